@@ -90,6 +90,7 @@ unique_fd fdevent_context::Destroy(fdevent* fde) {
     }
 
     this->Unregister(fde);
+    this->timeout_fdevents_.erase(fde);
 
     unique_fd fd = std::move(fde->fd);
 
@@ -113,6 +114,11 @@ void fdevent_context::SetTimeout(fdevent* fde, std::optional<std::chrono::millis
     CheckMainThread();
     fde->timeout = timeout;
     fde->last_active = std::chrono::steady_clock::now();
+    if (timeout) {
+        timeout_fdevents_.insert(fde);
+    } else {
+        timeout_fdevents_.erase(fde);
+    }
 }
 
 std::optional<std::chrono::milliseconds> fdevent_context::CalculatePollDuration() {
@@ -120,11 +126,10 @@ std::optional<std::chrono::milliseconds> fdevent_context::CalculatePollDuration(
     auto now = std::chrono::steady_clock::now();
     CheckMainThread();
 
-    for (const auto& [fd, fde] : this->installed_fdevents_) {
-        UNUSED(fd);
-        auto timeout_opt = fde.timeout;
+    for (const fdevent* fde : this->timeout_fdevents_) {
+        auto timeout_opt = fde->timeout;
         if (timeout_opt) {
-            auto deadline = fde.last_active + *timeout_opt;
+            auto deadline = fde->last_active + *timeout_opt;
             auto time_left = duration_cast<std::chrono::milliseconds>(deadline - now);
             if (time_left < 0ms) {
                 time_left = 0ms;
@@ -27,6 +27,7 @@
 #include <mutex>
 #include <optional>
 #include <unordered_map>
+#include <unordered_set>
 #include <variant>
 
 #include <android-base/thread_annotations.h>
@@ -129,6 +130,10 @@ struct fdevent_context {
   protected:
     std::unordered_map<int, fdevent> installed_fdevents_;
 
+    // The subset of installed_fdevents_ that have a timeout set, so that computing the poll
+    // duration and synthesizing FDE_TIMEOUT doesn't need to walk every installed fdevent.
+    std::unordered_set<fdevent*> timeout_fdevents_;
+
   private:
     uint64_t fdevent_id_ = 0;
     std::mutex run_queue_mutex_;
@@ -109,13 +109,18 @@ void fdevent_context_epoll::Loop() {
 
     std::vector<fdevent_event> fde_events;
     std::vector<epoll_event> epoll_events;
-    epoll_events.resize(this->installed_fdevents_.size());
 
     while (true) {
         if (terminate_loop_) {
             break;
         }
 
+        // Size the buffer to the number of installed fdevents, so that a single epoll_wait can
+        // drain every ready fd even when many transports are connected.
+        if (epoll_events.size() < this->installed_fdevents_.size()) {
+            epoll_events.resize(this->installed_fdevents_.size());
+        }
+
         int rc = -1;
         while (rc == -1) {
             std::optional<std::chrono::milliseconds> timeout = CalculatePollDuration();
@@ -132,6 +137,8 @@ void fdevent_context_epoll::Loop() {
             }
         }
 
+        // Only the fdevents that epoll reported, plus the ones with a timeout, can have events.
+        // Avoid walking every installed fdevent, which is O(sockets) per wakeup.
         auto post_poll = std::chrono::steady_clock::now();
         std::unordered_map<fdevent*, unsigned> event_map;
         for (int i = 0; i < rc; ++i) {
@@ -152,30 +159,26 @@ void fdevent_context_epoll::Loop() {
                 events |= FDE_READ | FDE_ERROR;
             }
 
-            event_map[fde] = events;
+            if (events != 0) {
+                event_map[fde] |= events;
+            }
         }
 
-        for (auto& [fd, fde] : installed_fdevents_) {
-            unsigned events = 0;
-            if (auto it = event_map.find(&fde); it != event_map.end()) {
-                events = it->second;
+        for (fdevent* fde : timeout_fdevents_) {
+            if (event_map.count(fde) != 0) {
+                continue;
             }
 
-            if (events == 0) {
-                if (fde.timeout) {
-                    auto deadline = fde.last_active + *fde.timeout;
-                    if (deadline < post_poll) {
-                        events |= FDE_TIMEOUT;
-                    }
-                }
+            auto deadline = fde->last_active + *fde->timeout;
+            if (deadline < post_poll) {
+                event_map[fde] = FDE_TIMEOUT;
             }
+        }
 
-            if (events != 0) {
-                LOG(DEBUG) << dump_fde(&fde) << " got events " << std::hex << std::showbase
-                           << events;
-                fde_events.push_back({&fde, events});
-                fde.last_active = post_poll;
-            }
+        for (auto& [fde, events] : event_map) {
+            LOG(DEBUG) << dump_fde(fde) << " got events " << std::hex << std::showbase << events;
+            fde_events.push_back({fde, events});
+            fde->last_active = post_poll;
         }
         this->HandleEvents(fde_events);
         fde_events.clear();
@@ -57,6 +57,7 @@
 #include <unwindstack/Unwinder.h>
 
 #include "libdebuggerd/backtrace.h"
+#include "libdebuggerd/stack_snapshot.h"
 #include "libdebuggerd/tombstone.h"
 #include "libdebuggerd/utility.h"
 
@@ -69,6 +70,11 @@
 using android::base::unique_fd;
 using android::base::StringPrintf;
 
+// How much of each thread's stack to copy for a backtrace, see below. This
+// covers the used part of a default-sized thread stack; frames beyond it are
+// cut off rather than read from the resumed process.
+static constexpr size_t kStackSnapshotSize = 1024 * 1024;
+
 static bool pid_contains_tid(int pid_proc_fd, pid_t tid) {
   struct stat st;
   std::string task_path = StringPrintf("task/%d", tid);
@@ -461,6 +467,9 @@ int main(int argc, char** argv) {
   siginfo_t siginfo;
   std::string error;
 
+  unwindstack::RemoteMaps snapshot_maps(target_process);
+  std::shared_ptr<StackSnapshotMemory> snapshot_memory;
+
   {
     ATRACE_NAME("ptrace");
     for (pid_t thread : threads) {
@@ -506,18 +515,56 @@ int main(int argc, char** argv) {
     }
   }
 
-  // Trace the pseudothread with PTRACE_O_TRACECLONE and tell it to fork.
-  if (!ptrace_seize_thread(target_proc_fd, pseudothread_tid, &error, PTRACE_O_TRACECLONE)) {
-    LOG(FATAL) << "failed to seize pseudothread: " << error;
-  }
+  // A backtrace only needs the threads' registers and stacks. Rather than
+  // have the process fork a copy of its address space, which can take a
+  // while for a large process, copy the stacks while the threads are
+  // stopped and unwind from that after letting them go.
+  bool snapshot_stacks = dump_type == kDebuggerdNativeBacktrace &&
+                         siginfo.si_signo == BIONIC_SIGNAL_DEBUGGER &&
+                         siginfo.si_value.sival_int == 1 &&
+                         android::base::GetBoolProperty("debug.debuggerd.snapshot_stacks", true);
+  pid_t vm_pid = -1;
+  if (snapshot_stacks) {
+    ATRACE_NAME("snapshot stacks");
+    if (!snapshot_maps.Parse()) {
+      LOG(FATAL) << "failed to read maps of " << target_process;
+    }
+    // Reads outside of the stacks, e.g. of JIT code or of ELFs that are only
+    // in memory, go to the live process. Open its memory while we're still
+    // attached and privileged, so that we can keep reading it after the
+    // threads resume and we drop our capabilities, even if the process isn't
+    // dumpable.
+    std::shared_ptr<unwindstack::Memory> process_memory;
+    unique_fd mem_fd(openat(target_proc_fd, "mem", O_RDONLY | O_CLOEXEC));
+    if (mem_fd != -1) {
+      process_memory = std::make_shared<ProcMemFdMemory>(std::move(mem_fd));
+    } else {
+      PLOG(WARNING) << "failed to open memory of " << target_process;
+      process_memory = unwindstack::Memory::CreateProcessMemory(target_process);
+    }
+    snapshot_memory = std::make_shared<StackSnapshotMemory>(process_memory);
+    snapshot_thread_stacks(snapshot_memory.get(), process_memory.get(), &snapshot_maps,
+                           thread_info, kStackSnapshotSize);
+    LOG(DEBUG) << "copied " << snapshot_memory->size() << " bytes of stack";
+
+    // Tell the pseudothread there's no need to fork.
+    if (TEMP_FAILURE_RETRY(write(output_pipe.get(), "\2", 1)) != 1) {
+      PLOG(FATAL) << "failed to write to pseudothread";
+    }
+  } else {
+    // Trace the pseudothread with PTRACE_O_TRACECLONE and tell it to fork.
+    if (!ptrace_seize_thread(target_proc_fd, pseudothread_tid, &error, PTRACE_O_TRACECLONE)) {
+      LOG(FATAL) << "failed to seize pseudothread: " << error;
+    }
 
-  if (TEMP_FAILURE_RETRY(write(output_pipe.get(), "\1", 1)) != 1) {
-    PLOG(FATAL) << "failed to write to pseudothread";
-  }
+    if (TEMP_FAILURE_RETRY(write(output_pipe.get(), "\1", 1)) != 1) {
+      PLOG(FATAL) << "failed to write to pseudothread";
+    }
 
-  pid_t vm_pid = wait_for_vm_process(pseudothread_tid);
-  if (ptrace(PTRACE_DETACH, pseudothread_tid, 0, 0) != 0) {
-    PLOG(FATAL) << "failed to detach from pseudothread";
+    vm_pid = wait_for_vm_process(pseudothread_tid);
+    if (ptrace(PTRACE_DETACH, pseudothread_tid, 0, 0) != 0) {
+      PLOG(FATAL) << "failed to detach from pseudothread";
+    }
   }
 
   // The pseudothread can die now.
@@ -587,26 +634,38 @@ int main(int argc, char** argv) {
   }
 
   // TODO: Use seccomp to lock ourselves down.
-  unwindstack::UnwinderFromPid unwinder(256, vm_pid);
-  if (!unwinder.Init(unwindstack::Regs::CurrentArch())) {
-    LOG(FATAL) << "Failed to init unwinder object.";
-  }
-
   std::string amfd_data;
-  if (backtrace) {
+  if (snapshot_stacks) {
     ATRACE_NAME("dump_backtrace");
+    auto arch = unwindstack::Regs::CurrentArch();
+    std::shared_ptr<unwindstack::Memory> process_memory = std::move(snapshot_memory);
+    unwindstack::Unwinder unwinder(256, &snapshot_maps, process_memory);
+    unwindstack::JitDebug jit_debug(process_memory);
+    unwinder.SetJitDebug(&jit_debug, arch);
+    unwindstack::DexFiles dex_files(process_memory);
+    unwinder.SetDexFiles(&dex_files, arch);
     dump_backtrace(std::move(g_output_fd), &unwinder, thread_info, g_target_thread);
   } else {
-    {
-      ATRACE_NAME("fdsan table dump");
-      populate_fdsan_table(&open_files, unwinder.GetProcessMemory(), fdsan_table_address);
+    unwindstack::UnwinderFromPid unwinder(256, vm_pid);
+    if (!unwinder.Init(unwindstack::Regs::CurrentArch())) {
+      LOG(FATAL) << "Failed to init unwinder object.";
     }
 
-    {
-      ATRACE_NAME("engrave_tombstone");
-      engrave_tombstone(std::move(g_output_fd), &unwinder, thread_info, g_target_thread,
-                        abort_msg_address, &open_files, &amfd_data, gwp_asan_state,
-                        gwp_asan_metadata);
+    if (backtrace) {
+      ATRACE_NAME("dump_backtrace");
+      dump_backtrace(std::move(g_output_fd), &unwinder, thread_info, g_target_thread);
+    } else {
+      {
+        ATRACE_NAME("fdsan table dump");
+        populate_fdsan_table(&open_files, unwinder.GetProcessMemory(), fdsan_table_address);
+      }
+
+      {
+        ATRACE_NAME("engrave_tombstone");
+        engrave_tombstone(std::move(g_output_fd), &unwinder, thread_info, g_target_thread,
+                          abort_msg_address, &open_files, &amfd_data, gwp_asan_state,
+                          gwp_asan_metadata);
+      }
     }
   }
 
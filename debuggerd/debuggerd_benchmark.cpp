@@ -18,6 +18,7 @@
 #include <errno.h>
 #include <sched.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -122,7 +123,23 @@ static void BM_maximum_pause_debuggerd(benchmark::State& state) {
   BM_maximum_pause_impl(state, []() { PerformDump(); });
 }
 
+// Forking a copy of the process takes longer the more memory it has mapped, so dump with
+// an extra 1GiB of touched memory, like a large process such as system_server has.
+static void BM_maximum_pause_debuggerd_large(benchmark::State& state) {
+  static constexpr size_t kSize = 1024 * 1024 * 1024;
+  void* map = mmap(nullptr, kSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) {
+    err(1, "mmap failed");
+  }
+  memset(map, 1, kSize);
+
+  BM_maximum_pause_impl(state, []() { PerformDump(); });
+
+  munmap(map, kSize);
+}
+
 BENCHMARK(BM_maximum_pause_noop)->Iterations(128)->UseManualTime();
 BENCHMARK(BM_maximum_pause_debuggerd)->Iterations(128)->UseManualTime();
+BENCHMARK(BM_maximum_pause_debuggerd_large)->Iterations(32)->UseManualTime();
 
 BENCHMARK_MAIN();
@@ -405,7 +405,7 @@ static int debuggerd_dispatch_pseudothread(void* arg) {
   output_read.reset();
 
   // crash_dump will ptrace and pause all of our threads, and then write to the pipe to tell
-  // us to fork off a process to read memory from.
+  // us to fork off a process to read memory from ('\1'), or that it copied all it needs ('\2').
   char buf[4];
   rc = TEMP_FAILURE_RETRY(read(input_read.get(), &buf, sizeof(buf)));
   if (rc == -1) {
@@ -418,13 +418,15 @@ static int debuggerd_dispatch_pseudothread(void* arg) {
     async_safe_format_log(ANDROID_LOG_FATAL, "libc",
                           "read of IPC pipe returned unexpected value: %zd", rc);
     return 1;
-  } else if (buf[0] != '\1') {
+  } else if (buf[0] != '\1' && buf[0] != '\2') {
     async_safe_format_log(ANDROID_LOG_FATAL, "libc", "crash_dump helper reported failure");
     return 1;
   }
 
-  // crash_dump is ptracing us, fork off a copy of our address space for it to use.
-  create_vm_process();
+  if (buf[0] == '\1') {
+    // crash_dump is ptracing us, fork off a copy of our address space for it to use.
+    create_vm_process();
+  }
 
   // Don't leave a zombie child.
   int status;
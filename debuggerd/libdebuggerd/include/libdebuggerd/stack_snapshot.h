@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <android-base/unique_fd.h>
+#include <unwindstack/Memory.h>
+
+#include "types.h"
+
+namespace unwindstack {
+class Maps;
+}
+
+// Memory of a process that has been resumed, made of the copies of its
+// memory taken while it was stopped. Reads outside of the copies go to
+// |fallback|, which can be null, unless they are in a range excluded with
+// ExcludeFromFallback().
+class StackSnapshotMemory : public unwindstack::Memory {
+ public:
+  explicit StackSnapshotMemory(std::shared_ptr<unwindstack::Memory> fallback)
+      : fallback_(std::move(fallback)) {}
+  virtual ~StackSnapshotMemory() = default;
+
+  // Copies the parts of [start, end) that aren't held yet out of |source|,
+  // stopping at the first unreadable byte. Returns the number of bytes copied.
+  size_t Copy(unwindstack::Memory* source, uint64_t start, uint64_t end);
+
+  // Makes reads in [start, end) that aren't covered by a copy fail instead of
+  // going to the fallback, for memory the process keeps changing, such as its
+  // stacks, where live data would not match the copies.
+  void ExcludeFromFallback(uint64_t start, uint64_t end);
+
+  size_t Read(uint64_t addr, void* dst, size_t size) override;
+
+  size_t size() const { return size_; }
+
+ private:
+  // start address -> copied bytes, the ranges don't overlap.
+  std::map<uint64_t, std::vector<uint8_t>> ranges_;
+  size_t size_ = 0;
+  // start address -> end address of the ranges excluded from the fallback.
+  std::map<uint64_t, uint64_t> excluded_;
+  std::shared_ptr<unwindstack::Memory> fallback_;
+};
+
+// Reads the memory of a process through an open /proc/<pid>/mem. Access is
+// checked when the file is opened, so reads keep working after crash_dump
+// has detached from the process and dropped its capabilities, even if the
+// process isn't dumpable.
+class ProcMemFdMemory : public unwindstack::Memory {
+ public:
+  explicit ProcMemFdMemory(android::base::unique_fd fd) : fd_(std::move(fd)) {}
+  virtual ~ProcMemFdMemory() = default;
+
+  size_t Read(uint64_t addr, void* dst, size_t size) override;
+
+ private:
+  android::base::unique_fd fd_;
+};
+
+// Copies what an unwind of each thread reads from its stack, from just below
+// the stack pointer up to the end of the stack mapping, but no more than
+// |max_size| bytes per thread. The rest of each stack mapping is excluded
+// from the snapshot's fallback.
+void snapshot_thread_stacks(StackSnapshotMemory* snapshot, unwindstack::Memory* process_memory,
+                            unwindstack::Maps* maps,
+                            const std::map<pid_t, ThreadInfo>& thread_info, size_t max_size);
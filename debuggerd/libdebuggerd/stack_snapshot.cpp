@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "DEBUG"
+
+#include "libdebuggerd/stack_snapshot.h"
+
+#include <inttypes.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <log/log.h>
+#include <unwindstack/MapInfo.h>
+#include <unwindstack/Maps.h>
+
+// Leaf functions may keep data below the stack pointer (128 bytes on x86_64).
+static constexpr uint64_t kRedZoneSize = 128;
+
+size_t StackSnapshotMemory::Copy(unwindstack::Memory* source, uint64_t start, uint64_t end) {
+  auto next = ranges_.upper_bound(start);
+  if (next != ranges_.begin()) {
+    auto prev = std::prev(next);
+    start = std::max(start, prev->first + prev->second.size());
+  }
+
+  // Fill each gap between the ranges already held.
+  size_t copied = 0;
+  while (start < end) {
+    uint64_t gap_end = end;
+    if (next != ranges_.end()) {
+      gap_end = std::min(end, next->first);
+    }
+    if (start < gap_end) {
+      std::vector<uint8_t> data(gap_end - start);
+      data.resize(source->Read(start, data.data(), data.size()));
+      size_t read = data.size();
+      if (read != 0) {
+        size_ += read;
+        copied += read;
+        ranges_.emplace_hint(next, start, std::move(data));
+      }
+      if (read != gap_end - start) {
+        break;
+      }
+    }
+    if (next == ranges_.end()) {
+      break;
+    }
+    start = next->first + next->second.size();
+    ++next;
+  }
+  return copied;
+}
+
+void StackSnapshotMemory::ExcludeFromFallback(uint64_t start, uint64_t end) {
+  uint64_t& excluded_end = excluded_[start];
+  excluded_end = std::max(excluded_end, end);
+}
+
+size_t StackSnapshotMemory::Read(uint64_t addr, void* dst, size_t size) {
+  uint8_t* out = static_cast<uint8_t*>(dst);
+  size_t bytes = 0;
+  while (bytes < size) {
+    uint64_t cur = addr + bytes;
+    if (cur < addr) {
+      break;
+    }
+
+    auto next = ranges_.upper_bound(cur);
+    if (next != ranges_.begin()) {
+      auto prev = std::prev(next);
+      uint64_t offset = cur - prev->first;
+      if (offset < prev->second.size()) {
+        size_t len = std::min(size - bytes, prev->second.size() - offset);
+        memcpy(out + bytes, prev->second.data() + offset, len);
+        bytes += len;
+        continue;
+      }
+    }
+
+    // Not copied. Memory excluded from the fallback can't be read at all.
+    auto excluded = excluded_.upper_bound(cur);
+    if (excluded != excluded_.begin() && cur < std::prev(excluded)->second) {
+      break;
+    }
+
+    // Read up to the next copied or excluded range from the fallback.
+    size_t len = size - bytes;
+    if (next != ranges_.end()) {
+      len = std::min<uint64_t>(len, next->first - cur);
+    }
+    if (excluded != excluded_.end()) {
+      len = std::min<uint64_t>(len, excluded->first - cur);
+    }
+    size_t read = fallback_ ? fallback_->Read(cur, out + bytes, len) : 0;
+    bytes += read;
+    if (read != len) {
+      break;
+    }
+  }
+  return bytes;
+}
+
+size_t ProcMemFdMemory::Read(uint64_t addr, void* dst, size_t size) {
+  uint8_t* out = static_cast<uint8_t*>(dst);
+  size_t bytes = 0;
+  while (bytes < size) {
+    uint64_t cur = addr + bytes;
+    if (cur < addr || cur > static_cast<uint64_t>(INT64_MAX)) {
+      break;
+    }
+    ssize_t rc = TEMP_FAILURE_RETRY(pread64(fd_.get(), out + bytes, size - bytes, cur));
+    if (rc <= 0) {
+      break;
+    }
+    bytes += rc;
+  }
+  return bytes;
+}
+
+void snapshot_thread_stacks(StackSnapshotMemory* snapshot, unwindstack::Memory* process_memory,
+                            unwindstack::Maps* maps,
+                            const std::map<pid_t, ThreadInfo>& thread_info, size_t max_size) {
+  for (const auto& [tid, info] : thread_info) {
+    uint64_t sp = info.registers->sp();
+    unwindstack::MapInfo* map_info = maps->Find(sp);
+    if (map_info == nullptr) {
+      ALOGW("no mapping for the stack of thread %d (sp = 0x%" PRIx64 ")", tid, sp);
+      continue;
+    }
+
+    // The live stack no longer matches the copy once the thread runs again.
+    snapshot->ExcludeFromFallback(map_info->start, map_info->end);
+
+    uint64_t start = std::max(map_info->start, sp - std::min(sp, kRedZoneSize));
+    uint64_t end = std::min(map_info->end, start + max_size);
+    snapshot->Copy(process_memory, start, end);
+  }
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <unwindstack/Memory.h>
+
+#include "libdebuggerd/stack_snapshot.h"
+
+class StackSnapshotTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // The "process" has 0x3000 bytes at 0x10000, the byte at each address is
+    // the low byte of the address.
+    data_.resize(0x3000);
+    for (size_t i = 0; i < data_.size(); i++) {
+      data_[i] = static_cast<uint8_t>(i);
+    }
+    process_ = unwindstack::Memory::CreateOfflineMemory(data_.data(), 0x10000,
+                                                        0x10000 + data_.size());
+  }
+
+  std::vector<uint8_t> data_;
+  std::shared_ptr<unwindstack::Memory> process_;
+};
+
+TEST_F(StackSnapshotTest, read_copied) {
+  StackSnapshotMemory snapshot(nullptr);
+  ASSERT_EQ(0x100U, snapshot.Copy(process_.get(), 0x10100, 0x10200));
+  ASSERT_EQ(0x100U, snapshot.size());
+
+  // Change the process, the snapshot must not see it.
+  data_[0x150] = 0xff;
+
+  uint8_t buf[0x20];
+  ASSERT_EQ(sizeof(buf), snapshot.Read(0x10140, buf, sizeof(buf)));
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    ASSERT_EQ(static_cast<uint8_t>(0x40 + i), buf[i]) << "at " << i;
+  }
+
+  // Nothing outside of what was copied.
+  ASSERT_EQ(0U, snapshot.Read(0x10000, buf, sizeof(buf)));
+  ASSERT_EQ(0x10U, snapshot.Read(0x101f0, buf, sizeof(buf)));
+}
+
+TEST_F(StackSnapshotTest, read_fallback) {
+  StackSnapshotMemory snapshot(process_);
+  ASSERT_EQ(0x100U, snapshot.Copy(process_.get(), 0x10100, 0x10200));
+  data_[0x0f8] = 0xaa;
+  data_[0x108] = 0xbb;
+  data_[0x208] = 0xcc;
+
+  // A read across both ends of the copy takes the live memory around it.
+  std::vector<uint8_t> buf(0x120);
+  ASSERT_EQ(buf.size(), snapshot.Read(0x100f0, buf.data(), buf.size()));
+  ASSERT_EQ(0xaa, buf[0x08]);
+  ASSERT_EQ(0x08, buf[0x18]);
+  ASSERT_EQ(0xcc, buf[0x118]);
+
+  // Reads stop where the process memory ends.
+  ASSERT_EQ(0x10U, snapshot.Read(0x12ff0, buf.data(), 0x20));
+}
+
+TEST_F(StackSnapshotTest, copy_overlapping) {
+  StackSnapshotMemory snapshot(nullptr);
+  ASSERT_EQ(0x100U, snapshot.Copy(process_.get(), 0x10100, 0x10200));
+  ASSERT_EQ(0U, snapshot.Copy(process_.get(), 0x10180, 0x10200));
+  ASSERT_EQ(0x80U, snapshot.Copy(process_.get(), 0x10080, 0x10180));
+  ASSERT_EQ(0x80U, snapshot.Copy(process_.get(), 0x10180, 0x10280));
+  ASSERT_EQ(0x200U, snapshot.size());
+
+  std::vector<uint8_t> buf(0x200);
+  ASSERT_EQ(buf.size(), snapshot.Read(0x10080, buf.data(), buf.size()));
+  for (size_t i = 0; i < buf.size(); i++) {
+    ASSERT_EQ(static_cast<uint8_t>(0x80 + i), buf[i]) << "at " << i;
+  }
+}
+
+TEST_F(StackSnapshotTest, copy_spanning) {
+  StackSnapshotMemory snapshot(nullptr);
+  ASSERT_EQ(0x100U, snapshot.Copy(process_.get(), 0x10100, 0x10200));
+  ASSERT_EQ(0x100U, snapshot.Copy(process_.get(), 0x10300, 0x10400));
+
+  // Both sides of and the gap between the ranges already held are copied.
+  ASSERT_EQ(0x300U, snapshot.Copy(process_.get(), 0x10000, 0x10500));
+  ASSERT_EQ(0x500U, snapshot.size());
+
+  std::vector<uint8_t> buf(0x500);
+  ASSERT_EQ(buf.size(), snapshot.Read(0x10000, buf.data(), buf.size()));
+  for (size_t i = 0; i < buf.size(); i++) {
+    ASSERT_EQ(static_cast<uint8_t>(i), buf[i]) << "at " << i;
+  }
+}
+
+TEST_F(StackSnapshotTest, read_excluded) {
+  StackSnapshotMemory snapshot(process_);
+  snapshot.ExcludeFromFallback(0x11000, 0x12000);
+  ASSERT_EQ(0x100U, snapshot.Copy(process_.get(), 0x11800, 0x11900));
+
+  // Copied parts of an excluded range are readable, the rest is not.
+  uint8_t buf[0x20];
+  ASSERT_EQ(sizeof(buf), snapshot.Read(0x11800, buf, sizeof(buf)));
+  ASSERT_EQ(0U, snapshot.Read(0x11000, buf, sizeof(buf)));
+  ASSERT_EQ(0x10U, snapshot.Read(0x118f0, buf, sizeof(buf)));
+
+  // Reads from the fallback stop where an excluded range starts.
+  ASSERT_EQ(0x10U, snapshot.Read(0x10ff0, buf, sizeof(buf)));
+  ASSERT_EQ(sizeof(buf), snapshot.Read(0x12000, buf, sizeof(buf)));
+}
+
+TEST_F(StackSnapshotTest, copy_truncated) {
+  StackSnapshotMemory snapshot(nullptr);
+  ASSERT_EQ(0x100U, snapshot.Copy(process_.get(), 0x12f00, 0x13100));
+  ASSERT_EQ(0U, snapshot.Copy(process_.get(), 0x20000, 0x21000));
+  ASSERT_EQ(0x100U, snapshot.size());
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright 2026, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <deque>
+#include <optional>
+#include <utility>
+
+// Requests waiting for their turn. The lowest priority value is served first,
+// and requests of equal priority in the order they arrived. At most |capacity|
+// requests are held: going over drops the last one, the newest of the least
+// important.
+template <typename T>
+class PendingQueue {
+ public:
+  explicit PendingQueue(size_t capacity) : capacity_(capacity) {}
+
+  // Returns the request dropped to stay within capacity, if any.
+  std::optional<T> push(T value, int priority) {
+    auto it = std::upper_bound(
+        entries_.begin(), entries_.end(), priority,
+        [](int lhs, const std::pair<int, T>& rhs) { return lhs < rhs.first; });
+    entries_.insert(it, std::make_pair(priority, std::move(value)));
+
+    if (entries_.size() <= capacity_) {
+      return std::nullopt;
+    }
+    T dropped = std::move(entries_.back().second);
+    entries_.pop_back();
+    return dropped;
+  }
+
+  T pop() {
+    T value = std::move(entries_.front().second);
+    entries_.pop_front();
+    return value;
+  }
+
+  bool empty() const { return entries_.empty(); }
+  size_t size() const { return entries_.size(); }
+
+ private:
+  const size_t capacity_;
+  std::deque<std::pair<int, T>> entries_;
+};
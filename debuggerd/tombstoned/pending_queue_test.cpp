@@ -0,0 +1,57 @@
+/*
+ * Copyright 2026, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <gtest/gtest.h>
+
+#include "pending_queue.h"
+
+TEST(PendingQueueTest, serves_most_important_first) {
+  PendingQueue<int> queue(8);
+  ASSERT_FALSE(queue.push(1, 900));
+  ASSERT_FALSE(queue.push(2, -900));
+  ASSERT_FALSE(queue.push(3, 0));
+  ASSERT_FALSE(queue.push(4, -900));
+  ASSERT_EQ(4U, queue.size());
+
+  // Equal priorities keep their arrival order.
+  EXPECT_EQ(2, queue.pop());
+  EXPECT_EQ(4, queue.pop());
+  EXPECT_EQ(3, queue.pop());
+  EXPECT_EQ(1, queue.pop());
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(PendingQueueTest, drops_least_important) {
+  PendingQueue<int> queue(2);
+  ASSERT_FALSE(queue.push(1, 100));
+  ASSERT_FALSE(queue.push(2, 100));
+
+  // The newest of the least important goes.
+  EXPECT_EQ(std::optional<int>(2), queue.push(3, 0));
+  // A request less important than everything queued is dropped itself.
+  EXPECT_EQ(std::optional<int>(4), queue.push(4, 200));
+  ASSERT_EQ(2U, queue.size());
+
+  EXPECT_EQ(3, queue.pop());
+  EXPECT_EQ(1, queue.pop());
+  EXPECT_TRUE(queue.empty());
+}
+
+TEST(PendingQueueTest, zero_capacity) {
+  PendingQueue<int> queue(0);
+  EXPECT_EQ(std::optional<int>(1), queue.push(1, 0));
+  EXPECT_TRUE(queue.empty());
+}
@@ -21,8 +21,11 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
-#include <deque>
+#include <chrono>
+#include <limits>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -32,9 +35,12 @@
 #include <event2/thread.h>
 
 #include <android-base/cmsg.h>
+#include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
+#include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 #include <cutils/sockets.h>
 
@@ -44,8 +50,11 @@
 #include "util.h"
 
 #include "intercept_manager.h"
+#include "pending_queue.h"
 
 using android::base::GetIntProperty;
+using android::base::ParseInt;
+using android::base::ReadFileToString;
 using android::base::SendFileDescriptors;
 using android::base::StringPrintf;
 using android::base::unique_fd;
@@ -70,19 +79,49 @@ struct Crash {
   event* crash_event = nullptr;
 
   DebuggerdDumpType crash_type;
+
+  // The crashing process's oom_score_adj, lower is more important.
+  int crash_priority = 0;
+  std::chrono::steady_clock::time_point crash_received_time;
+  std::chrono::steady_clock::time_point crash_started_time;
+};
+
+// Queued requests are served most important first, going by how important
+// the system thinks the process is. A process that's gone goes last.
+static int get_crash_priority(pid_t pid) {
+  std::string content;
+  int oom_score_adj;
+  if (!ReadFileToString(StringPrintf("/proc/%d/oom_score_adj", pid), &content) ||
+      !ParseInt(android::base::Trim(content), &oom_score_adj)) {
+    return std::numeric_limits<int>::max();
+  }
+  return oom_score_adj;
+}
+
+// Counters for one burst of requests, from the first request to the queue
+// going idle.
+struct CrashQueueStats {
+  size_t completed = 0;
+  size_t dropped = 0;
+  size_t max_queued = 0;
+  std::chrono::milliseconds total_wait{0};
+  std::chrono::milliseconds max_wait{0};
+  std::chrono::milliseconds total_dump{0};
+  std::chrono::milliseconds max_dump{0};
 };
 
 class CrashQueue {
  public:
   CrashQueue(const std::string& dir_path, const std::string& file_name_prefix, size_t max_artifacts,
-             size_t max_concurrent_dumps)
+             size_t max_concurrent_dumps, size_t max_queued_dumps)
       : file_name_prefix_(file_name_prefix),
         dir_path_(dir_path),
         dir_fd_(open(dir_path.c_str(), O_DIRECTORY | O_RDONLY | O_CLOEXEC)),
         max_artifacts_(max_artifacts),
         next_artifact_(0),
         max_concurrent_dumps_(max_concurrent_dumps),
-        num_concurrent_dumps_(0) {
+        num_concurrent_dumps_(0),
+        queued_requests_(max_queued_dumps) {
     if (dir_fd_ == -1) {
       PLOG(FATAL) << "failed to open directory: " << dir_path;
     }
@@ -99,16 +138,21 @@ class CrashQueue {
   }
 
   static CrashQueue* for_tombstones() {
+    // At least two, so that there's room for a concurrent dump.
+    static size_t max_tombstones =
+        GetIntProperty("tombstoned.max_tombstone_count", size_t(32), size_t(2));
     static CrashQueue queue("/data/tombstones", "tombstone_" /* file_name_prefix */,
-                            GetIntProperty("tombstoned.max_tombstone_count", 32),
-                            1 /* max_concurrent_dumps */);
+                            max_tombstones,
+                            GetIntProperty("tombstoned.max_concurrent_tombstones", size_t(4),
+                                           size_t(1), max_tombstones - 1),
+                            GetIntProperty("tombstoned.max_queued_tombstones", 32));
     return &queue;
   }
 
   static CrashQueue* for_anrs() {
     static CrashQueue queue("/data/anr", "trace_" /* file_name_prefix */,
                             GetIntProperty("tombstoned.max_anr_count", 64),
-                            4 /* max_concurrent_dumps */);
+                            4 /* max_concurrent_dumps */, 32 /* max_queued_dumps */);
     return &queue;
   }
 
@@ -137,26 +181,70 @@ class CrashQueue {
     return file_name;
   }
 
+  // Returns true if the crash was queued, or dropped because the queue is full.
   bool maybe_enqueue_crash(Crash* crash) {
-    if (num_concurrent_dumps_ == max_concurrent_dumps_) {
-      queued_requests_.push_back(crash);
-      return true;
+    if (num_concurrent_dumps_ < max_concurrent_dumps_) {
+      return false;
     }
 
-    return false;
+    std::optional<Crash*> dropped = queued_requests_.push(crash, crash->crash_priority);
+    LOG(INFO) << "enqueueing crash request for pid " << crash->crash_pid << " ("
+              << queued_requests_.size() << " queued)";
+
+    if (dropped) {
+      // Let the least important crash go without a dump from us, rather than
+      // keep it waiting. Closing its socket tells crash_dump to carry on
+      // without an output file.
+      LOG(WARNING) << "too many queued crash requests, dropping request for pid "
+                   << (*dropped)->crash_pid;
+      ++stats_.dropped;
+      delete *dropped;
+    }
+    stats_.max_queued = std::max(stats_.max_queued, queued_requests_.size());
+    return true;
   }
 
   void maybe_dequeue_crashes(void (*handler)(Crash* crash)) {
     while (!queued_requests_.empty() && num_concurrent_dumps_ < max_concurrent_dumps_) {
-      Crash* next_crash = queued_requests_.front();
-      queued_requests_.pop_front();
-      handler(next_crash);
+      handler(queued_requests_.pop());
     }
   }
 
-  void on_crash_started() { ++num_concurrent_dumps_; }
+  void on_crash_started(Crash* crash) {
+    ++num_concurrent_dumps_;
+    crash->crash_started_time = std::chrono::steady_clock::now();
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(crash->crash_started_time -
+                                                                      crash->crash_received_time);
+    stats_.total_wait += wait;
+    stats_.max_wait = std::max(stats_.max_wait, wait);
+  }
 
-  void on_crash_completed() { --num_concurrent_dumps_; }
+  void on_crash_completed(Crash* crash) {
+    --num_concurrent_dumps_;
+    auto dump = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - crash->crash_started_time);
+    ++stats_.completed;
+    stats_.total_dump += dump;
+    stats_.max_dump = std::max(stats_.max_dump, dump);
+    LOG(INFO) << "dump for pid " << crash->crash_pid << " took " << dump.count() << "ms, "
+              << num_concurrent_dumps_ << " running, " << queued_requests_.size() << " queued";
+  }
+
+  // Once the queue is idle, log the counters of the requests since it last was.
+  void maybe_report_stats() {
+    if (num_concurrent_dumps_ != 0 || !queued_requests_.empty()) {
+      return;
+    }
+    if (stats_.max_queued != 0) {
+      LOG(INFO) << dir_path_ << ": " << stats_.completed << " dumps, " << stats_.dropped
+                << " dropped, up to " << stats_.max_queued << " queued, wait avg "
+                << (stats_.total_wait / stats_.completed).count() << "ms max "
+                << stats_.max_wait.count() << "ms, dump avg "
+                << (stats_.total_dump / stats_.completed).count() << "ms max "
+                << stats_.max_dump.count() << "ms";
+    }
+    stats_ = {};
+  }
 
  private:
   void find_oldest_artifact() {
@@ -196,7 +284,9 @@ class CrashQueue {
   const size_t max_concurrent_dumps_;
   size_t num_concurrent_dumps_;
 
-  std::deque<Crash*> queued_requests_;
+  PendingQueue<Crash*> queued_requests_;
+
+  CrashQueueStats stats_;
 
   DISALLOW_COPY_AND_ASSIGN(CrashQueue);
 };
@@ -246,7 +336,7 @@ static void perform_request(Crash* crash) {
     event_add(crash->crash_event, &timeout);
   }
 
-  CrashQueue::for_crash(crash)->on_crash_started();
+  CrashQueue::for_crash(crash)->on_crash_started(crash);
   return;
 
 fail:
@@ -321,10 +411,10 @@ static void crash_request_cb(evutil_socket_t sockfd, short ev, void* arg) {
   }
 
   LOG(INFO) << "received crash request for pid " << crash->crash_pid;
+  crash->crash_priority = get_crash_priority(crash->crash_pid);
+  crash->crash_received_time = std::chrono::steady_clock::now();
 
-  if (CrashQueue::for_crash(crash)->maybe_enqueue_crash(crash)) {
-    LOG(INFO) << "enqueueing crash request for pid " << crash->crash_pid;
-  } else {
+  if (!CrashQueue::for_crash(crash)->maybe_enqueue_crash(crash)) {
     perform_request(crash);
   }
 
@@ -339,7 +429,7 @@ static void crash_completed_cb(evutil_socket_t sockfd, short ev, void* arg) {
   Crash* crash = static_cast<Crash*>(arg);
   TombstonedCrashPacket request = {};
 
-  CrashQueue::for_crash(crash)->on_crash_completed();
+  CrashQueue::for_crash(crash)->on_crash_completed(crash);
 
   if ((ev & EV_READ) == 0) {
     goto fail;
@@ -401,6 +491,7 @@ fail:
 
   // If there's something queued up, let them proceed.
   queue->maybe_dequeue_crashes(perform_request);
+  queue->maybe_report_stats();
 }
 
 int main(int, char* []) {
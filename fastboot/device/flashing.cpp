@@ -16,6 +16,8 @@
 #include "flashing.h"
 
 #include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
@@ -72,76 +74,191 @@ void WipeOverlayfsForPartition(FastbootDevice* device, const std::string& partit
     }
 }
 
-}  // namespace
+// Writes flashed data to a block device through a page-aligned staging buffer, so that the
+// device can be switched to O_DIRECT. Large images then go straight to the device instead of
+// filling the page cache in recovery, where memory is tight, and the final close does not stall
+// on writeback. If an unaligned write is ever needed, or the device rejects a direct write, it
+// falls back to buffered I/O.
+class BlockDeviceWriter {
+  public:
+    explicit BlockDeviceWriter(int fd) : fd_(fd) {}
+    ~BlockDeviceWriter() {
+        if (direct_) {
+            fcntl(fd_, F_SETFL, flags_);
+        }
+    }
+
+    bool Init() {
+        offset_ = lseek64(fd_, 0, SEEK_CUR);
+        if (offset_ < 0) {
+            PLOG(ERROR) << "lseek64 failed";
+            return false;
+        }
+        void* buffer;
+        if (posix_memalign(&buffer, kAlignment, kBufferSize)) {
+            LOG(ERROR) << "Failed to allocate " << kBufferSize << " byte flash buffer";
+            return false;
+        }
+        buffer_.reset(static_cast<char*>(buffer));
+
+        flags_ = fcntl(fd_, F_GETFL);
+        direct_ = flags_ >= 0 && fcntl(fd_, F_SETFL, flags_ | O_DIRECT) == 0;
+        return true;
+    }
 
-int FlashRawDataChunk(int fd, const char* data, size_t len) {
-    size_t ret = 0;
-    while (ret < len) {
-        int this_len = std::min(static_cast<size_t>(1048576UL * 8), len - ret);
-        int this_ret = write(fd, data, this_len);
-        if (this_ret < 0) {
-            PLOG(ERROR) << "Failed to flash data of len " << len;
-            return -1;
+    int Write(const char* data, size_t len) {
+        while (len > 0) {
+            size_t to_copy = std::min(kBufferSize - used_, len);
+            if (data) {
+                memcpy(buffer_.get() + used_, data, to_copy);
+                data += to_copy;
+            } else {
+                memset(buffer_.get() + used_, 0, to_copy);
+            }
+            used_ += to_copy;
+            len -= to_copy;
+            if (used_ == kBufferSize) {
+                if (int ret = Flush(); ret < 0) {
+                    return ret;
+                }
+            }
         }
-        data += this_ret;
-        ret += this_ret;
+        return 0;
     }
-    return 0;
-}
 
-int FlashRawData(int fd, const std::vector<char>& downloaded_data) {
-    int ret = FlashRawDataChunk(fd, downloaded_data.data(), downloaded_data.size());
-    if (ret < 0) {
-        return -errno;
+    int WriteZeroes(size_t len) { return Write(nullptr, len); }
+
+    int Skip(size_t len) {
+        if (int ret = Flush(); ret < 0) {
+            return ret;
+        }
+        offset_ += len;
+        return 0;
+    }
+
+    int Seek(off64_t offset) {
+        if (int ret = Flush(); ret < 0) {
+            return ret;
+        }
+        offset_ = offset;
+        return 0;
     }
-    return ret;
+
+    int Flush() {
+        if (used_ == 0) {
+            return 0;
+        }
+        if (direct_ && (used_ % kAlignment || offset_ % kAlignment)) {
+            DisableDirectIo();
+        }
+
+        const char* data = buffer_.get();
+        size_t remaining = used_;
+        while (remaining > 0) {
+            ssize_t rv = TEMP_FAILURE_RETRY(pwrite64(fd_, data, remaining, offset_));
+            if (rv < 0 && errno == EINVAL && direct_) {
+                // Some devices have stricter alignment rules than kAlignment, and a short write
+                // can leave the rest of the buffer misaligned. Retry without O_DIRECT.
+                DisableDirectIo();
+                continue;
+            }
+            if (rv < 0) {
+                PLOG(ERROR) << "Failed to flash data of len " << remaining;
+                return -errno;
+            }
+            data += rv;
+            remaining -= rv;
+            offset_ += rv;
+        }
+        used_ = 0;
+        return 0;
+    }
+
+  private:
+    void DisableDirectIo() {
+        fcntl(fd_, F_SETFL, flags_);
+        direct_ = false;
+    }
+
+    static constexpr size_t kAlignment = 4096;
+    static constexpr size_t kBufferSize = 8 * 1024 * 1024;
+
+    int fd_;
+    int flags_ = 0;
+    bool direct_ = false;
+    off64_t offset_ = 0;
+    std::unique_ptr<char, decltype(&free)> buffer_{nullptr, &free};
+    size_t used_ = 0;
+};
+
+}  // namespace
+
+int FlashRawData(BlockDeviceWriter* writer, const std::vector<char>& downloaded_data,
+                 uint64_t avb_footer_device_size) {
+    if (int ret = writer->Write(downloaded_data.data(), downloaded_data.size()); ret < 0) {
+        return ret;
+    }
+    if (avb_footer_device_size > downloaded_data.size()) {
+        // Copy the AVB footer from the end of the data to the end of the block device, zeroing
+        // the space in between, without growing the download buffer to the partition size. If
+        // there is less than a footer's worth of room, the footer overlaps the end of the data.
+        uint64_t footer_offset = avb_footer_device_size - AVB_FOOTER_SIZE;
+        const char* footer = downloaded_data.data() + downloaded_data.size() - AVB_FOOTER_SIZE;
+        if (footer_offset >= downloaded_data.size()) {
+            if (int ret = writer->WriteZeroes(footer_offset - downloaded_data.size()); ret < 0) {
+                return ret;
+            }
+        } else if (int ret = writer->Seek(footer_offset); ret < 0) {
+            return ret;
+        }
+        if (int ret = writer->Write(footer, AVB_FOOTER_SIZE); ret < 0) {
+            return ret;
+        }
+    }
+    return writer->Flush();
 }
 
 int WriteCallback(void* priv, const void* data, size_t len) {
-    int fd = reinterpret_cast<long long>(priv);
+    BlockDeviceWriter* writer = reinterpret_cast<BlockDeviceWriter*>(priv);
     if (!data) {
-        return lseek64(fd, len, SEEK_CUR) >= 0 ? 0 : -errno;
+        return writer->Skip(len);
     }
-    return FlashRawDataChunk(fd, reinterpret_cast<const char*>(data), len);
+    return writer->Write(reinterpret_cast<const char*>(data), len);
 }
 
-int FlashSparseData(int fd, std::vector<char>& downloaded_data) {
+int FlashSparseData(BlockDeviceWriter* writer, std::vector<char>& downloaded_data) {
     struct sparse_file* file = sparse_file_import_buf(downloaded_data.data(), true, false);
     if (!file) {
         return -ENOENT;
     }
-    return sparse_file_callback(file, false, false, WriteCallback, reinterpret_cast<void*>(fd));
+    int ret = sparse_file_callback(file, false, false, WriteCallback, writer);
+    sparse_file_destroy(file);
+    if (ret < 0) {
+        return ret;
+    }
+    return writer->Flush();
 }
 
-int FlashBlockDevice(int fd, std::vector<char>& downloaded_data) {
+int FlashBlockDevice(int fd, std::vector<char>& downloaded_data, uint64_t avb_footer_device_size) {
     lseek64(fd, 0, SEEK_SET);
+    BlockDeviceWriter writer(fd);
+    if (!writer.Init()) {
+        return -ENOMEM;
+    }
     if (downloaded_data.size() >= sizeof(SPARSE_HEADER_MAGIC) &&
         *reinterpret_cast<uint32_t*>(downloaded_data.data()) == SPARSE_HEADER_MAGIC) {
-        return FlashSparseData(fd, downloaded_data);
+        return FlashSparseData(&writer, downloaded_data);
     } else {
-        return FlashRawData(fd, downloaded_data);
+        return FlashRawData(&writer, downloaded_data, avb_footer_device_size);
     }
 }
 
-static void CopyAVBFooter(std::vector<char>* data, const uint64_t block_device_size) {
-    if (data->size() < AVB_FOOTER_SIZE) {
-        return;
-    }
-    std::string footer;
-    uint64_t footer_offset = data->size() - AVB_FOOTER_SIZE;
-    for (int idx = 0; idx < AVB_FOOTER_MAGIC_LEN; idx++) {
-        footer.push_back(data->at(footer_offset + idx));
-    }
-    if (0 != footer.compare(AVB_FOOTER_MAGIC)) {
-        return;
-    }
-
-    // copy AVB footer from end of data to end of block device
-    uint64_t original_data_size = data->size();
-    data->resize(block_device_size, 0);
-    for (int idx = 0; idx < AVB_FOOTER_SIZE; idx++) {
-        data->at(block_device_size - 1 - idx) = data->at(original_data_size - 1 - idx);
+static bool HasAVBFooter(const std::vector<char>& data) {
+    if (data.size() < AVB_FOOTER_SIZE) {
+        return false;
     }
+    uint64_t footer_offset = data.size() - AVB_FOOTER_SIZE;
+    return memcmp(data.data() + footer_offset, AVB_FOOTER_MAGIC, AVB_FOOTER_MAGIC_LEN) == 0;
 }
 
 int Flash(FastbootDevice* device, const std::string& partition_name) {
@@ -155,15 +272,17 @@ int Flash(FastbootDevice* device, const std::string& partition_name) {
         return -EINVAL;
     }
     uint64_t block_device_size = get_block_device_size(handle.fd());
+    uint64_t avb_footer_device_size = 0;
     if (data.size() > block_device_size) {
         return -EOVERFLOW;
     } else if (data.size() < block_device_size &&
                (partition_name == "boot" || partition_name == "boot_a" ||
-                partition_name == "boot_b")) {
-        CopyAVBFooter(&data, block_device_size);
+                partition_name == "boot_b") &&
+               HasAVBFooter(data)) {
+        avb_footer_device_size = block_device_size;
     }
     WipeOverlayfsForPartition(device, partition_name);
-    return FlashBlockDevice(handle.fd(), data);
+    return FlashBlockDevice(handle.fd(), data, avb_footer_device_size);
 }
 
 bool UpdateSuper(FastbootDevice* device, const std::string& super_name, bool wipe) {
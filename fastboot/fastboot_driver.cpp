@@ -35,9 +35,13 @@
 #include <string.h>
 #include <algorithm>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <regex>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -53,6 +57,71 @@ using android::base::StringPrintf;
 
 namespace fastboot {
 
+namespace {
+
+// A bounded queue of buffers between the thread serializing a sparse file and the thread writing
+// it to the transport. Every buffer except the last is a multiple of TRANSPORT_CHUNK_SIZE, so the
+// transport never sends a ZLP in the middle of a download.
+class SparseBufferQueue {
+  public:
+    explicit SparseBufferQueue(size_t max_buffers) : max_buffers_(max_buffers) {}
+
+    // Producer side. Returns false if the consumer has given up.
+    bool Push(std::vector<char>&& buf) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return aborted_ || buffers_.size() < max_buffers_; });
+        if (aborted_) {
+            return false;
+        }
+        buffers_.emplace_back(std::move(buf));
+        cv_.notify_all();
+        return true;
+    }
+
+    void Close(bool failed) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        failed_ = failed;
+        cv_.notify_all();
+    }
+
+    // Consumer side. Returns false once the producer has closed the queue and it is drained.
+    bool Pop(std::vector<char>* buf) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return closed_ || !buffers_.empty(); });
+        if (buffers_.empty()) {
+            return false;
+        }
+        *buf = std::move(buffers_.front());
+        buffers_.pop_front();
+        cv_.notify_all();
+        return true;
+    }
+
+    void Abort() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        aborted_ = true;
+        buffers_.clear();
+        cv_.notify_all();
+    }
+
+    bool failed() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return failed_;
+    }
+
+  private:
+    const size_t max_buffers_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::vector<char>> buffers_;
+    bool closed_ = false;
+    bool failed_ = false;
+    bool aborted_ = false;
+};
+
+}  // namespace
+
 /*************************** PUBLIC *******************************/
 FastBootDriver::FastBootDriver(Transport* transport, DriverCallbacks driver_callbacks,
                                bool no_checks)
@@ -264,27 +333,60 @@ RetCode FastBootDriver::Download(sparse_file* s, bool use_crc, std::string* resp
         return ret;
     }
 
-    struct SparseCBPrivate {
-        FastBootDriver* self;
-        std::vector<char> tpbuf;
-    } cb_priv;
-    cb_priv.self = this;
-
-    auto cb = [](void* priv, const void* buf, size_t len) -> int {
-        SparseCBPrivate* data = static_cast<SparseCBPrivate*>(priv);
-        const char* cbuf = static_cast<const char*>(buf);
-        return data->self->SparseWriteCallback(data->tpbuf, cbuf, len);
-    };
+    // Serialize the sparse file on a helper thread while this thread writes to the transport, so
+    // that reading the backing image overlaps with the transfer instead of alternating with it.
+    SparseBufferQueue queue(SPARSE_QUEUE_DEPTH);
+    std::thread producer([s, use_crc, &queue]() {
+        struct SparseCBPrivate {
+            SparseBufferQueue* queue;
+            std::vector<char> pending;
+        } cb_priv;
+        cb_priv.queue = &queue;
+
+        auto cb = [](void* priv, const void* buf, size_t len) -> int {
+            SparseCBPrivate* data = static_cast<SparseCBPrivate*>(priv);
+            const char* cbuf = static_cast<const char*>(buf);
+            while (len > 0) {
+                if (data->pending.capacity() < SPARSE_BUFFER_SIZE) {
+                    data->pending.reserve(SPARSE_BUFFER_SIZE);
+                }
+                size_t to_copy = std::min(SPARSE_BUFFER_SIZE - data->pending.size(), len);
+                data->pending.insert(data->pending.end(), cbuf, cbuf + to_copy);
+                cbuf += to_copy;
+                len -= to_copy;
+                if (data->pending.size() == SPARSE_BUFFER_SIZE) {
+                    if (!data->queue->Push(std::move(data->pending))) {
+                        return -1;
+                    }
+                    data->pending.clear();
+                }
+            }
+            return 0;
+        };
 
-    if (sparse_file_callback(s, true, use_crc, cb, &cb_priv) < 0) {
-        error_ = "Error reading sparse file";
-        return IO_ERROR;
+        bool failed = sparse_file_callback(s, true, use_crc, cb, &cb_priv) < 0;
+        if (!failed && !cb_priv.pending.empty()) {
+            failed = !queue.Push(std::move(cb_priv.pending));
+        }
+        queue.Close(failed);
+    });
+
+    std::vector<char> buf;
+    while (queue.Pop(&buf)) {
+        if ((ret = SendBuffer(buf))) {
+            queue.Abort();
+            break;
+        }
     }
+    producer.join();
 
-    // Now flush
-    if (cb_priv.tpbuf.size() && (ret = SendBuffer(cb_priv.tpbuf))) {
+    if (ret) {
         return ret;
     }
+    if (queue.failed()) {
+        error_ = "Error reading sparse file";
+        return IO_ERROR;
+    }
 
     return HandleResponse(response, info);
 }
@@ -544,39 +646,6 @@ RetCode FastBootDriver::ReadBuffer(void* buf, size_t size) {
     return SUCCESS;
 }
 
-int FastBootDriver::SparseWriteCallback(std::vector<char>& tpbuf, const char* data, size_t len) {
-    size_t total = 0;
-    size_t to_write = std::min(TRANSPORT_CHUNK_SIZE - tpbuf.size(), len);
-
-    // Handle the residual
-    tpbuf.insert(tpbuf.end(), data, data + to_write);
-    if (tpbuf.size() < TRANSPORT_CHUNK_SIZE) {  // Nothing enough to send rn
-        return 0;
-    }
-
-    if (SendBuffer(tpbuf)) {
-        error_ = ErrnoStr("Send failed in SparseWriteCallback()");
-        return -1;
-    }
-    tpbuf.clear();
-    total += to_write;
-
-    // Now we need to send a multiple of chunk size
-    size_t nchunks = (len - total) / TRANSPORT_CHUNK_SIZE;
-    size_t nbytes = TRANSPORT_CHUNK_SIZE * nchunks;
-    if (nbytes && SendBuffer(data + total, nbytes)) {  // Don't send a ZLP
-        error_ = ErrnoStr("Send failed in SparseWriteCallback()");
-        return -1;
-    }
-    total += nbytes;
-
-    if (len - total > 0) {  // We have residual data to save for next time
-        tpbuf.assign(data + total, data + len);
-    }
-
-    return 0;
-}
-
 Transport* FastBootDriver::set_transport(Transport* transport) {
     std::swap(transport_, transport);
     return transport;
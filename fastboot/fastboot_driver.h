@@ -67,6 +67,9 @@ class FastBootDriver {
     static constexpr int RESP_TIMEOUT = 30;  // 30 seconds
     static constexpr uint32_t MAX_DOWNLOAD_SIZE = std::numeric_limits<uint32_t>::max();
     static constexpr size_t TRANSPORT_CHUNK_SIZE = 1024;
+    // Sparse downloads are staged in buffers of this size, up to SPARSE_QUEUE_DEPTH of them.
+    static constexpr size_t SPARSE_BUFFER_SIZE = 1024 * TRANSPORT_CHUNK_SIZE;
+    static constexpr size_t SPARSE_QUEUE_DEPTH = 4;
 
     FastBootDriver(Transport* transport, DriverCallbacks driver_callbacks = {},
                    bool no_checks = false);
@@ -155,8 +158,6 @@ class FastBootDriver {
     RetCode UploadInner(const std::string& outfile, std::string* response = nullptr,
                         std::vector<std::string>* info = nullptr);
 
-    int SparseWriteCallback(std::vector<char>& tpbuf, const char* data, size_t len);
-
     std::string error_;
     std::function<void(const std::string&)> prolog_;
     std::function<void(int)> epilog_;
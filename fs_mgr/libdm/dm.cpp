@@ -17,6 +17,7 @@
 #include "libdm/dm.h"
 
 #include <linux/dm-ioctl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/sysmacros.h>
 #include <sys/types.h>
@@ -447,6 +448,33 @@ bool DeviceMapper::GetDeviceString(const std::string& name, std::string* dev) {
     return true;
 }
 
+bool DeviceMapper::ArmEventPoll() {
+#ifdef DM_DEV_ARM_POLL
+    struct dm_ioctl io;
+    InitIo(&io);
+    if (ioctl(fd_, DM_DEV_ARM_POLL, &io) < 0) {
+        // Older kernels reject the ioctl; callers fall back to timed polling.
+        PLOG(VERBOSE) << "DM_DEV_ARM_POLL failed";
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool DeviceMapper::WaitForEvent(const std::chrono::milliseconds& timeout) {
+    struct pollfd pfd = {};
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    int rv = TEMP_FAILURE_RETRY(poll(&pfd, 1, static_cast<int>(timeout.count())));
+    if (rv < 0) {
+        PLOG(ERROR) << "poll on device-mapper failed";
+        return false;
+    }
+    return rv > 0 && (pfd.revents & POLLIN);
+}
+
 bool DeviceMapper::GetTableStatus(const std::string& name, std::vector<TargetInfo>* table) {
     return GetTable(name, 0, table);
 }
@@ -219,6 +219,17 @@ class DeviceMapper final {
     // Returns true if given path is a path to a dm block device.
     bool IsDmBlockDevice(const std::string& path);
 
+    // Device-mapper raises an event on a device when, for example, a snapshot
+    // is invalidated or a table is swapped. ArmEventPoll() records the current
+    // event count, and a following WaitForEvent() blocks until any device has
+    // raised an event since, or |timeout| has elapsed. WaitForEvent() must
+    // only be used after ArmEventPoll() returned true.
+    //
+    // ArmEventPoll() returns false if the kernel doesn't support polling
+    // (before 4.13). WaitForEvent() returns false on timeout or error.
+    bool ArmEventPoll();
+    bool WaitForEvent(const std::chrono::milliseconds& timeout);
+
     // Returns name of a dm-device with the given path, or std::nulloptr if given path is not a
     // dm-device.
     std::optional<std::string> GetDmDeviceNameByPath(const std::string& path);
@@ -19,6 +19,7 @@
 #include <string.h>
 
 #include <algorithm>
+#include <atomic>
 
 #include <android-base/unique_fd.h>
 
@@ -63,10 +64,19 @@ bool ZeroExtent::AddTo(LpMetadata* out) const {
     return true;
 }
 
+// Shared by all partitions, so that a stamp never repeats even when
+// partitions are removed and re-added.
+static std::atomic<uint64_t> sModificationStamp;
+
 Partition::Partition(std::string_view name, std::string_view group_name, uint32_t attributes)
     : name_(name), group_name_(group_name), attributes_(attributes), size_(0) {}
 
+void Partition::MarkModified() {
+    modification_stamp_ = ++sModificationStamp;
+}
+
 void Partition::AddExtent(std::unique_ptr<Extent>&& extent) {
+    MarkModified();
     size_ += extent->num_sectors() * LP_SECTOR_SIZE;
 
     if (LinearExtent* new_extent = extent->AsLinearExtent()) {
@@ -87,6 +97,7 @@ void Partition::AddExtent(std::unique_ptr<Extent>&& extent) {
 }
 
 void Partition::RemoveExtents() {
+    MarkModified();
     size_ = 0;
     extents_.clear();
 }
@@ -96,6 +107,7 @@ void Partition::ShrinkTo(uint64_t aligned_size) {
         RemoveExtents();
         return;
     }
+    MarkModified();
 
     // Remove or shrink extents of any kind until the total partition size is
     // equal to the requested size.
@@ -265,7 +277,10 @@ bool MetadataBuilder::UpdateMetadataForOtherSuper(LpMetadata* metadata, uint32_t
     return true;
 }
 
-MetadataBuilder::MetadataBuilder() : auto_slot_suffixing_(false) {
+MetadataBuilder::MetadataBuilder()
+    : auto_slot_suffixing_(false),
+      allocation_policy_(AllocationPolicy::FirstFit),
+      free_regions_stamp_(0) {
     memset(&geometry_, 0, sizeof(geometry_));
     geometry_.magic = LP_METADATA_GEOMETRY_MAGIC;
     geometry_.struct_size = sizeof(geometry_);
@@ -537,6 +552,7 @@ void MetadataBuilder::RemovePartition(std::string_view name) {
     for (auto iter = partitions_.begin(); iter != partitions_.end(); iter++) {
         if ((*iter)->name() == name) {
             partitions_.erase(iter);
+            free_regions_.reset();
             return;
         }
     }
@@ -565,7 +581,24 @@ void MetadataBuilder::ExtentsToFreeList(const std::vector<Interval>& extents,
     }
 }
 
+bool MetadataBuilder::IsFreeRegionCacheValid() const {
+    if (!free_regions_) {
+        return false;
+    }
+    for (const auto& partition : partitions_) {
+        if (partition->modification_stamp() > free_regions_stamp_) {
+            return false;
+        }
+    }
+    return true;
+}
+
 auto MetadataBuilder::GetFreeRegions() const -> std::vector<Interval> {
+    if (IsFreeRegionCacheValid()) {
+        return *free_regions_;
+    }
+    free_regions_stamp_ = sModificationStamp;
+
     std::vector<Interval> free_regions;
 
     // Collect all extents in the partition table, per-device, then sort them
@@ -598,9 +631,33 @@ auto MetadataBuilder::GetFreeRegions() const -> std::vector<Interval> {
         std::sort(extents.begin(), extents.end());
         ExtentsToFreeList(extents, &free_regions);
     }
+    free_regions_ = free_regions;
     return free_regions;
 }
 
+void MetadataBuilder::RemoveFromFreeRegions(const LinearExtent& extent) {
+    auto& regions = *free_regions_;
+    for (auto iter = regions.begin(); iter != regions.end(); iter++) {
+        if (iter->device_index != extent.device_index() ||
+            extent.physical_sector() < iter->start || extent.physical_sector() >= iter->end) {
+            continue;
+        }
+
+        // Split the region the same way ExtentsToFreeList() would around the
+        // new extent: the space after it starts at the next aligned sector.
+        Interval region = *iter;
+        iter = regions.erase(iter);
+        uint64_t next = AlignSector(block_devices_[region.device_index], extent.end_sector());
+        if (next < region.end) {
+            iter = regions.emplace(iter, region.device_index, next, region.end);
+        }
+        if (region.start < extent.physical_sector()) {
+            regions.emplace(iter, region.device_index, region.start, extent.physical_sector());
+        }
+        return;
+    }
+}
+
 bool MetadataBuilder::ValidatePartitionSizeChange(Partition* partition, uint64_t old_size,
                                                   uint64_t new_size, bool force_check) {
     PartitionGroup* group = FindGroup(partition->group_name());
@@ -667,12 +724,6 @@ bool MetadataBuilder::GrowPartition(Partition* partition, uint64_t aligned_size,
     CHECK_NE(sectors_per_block, 0);
     CHECK(sectors_needed % sectors_per_block == 0);
 
-    if (IsABDevice() && ShouldHalveSuper() && GetPartitionSlotSuffix(partition->name()) == "_b") {
-        // Allocate "a" partitions top-down and "b" partitions bottom-up, to
-        // minimize fragmentation during OTA.
-        free_regions = PrioritizeSecondHalfOfSuper(free_regions);
-    }
-
     // Note we store new extents in a temporary vector, and only commit them
     // if we are guaranteed enough free space.
     std::vector<std::unique_ptr<LinearExtent>> new_extents;
@@ -685,6 +736,14 @@ bool MetadataBuilder::GrowPartition(Partition* partition, uint64_t aligned_size,
         new_extents.emplace_back(std::move(extent));
     }
 
+    ApplyAllocationPolicy(partition, sectors_needed, &free_regions);
+
+    if (IsABDevice() && ShouldHalveSuper() && GetPartitionSlotSuffix(partition->name()) == "_b") {
+        // Allocate "a" partitions top-down and "b" partitions bottom-up, to
+        // minimize fragmentation during OTA.
+        free_regions = PrioritizeSecondHalfOfSuper(free_regions);
+    }
+
     for (auto& region : free_regions) {
         // Note: this comes first, since we may enter the loop not needing any
         // more sectors.
@@ -720,13 +779,66 @@ bool MetadataBuilder::GrowPartition(Partition* partition, uint64_t aligned_size,
         return false;
     }
 
-    // Everything succeeded, so commit the new extents.
+    // Everything succeeded, so commit the new extents, and take them out of
+    // the cached free regions rather than recomputing them next time.
+    bool cache_valid = IsFreeRegionCacheValid();
     for (auto& extent : new_extents) {
+        if (cache_valid) {
+            RemoveFromFreeRegions(*extent.get());
+        }
         partition->AddExtent(std::move(extent));
     }
+    if (cache_valid) {
+        free_regions_stamp_ = sModificationStamp;
+    }
     return true;
 }
 
+void MetadataBuilder::ApplyAllocationPolicy(Partition* partition, uint64_t sectors_needed,
+                                            std::vector<Interval>* free_list) const {
+    if (allocation_policy_ == AllocationPolicy::FirstFit || !sectors_needed) {
+        return;
+    }
+
+    auto begin = free_list->begin();
+    auto end = free_list->end();
+    LinearExtent* last = nullptr;
+    if (!partition->extents().empty()) {
+        last = partition->extents().back()->AsLinearExtent();
+    }
+    if (allocation_policy_ == AllocationPolicy::Contiguous && last) {
+        // Any misaligned tail was already filled by ExtendFinalExtent(), so a
+        // region starting at the next aligned sector merges with the extent.
+        uint64_t next = AlignSector(block_devices_[last->device_index()], last->end_sector());
+        auto adjacent = std::find_if(begin, end, [&](const Interval& region) -> bool {
+            return region.device_index == last->device_index() && region.start == next;
+        });
+        if (adjacent != end) {
+            std::rotate(begin, adjacent, adjacent + 1);
+            if (begin->length() >= sectors_needed) {
+                return;
+            }
+            sectors_needed -= begin->length();
+            begin++;
+        }
+    }
+
+    auto best = end;
+    for (auto iter = begin; iter != end; iter++) {
+        if (iter->length() >= sectors_needed &&
+            (best == end || iter->length() < best->length())) {
+            best = iter;
+        }
+    }
+    if (best != end) {
+        std::rotate(begin, best, best + 1);
+        return;
+    }
+    std::stable_sort(begin, end, [](const Interval& a, const Interval& b) -> bool {
+        return a.length() > b.length();
+    });
+}
+
 std::vector<Interval> MetadataBuilder::PrioritizeSecondHalfOfSuper(
         const std::vector<Interval>& free_list) {
     const auto& super = block_devices_[0];
@@ -986,6 +1098,7 @@ bool MetadataBuilder::UpdateBlockDeviceInfo(size_t index, const BlockDeviceInfo&
     CHECK(index < block_devices_.size());
 
     LpMetadataBlockDevice& block_device = block_devices_[index];
+    free_regions_.reset();
     if (device_info.size != block_device.size) {
         LERROR << "Device size does not match (got " << device_info.size << ", expected "
                << block_device.size << ")";
@@ -0,0 +1,85 @@
+//
+// Copyright (C) 2020 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+#include <liblp/builder.h>
+#include <storage_literals/storage_literals.h>
+
+using namespace android::fs_mgr;
+using namespace android::storage_literals;
+
+// Build metadata for |num_partitions| partitions spread over groups of eight,
+// then resize them the way a few rounds of updates would, shrinking some and
+// growing the rest. Reports the average number of extents per partition.
+static void BuildAndResize(benchmark::State& state, AllocationPolicy policy) {
+    android::base::SetMinimumLogSeverity(android::base::WARNING);
+    const int num_partitions = state.range(0);
+
+    size_t num_extents = 0;
+    for (auto _ : state) {
+        BlockDeviceInfo device_info("super", 128_GiB, 1_MiB, 0, 4096);
+        auto builder = MetadataBuilder::New(device_info, 65536, 2);
+        builder->SetAllocationPolicy(policy);
+
+        std::mt19937 random(num_partitions);
+        std::vector<Partition*> partitions;
+        for (int i = 0; i < num_partitions; i++) {
+            std::string group = "group_" + std::to_string(i / 8);
+            if (!builder->FindGroup(group)) {
+                builder->AddGroup(group, 0);
+            }
+            Partition* partition = builder->AddPartition("p" + std::to_string(i), group, 0);
+            builder->ResizePartition(partition, (random() % 64 + 1) * 4_MiB);
+            partitions.emplace_back(partition);
+        }
+        for (int round = 0; round < 3; round++) {
+            for (auto partition : partitions) {
+                uint64_t size = partition->size();
+                if (random() % 3 == 0) {
+                    builder->ResizePartition(partition, size / 2);
+                } else {
+                    builder->ResizePartition(partition, size + (random() % 16 + 1) * 1_MiB);
+                }
+            }
+        }
+        auto metadata = builder->Export();
+        num_extents = metadata->extents.size();
+    }
+    state.counters["extents_per_partition"] =
+            static_cast<double>(num_extents) / num_partitions;
+}
+
+static void BM_BuildAndResize_FirstFit(benchmark::State& state) {
+    BuildAndResize(state, AllocationPolicy::FirstFit);
+}
+BENCHMARK(BM_BuildAndResize_FirstFit)->Arg(64)->Arg(256)->Arg(512);
+
+static void BM_BuildAndResize_BestFit(benchmark::State& state) {
+    BuildAndResize(state, AllocationPolicy::BestFit);
+}
+BENCHMARK(BM_BuildAndResize_BestFit)->Arg(64)->Arg(256)->Arg(512);
+
+static void BM_BuildAndResize_Contiguous(benchmark::State& state) {
+    BuildAndResize(state, AllocationPolicy::Contiguous);
+}
+BENCHMARK(BM_BuildAndResize_Contiguous)->Arg(64)->Arg(256)->Arg(512);
+
+BENCHMARK_MAIN();
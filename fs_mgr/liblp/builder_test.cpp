@@ -1019,3 +1019,96 @@ TEST_F(BuilderTest, LinearExtentOverlap) {
     EXPECT_FALSE(extent.OverlapsWith(LinearExtent{20, 1, 15}));
     EXPECT_FALSE(extent.OverlapsWith(LinearExtent{20, 1, 10}));
 }
+
+TEST_F(BuilderTest, BestFitAllocation) {
+    BlockDeviceInfo device_info("super", 1_GiB, 0, 0, 4096);
+    auto builder = MetadataBuilder::New(device_info, 65536, 1);
+    ASSERT_NE(builder, nullptr);
+    builder->SetAllocationPolicy(AllocationPolicy::BestFit);
+
+    for (const auto& [name, size] : {std::pair{"a", 16_MiB}, {"b", 32_MiB}, {"c", 16_MiB},
+                                     {"d", 8_MiB}, {"e", 16_MiB}}) {
+        Partition* partition = builder->AddPartition(name, 0);
+        ASSERT_NE(partition, nullptr);
+        ASSERT_TRUE(builder->ResizePartition(partition, size));
+    }
+    LinearExtent* d = builder->FindPartition("d")->extents()[0]->AsLinearExtent();
+    ASSERT_NE(d, nullptr);
+    uint64_t d_start = d->physical_sector();
+    builder->RemovePartition("b");
+    builder->RemovePartition("d");
+
+    // The 8MiB hole left by "d" fits exactly, so the 32MiB one is kept whole.
+    Partition* x = builder->AddPartition("x", 0);
+    ASSERT_NE(x, nullptr);
+    ASSERT_TRUE(builder->ResizePartition(x, 8_MiB));
+    ASSERT_EQ(x->extents().size(), 1);
+    EXPECT_EQ(x->extents()[0]->AsLinearExtent()->physical_sector(), d_start);
+
+    Partition* y = builder->AddPartition("y", 0);
+    ASSERT_NE(y, nullptr);
+    ASSERT_TRUE(builder->ResizePartition(y, 32_MiB));
+    EXPECT_EQ(y->extents().size(), 1);
+}
+
+TEST_F(BuilderTest, ContiguousAllocation) {
+    BlockDeviceInfo device_info("super", 1_GiB, 0, 0, 4096);
+    for (auto policy : {AllocationPolicy::BestFit, AllocationPolicy::Contiguous}) {
+        auto builder = MetadataBuilder::New(device_info, 65536, 1);
+        ASSERT_NE(builder, nullptr);
+        builder->SetAllocationPolicy(policy);
+
+        for (const auto& [name, size] : {std::pair{"a", 16_MiB}, {"b", 16_MiB}, {"c", 16_MiB},
+                                         {"d", 8_MiB}, {"e", 16_MiB}}) {
+            Partition* partition = builder->AddPartition(name, 0);
+            ASSERT_NE(partition, nullptr);
+            ASSERT_TRUE(builder->ResizePartition(partition, size));
+        }
+        builder->RemovePartition("b");
+        builder->RemovePartition("d");
+
+        // Best fit takes the hole left by "d", while growing in place into the
+        // space left by "b" keeps "a" in one extent.
+        Partition* a = builder->FindPartition("a");
+        ASSERT_TRUE(builder->ResizePartition(a, 24_MiB));
+        EXPECT_EQ(a->extents().size(), policy == AllocationPolicy::Contiguous ? 1 : 2);
+    }
+}
+
+TEST_F(BuilderTest, FreeRegionsStayConsistent) {
+    BlockDeviceInfo device_info("super", 1_GiB, 768 * 1024, 0, 4096);
+    auto builder = MetadataBuilder::New(device_info, 65536, 1);
+    ASSERT_NE(builder, nullptr);
+    builder->SetAllocationPolicy(AllocationPolicy::Contiguous);
+
+    std::vector<Partition*> partitions;
+    for (int i = 0; i < 20; i++) {
+        Partition* partition = builder->AddPartition("p" + std::to_string(i), 0);
+        ASSERT_NE(partition, nullptr);
+        ASSERT_TRUE(builder->ResizePartition(partition, (i % 4 + 1) * 3_MiB + 4096));
+        partitions.emplace_back(partition);
+    }
+    for (int i = 0; i < 20; i += 3) {
+        ASSERT_TRUE(builder->ResizePartition(partitions[i], 4096));
+    }
+    for (int i = 1; i < 20; i += 2) {
+        ASSERT_TRUE(builder->ResizePartition(partitions[i], partitions[i]->size() + 5_MiB));
+    }
+    partitions[2]->RemoveExtents();
+    ASSERT_TRUE(builder->ResizePartition(partitions[4], partitions[4]->size() + 7_MiB));
+
+    // The free regions kept up to date across resizes must match the ones
+    // computed from scratch.
+    unique_ptr<LpMetadata> exported = builder->Export();
+    ASSERT_NE(exported, nullptr);
+    auto fresh = MetadataBuilder::New(*exported.get());
+    ASSERT_NE(fresh, nullptr);
+    auto expected = fresh->GetFreeRegions();
+    auto actual = builder->GetFreeRegions();
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < actual.size(); i++) {
+        EXPECT_EQ(actual[i].device_index, expected[i].device_index);
+        EXPECT_EQ(actual[i].start, expected[i].start);
+        EXPECT_EQ(actual[i].end, expected[i].end);
+    }
+}
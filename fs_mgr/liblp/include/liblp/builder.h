@@ -135,9 +135,13 @@ class Partition final {
     // to.
     Partition GetBeginningExtents(uint64_t aligned_size) const;
 
+    // Increases every time the extents of any partition change.
+    uint64_t modification_stamp() const { return modification_stamp_; }
+
   private:
     void ShrinkTo(uint64_t aligned_size);
     void set_group_name(std::string_view group_name) { group_name_ = group_name; }
+    void MarkModified();
 
     std::string name_;
     std::string group_name_;
@@ -145,6 +149,7 @@ class Partition final {
     uint32_t attributes_;
     uint64_t size_;
     bool disabled_;
+    uint64_t modification_stamp_ = 0;
 };
 
 // An interval in the metadata. This is similar to a LinearExtent with one difference.
@@ -176,6 +181,19 @@ struct Interval {
                                            const std::vector<Interval>& b);
 };
 
+// How MetadataBuilder picks free regions when growing a partition.
+enum class AllocationPolicy {
+    // Take free regions in disk order. This is the default.
+    FirstFit,
+    // Take the smallest free region that holds the whole request. If none
+    // does, take the largest regions first, so that as few extents as possible
+    // are added.
+    BestFit,
+    // Like BestFit, but first extend the partition's last extent in place if
+    // the space after it is free, so that growing doesn't add an extent.
+    Contiguous,
+};
+
 class MetadataBuilder {
   public:
     // Construct an empty logical partition table builder given the specified
@@ -281,9 +299,9 @@ class MetadataBuilder {
     // rounded UP to the nearest block (512 bytes).
     //
     // When growing a partition, a greedy algorithm is used to find free gaps
-    // in the partition table and allocate them. If not enough space can be
-    // allocated, false is returned, and the parition table will not be
-    // modified.
+    // in the partition table and allocate them, in the order given by the
+    // allocation policy. If not enough space can be allocated, false is
+    // returned, and the parition table will not be modified.
     //
     // Note, this is an in-memory operation, and it does not alter the
     // underlying filesystem or contents of the partition on disk.
@@ -293,6 +311,9 @@ class MetadataBuilder {
     bool ResizePartition(Partition* partition, uint64_t requested_size,
                          const std::vector<Interval>& free_region_hint = {});
 
+    // Set the policy used by ResizePartition() to pick free regions.
+    void SetAllocationPolicy(AllocationPolicy policy) { allocation_policy_ = policy; }
+
     // Return the list of partitions belonging to a group.
     std::vector<Partition*> ListPartitionsInGroup(std::string_view group_name);
 
@@ -344,7 +365,8 @@ class MetadataBuilder {
     // Return the name of the block device at |index|.
     std::string GetBlockDevicePartitionName(uint64_t index) const;
 
-    // Return the list of free regions not occupied by extents in the metadata.
+    // Return the list of free regions not occupied by extents in the metadata,
+    // ordered by block device and then by starting sector.
     std::vector<Interval> GetFreeRegions() const;
 
     uint64_t logical_block_size() const;
@@ -388,6 +410,10 @@ class MetadataBuilder {
     void ExtentsToFreeList(const std::vector<Interval>& extents,
                            std::vector<Interval>* free_regions) const;
     std::vector<Interval> PrioritizeSecondHalfOfSuper(const std::vector<Interval>& free_list);
+    void ApplyAllocationPolicy(Partition* partition, uint64_t sectors_needed,
+                               std::vector<Interval>* free_list) const;
+    bool IsFreeRegionCacheValid() const;
+    void RemoveFromFreeRegions(const LinearExtent& extent);
     std::unique_ptr<LinearExtent> ExtendFinalExtent(Partition* partition,
                                                     const std::vector<Interval>& free_list,
                                                     uint64_t sectors_needed) const;
@@ -401,6 +427,13 @@ class MetadataBuilder {
     std::vector<std::unique_ptr<PartitionGroup>> groups_;
     std::vector<LpMetadataBlockDevice> block_devices_;
     bool auto_slot_suffixing_;
+    AllocationPolicy allocation_policy_;
+
+    // Result of the last GetFreeRegions(), updated in place as GrowPartition()
+    // allocates. It is stale once any partition has a modification stamp past
+    // free_regions_stamp_, or once a partition or block device changes.
+    mutable std::optional<std::vector<Interval>> free_regions_;
+    mutable uint64_t free_regions_stamp_;
 };
 
 // Read BlockDeviceInfo for a given block device. This always returns false
@@ -83,6 +83,32 @@ enum class CreateResult : unsigned int {
     NOT_CREATED,
 };
 
+// Merge progress of one snapshot device, as sampled by ProcessUpdateState().
+// All sector counts are in 512-byte sectors.
+struct SnapshotMergeMetrics {
+    std::string dm_name;
+    // dm-snapshot status at the first and at the latest sample.
+    android::dm::DmTargetSnapshot::Status initial_status = {};
+    android::dm::DmTargetSnapshot::Status status = {};
+    std::chrono::steady_clock::time_point first_sampled_at;
+    std::chrono::steady_clock::time_point sampled_at;
+    // Sectors merged per second, measured over at least a second and updated
+    // about every two while ProcessUpdateState() waits for the merge.
+    double merge_rate = 0;
+    // The sample the next merge_rate is measured from.
+    std::chrono::steady_clock::time_point rate_sampled_at;
+    uint64_t rate_sectors_allocated = 0;
+
+    uint64_t sectors_merged() const;
+    // Sectors merged per second since the first sample.
+    double average_merge_rate() const;
+    // Fraction of the COW device in use, in the range [0, 1].
+    double cow_fill() const;
+    // Sectors the merge has to process per sector of data, counting the
+    // exception metadata that is read and rewritten along with it.
+    double io_amplification() const;
+};
+
 class SnapshotManager final {
     using CreateLogicalPartitionParams = android::fs_mgr::CreateLogicalPartitionParams;
     using IPartitionOpener = android::fs_mgr::IPartitionOpener;
@@ -181,6 +207,24 @@ class SnapshotManager final {
     UpdateState ProcessUpdateState(const std::function<bool()>& callback = {},
                                    const std::function<bool()>& before_cancel = {});
 
+    // Per-device merge metrics sampled by the current or last call to
+    // ProcessUpdateState(), including devices that have finished merging.
+    // Intended to be called from its callback.
+    std::vector<SnapshotMergeMetrics> GetMergeMetrics() const;
+
+    // Pace merges so that all devices together merge about |bytes_per_second|,
+    // leaving I/O bandwidth for the foreground. 0, the default, disables
+    // pacing and leaves the copy throttle at its original setting. May be
+    // changed at any time, including from the ProcessUpdateState() callback,
+    // and applies from the next sample.
+    //
+    // Pacing works by adjusting the dm-snapshot copy throttle, which is
+    // global to the kernel. The original value is saved under the metadata
+    // directory before it is first changed, and put back when
+    // ProcessUpdateState() returns, or by the next ProcessUpdateState() if
+    // the process died while pacing. Only one process paces at a time.
+    void SetMergeThroughputTarget(uint64_t bytes_per_second);
+
     // Find the status of the current update, if any.
     //
     // |progress| depends on the returned status:
@@ -274,7 +318,9 @@ class SnapshotManager final {
     FRIEND_TEST(SnapshotTest, MapSnapshot);
     FRIEND_TEST(SnapshotTest, Merge);
     FRIEND_TEST(SnapshotTest, NoMergeBeforeReboot);
+    FRIEND_TEST(SnapshotTest, RestoreMergePaceAfterCrash);
     FRIEND_TEST(SnapshotTest, UpdateBootControlHal);
+    FRIEND_TEST(SnapshotTest, WatchMetadataDir);
     FRIEND_TEST(SnapshotUpdateTest, DataWipeAfterRollback);
     FRIEND_TEST(SnapshotUpdateTest, DataWipeRollbackInRecovery);
     FRIEND_TEST(SnapshotUpdateTest, FullUpdateFlow);
@@ -411,6 +457,11 @@ class SnapshotManager final {
     // This file contains information related to the snapshot merge process.
     std::string GetMergeStateFilePath() const;
 
+    // Holds the dm-snapshot copy throttle as it was before PaceMerge()
+    // changed it. Only exists while a merge is being paced, and is locked by
+    // the pacing process for as long as it lives.
+    std::string GetCopyThrottleFilePath() const;
+
     // Helpers for merging.
     bool SwitchSnapshotToMerge(LockedFile* lock, const std::string& name);
     bool RewriteSnapshotDeviceTable(const std::string& dm_name);
@@ -451,6 +502,40 @@ class SnapshotManager final {
     UpdateState CheckMergeState(LockedFile* lock, const std::function<bool()>& before_cancel);
     UpdateState CheckTargetMergeState(LockedFile* lock, const std::string& name);
 
+    // Blocks until the merge may have changed state, for at most one polling
+    // interval, by watching the devices in merging_devices_ and waiting for
+    // device-mapper events. Returns true if CheckMergeState() should run
+    // again, or false if every watched device is still merging.
+    bool WaitForMergeStateChange();
+
+    // Watch the metadata directory, and the snapshot status files in it, for
+    // changes made by other processes while a merge is in progress. Returns
+    // -1 if the directory can't be watched.
+    android::base::unique_fd WatchMetadataDir();
+    // Returns true if a watched file changed since the last call, discarding
+    // the pending notifications.
+    static bool ConsumeMetadataChanges(int watch_fd);
+
+    // Record a new status sample for |dm_name| in merge_metrics_. If
+    // |rate_updated| is set, also measure the merge rate when enough time has
+    // passed since it was last measured, and report whether it was.
+    SnapshotMergeMetrics& UpdateMergeMetrics(const std::string& dm_name,
+                                             const DmTargetSnapshot::Status& status,
+                                             bool* rate_updated = nullptr);
+
+    // Adjust the dm-snapshot copy throttle towards merge_throughput_target_,
+    // given the combined merge rate in sectors per second.
+    void PaceMerge(double merge_rate);
+    // Put back the copy throttle as it was before PaceMerge() changed it,
+    // whether by this process or by one that died while pacing. Pacing by
+    // another live process is left alone.
+    void RestoreMergePace();
+    // Open and lock the saved copy throttle file. Returns -1 if it doesn't
+    // exist and |create| is false, or if another process holds the lock.
+    android::base::unique_fd LockCopyThrottleFile(bool create);
+    static bool ReadSavedCopyThrottle(int fd, int* throttle);
+    static bool WriteSavedCopyThrottle(int fd, int throttle);
+
     // Interact with status files under /metadata/ota/snapshots.
     bool WriteSnapshotStatus(LockedFile* lock, const SnapshotStatus& status);
     bool ReadSnapshotStatus(LockedFile* lock, const std::string& name, SnapshotStatus* status);
@@ -550,6 +635,22 @@ class SnapshotManager final {
     std::unique_ptr<IImageManager> images_;
     bool has_local_image_manager_ = false;
     bool in_factory_data_reset_ = false;
+
+    // The snapshot devices that the last CheckMergeState() found merging.
+    std::vector<std::string> merging_devices_;
+    // Samples of every device seen during the current ProcessUpdateState().
+    std::map<std::string, SnapshotMergeMetrics> merge_metrics_;
+
+    // Merge pacing. The copy throttle is a percentage; -1 means PaceMerge()
+    // hasn't changed it, and saved_copy_throttle_ holds the original.
+    uint64_t merge_throughput_target_ = 0;
+    int copy_throttle_ = -1;
+    int saved_copy_throttle_ = -1;
+    bool copy_throttle_unavailable_ = false;
+    // Locks the saved copy throttle file while this process is pacing.
+    android::base::unique_fd copy_throttle_fd_;
+    // When merge rates were last measured.
+    std::chrono::steady_clock::time_point merge_rate_sampled_at_;
 };
 
 }  // namespace snapshot
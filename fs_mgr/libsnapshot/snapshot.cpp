@@ -17,9 +17,12 @@
 #include <dirent.h>
 #include <math.h>
 #include <sys/file.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/unistd.h>
 
+#include <algorithm>
 #include <optional>
 #include <thread>
 #include <unordered_set>
@@ -27,6 +30,7 @@
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/parseint.h>
+#include <android-base/scopeguard.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 #include <ext4_utils/ext4_utils.h>
@@ -78,6 +82,19 @@ using namespace std::string_literals;
 static constexpr char kBootIndicatorPath[] = "/metadata/ota/snapshot-boot";
 static constexpr char kRollbackIndicatorPath[] = "/metadata/ota/rollback-indicator";
 static constexpr auto kUpdateStateCheckInterval = 2s;
+// While merging, status files are only re-read when a watched device changes
+// state, a device-mapper event fires, another process writes to the metadata
+// directory, or this long has passed. The last is only a safety net.
+static constexpr auto kMergeFullCheckInterval = 1min;
+// Lower bound on how soon a device projected to finish merging is re-queried.
+static constexpr auto kMinMergeCheckInterval = 50ms;
+// Merge rates are only computed over at least this long. Samples taken closer
+// together, such as by CheckMergeState() just before waiting, are mostly noise.
+static constexpr auto kMinMergeRateWindow = 1s;
+// Percentage of time dm-snapshot's kcopyd may spend copying, used to pace merges.
+static constexpr char kCopyThrottlePath[] =
+        "/sys/module/dm_snapshot/parameters/snapshot_copy_throttle";
+static constexpr char kCopyThrottleFileName[] = "merge_copy_throttle";
 
 // Note: IImageManager is an incomplete type in the header, so the default
 // destructor doesn't work.
@@ -803,25 +820,365 @@ bool SnapshotManager::QuerySnapshotStatus(const std::string& dm_name, std::strin
 // the problem was transient, we might manage to get a new outcome.
 UpdateState SnapshotManager::ProcessUpdateState(const std::function<bool()>& callback,
                                                 const std::function<bool()>& before_cancel) {
+    merge_metrics_.clear();
+    merge_rate_sampled_at_ = {};
+    // Undo pacing left behind by a process that died mid-merge.
+    RestoreMergePace();
+    auto restore_pace = android::base::make_scope_guard([this] { RestoreMergePace(); });
+
+    // Other processes may cancel or otherwise change the update while we wait,
+    // so watch for their writes to the status files.
+    auto metadata_watch = WatchMetadataDir();
+
+    bool need_full_check = true;
+    auto last_full_check = std::chrono::steady_clock::now();
     while (true) {
-        UpdateState state = CheckMergeState(before_cancel);
-        if (state == UpdateState::MergeFailed) {
-            AcknowledgeMergeFailure();
-        }
-        if (state != UpdateState::Merging) {
-            // Either there is no merge, or the merge was finished, so no need
-            // to keep waiting.
-            return state;
+        if (need_full_check) {
+            // Writes made before this point are seen by the check itself.
+            if (metadata_watch >= 0) {
+                ConsumeMetadataChanges(metadata_watch.get());
+            }
+            UpdateState state = CheckMergeState(before_cancel);
+            if (state == UpdateState::MergeFailed) {
+                AcknowledgeMergeFailure();
+            }
+            if (state != UpdateState::Merging) {
+                // Either there is no merge, or the merge was finished, so no need
+                // to keep waiting.
+                return state;
+            }
+            last_full_check = std::chrono::steady_clock::now();
         }
 
         if (callback && !callback()) {
-            return state;
+            return UpdateState::Merging;
+        }
+
+        // Taking the lock and reading every status file is only needed once
+        // something has changed, so in between just watch the devices and the
+        // metadata directory. Without a watch, check on every wakeup as the
+        // status files may have changed.
+        need_full_check = WaitForMergeStateChange() || metadata_watch < 0 ||
+                          ConsumeMetadataChanges(metadata_watch.get()) ||
+                          std::chrono::steady_clock::now() - last_full_check >=
+                                  kMergeFullCheckInterval;
+    }
+}
+
+unique_fd SnapshotManager::WatchMetadataDir() {
+    unique_fd fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC));
+    if (fd < 0) {
+        PLOG(WARNING) << "inotify_init1 failed";
+        return {};
+    }
+    // Status files are written to a temporary file and renamed into place.
+    constexpr uint32_t kMask = IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE;
+    if (inotify_add_watch(fd.get(), metadata_dir_.c_str(), kMask) < 0) {
+        PLOG(WARNING) << "Could not watch " << metadata_dir_;
+        return {};
+    }
+    auto snapshots_dir = metadata_dir_ + "/snapshots"s;
+    if (inotify_add_watch(fd.get(), snapshots_dir.c_str(), kMask) < 0 && errno != ENOENT) {
+        PLOG(WARNING) << "Could not watch " << snapshots_dir;
+        return {};
+    }
+    return fd;
+}
+
+bool SnapshotManager::ConsumeMetadataChanges(int watch_fd) {
+    bool changed = false;
+    char buffer[4096] __attribute__((aligned(alignof(struct inotify_event))));
+    while (true) {
+        ssize_t n = TEMP_FAILURE_RETRY(read(watch_fd, buffer, sizeof(buffer)));
+        if (n <= 0) {
+            if (n < 0 && errno != EAGAIN) {
+                // Don't trust the watch any more; make the caller check.
+                PLOG(ERROR) << "read inotify failed";
+                return true;
+            }
+            return changed;
+        }
+        for (char* p = buffer; p < buffer + n;) {
+            auto event = reinterpret_cast<struct inotify_event*>(p);
+            p += sizeof(*event) + event->len;
+            // The saved copy throttle is written while pacing, and says
+            // nothing about the update itself.
+            if (event->len && std::string_view(event->name) == kCopyThrottleFileName) {
+                continue;
+            }
+            changed = true;
+        }
+    }
+}
+
+bool SnapshotManager::WaitForMergeStateChange() {
+    auto& dm = DeviceMapper::Instance();
+
+    // Arm before sampling, so that an event raised while we look isn't lost.
+    bool armed = dm.ArmEventPoll();
+
+    // Estimate the merge rate, and pace by it, about once per interval rather
+    // than on every wakeup.
+    auto now = std::chrono::steady_clock::now();
+    bool rate_due = now - merge_rate_sampled_at_ >= kUpdateStateCheckInterval;
+    bool have_rate = rate_due && !merging_devices_.empty();
+
+    auto timeout = duration_cast<std::chrono::milliseconds>(kUpdateStateCheckInterval);
+    double merge_rate = 0;
+    for (const auto& dm_name : merging_devices_) {
+        std::string target_type;
+        DmTargetSnapshot::Status status;
+        if (!QuerySnapshotStatus(dm_name, &target_type, &status) ||
+            target_type != "snapshot-merge" || !status.error.empty()) {
+            return true;
+        }
+        bool rate_updated = false;
+        const auto& metrics =
+                UpdateMergeMetrics(dm_name, status, rate_due ? &rate_updated : nullptr);
+        if (status.sectors_allocated == status.metadata_sectors) {
+            return true;
+        }
+        have_rate = have_rate && rate_updated;
+        merge_rate += metrics.merge_rate;
+
+        // dm-snapshot doesn't raise an event when a merge finishes, so project
+        // when it will from the progress since the last sample and look again
+        // then, rather than up to a whole interval late.
+        if (metrics.merge_rate > 0) {
+            uint64_t remaining = status.sectors_allocated - status.metadata_sectors;
+            auto eta = duration_cast<std::chrono::milliseconds>(
+                    std::chrono::duration<double>(remaining / metrics.merge_rate));
+            timeout = std::min(timeout, std::max(eta, duration_cast<std::chrono::milliseconds>(
+                                                              kMinMergeCheckInterval)));
+        }
+    }
+    if (rate_due) {
+        merge_rate_sampled_at_ = now;
+    }
+    // Without a fresh rate for every device there is nothing to pace by.
+    if (have_rate) {
+        PaceMerge(merge_rate);
+    }
+
+    if (armed) {
+        return dm.WaitForEvent(timeout);
+    }
+    std::this_thread::sleep_for(timeout);
+    return false;
+}
+
+SnapshotMergeMetrics& SnapshotManager::UpdateMergeMetrics(const std::string& dm_name,
+                                                          const DmTargetSnapshot::Status& status,
+                                                          bool* rate_updated) {
+    auto now = std::chrono::steady_clock::now();
+    auto [iter, inserted] = merge_metrics_.emplace(dm_name, SnapshotMergeMetrics{});
+    auto& metrics = iter->second;
+    if (inserted) {
+        metrics.dm_name = dm_name;
+        metrics.initial_status = status;
+        metrics.first_sampled_at = now;
+        metrics.rate_sampled_at = now;
+        metrics.rate_sectors_allocated = status.sectors_allocated;
+    }
+    metrics.status = status;
+    metrics.sampled_at = now;
+    if (!rate_updated) {
+        return metrics;
+    }
+
+    *rate_updated = false;
+    std::chrono::duration<double> elapsed = now - metrics.rate_sampled_at;
+    if (elapsed < kMinMergeRateWindow) {
+        return metrics;
+    }
+    metrics.merge_rate = 0;
+    if (status.sectors_allocated < metrics.rate_sectors_allocated) {
+        metrics.merge_rate =
+                (metrics.rate_sectors_allocated - status.sectors_allocated) / elapsed.count();
+    }
+    metrics.rate_sampled_at = now;
+    metrics.rate_sectors_allocated = status.sectors_allocated;
+    *rate_updated = true;
+    return metrics;
+}
+
+std::vector<SnapshotMergeMetrics> SnapshotManager::GetMergeMetrics() const {
+    std::vector<SnapshotMergeMetrics> result;
+    for (const auto& [dm_name, metrics] : merge_metrics_) {
+        result.emplace_back(metrics);
+    }
+    return result;
+}
+
+void SnapshotManager::SetMergeThroughputTarget(uint64_t bytes_per_second) {
+    merge_throughput_target_ = bytes_per_second;
+}
+
+void SnapshotManager::PaceMerge(double merge_rate) {
+    if (copy_throttle_unavailable_) {
+        return;
+    }
+    if (!merge_throughput_target_) {
+        if (copy_throttle_ >= 0) {
+            RestoreMergePace();
+        }
+        return;
+    }
+    if (copy_throttle_ < 0) {
+        // The throttle is global and outlives this process, so save the
+        // original where a later ProcessUpdateState() can find it. The saved
+        // file stays locked while pacing, which also keeps other processes
+        // from pacing at the same time.
+        auto fd = LockCopyThrottleFile(true);
+        if (fd < 0) {
+            LOG(WARNING) << "Could not lock " << GetCopyThrottleFilePath()
+                         << ", merges will not be paced";
+            copy_throttle_unavailable_ = true;
+            return;
+        }
+        // A process that died while pacing may have left the original behind.
+        if (!ReadSavedCopyThrottle(fd.get(), &saved_copy_throttle_)) {
+            std::string contents;
+            if (!android::base::ReadFileToString(kCopyThrottlePath, &contents) ||
+                !android::base::ParseInt(android::base::Trim(contents), &saved_copy_throttle_)) {
+                PLOG(WARNING) << "Could not read " << kCopyThrottlePath
+                              << ", merges will not be paced";
+                unlink(GetCopyThrottleFilePath().c_str());
+                copy_throttle_unavailable_ = true;
+                return;
+            }
+            if (!WriteSavedCopyThrottle(fd.get(), saved_copy_throttle_)) {
+                PLOG(WARNING) << "Could not save " << kCopyThrottlePath
+                              << ", merges will not be paced";
+                unlink(GetCopyThrottleFilePath().c_str());
+                copy_throttle_unavailable_ = true;
+                return;
+            }
+        }
+        copy_throttle_fd_ = std::move(fd);
+        copy_throttle_ = std::clamp(saved_copy_throttle_, 1, 100);
+    }
+
+    // kcopyd throughput is roughly proportional to the throttle, so scale it
+    // by how far off target the merge is. Limit each step so that a noisy
+    // sample doesn't make it oscillate; a merge that made no progress at all
+    // is treated as being far too slow.
+    double target = static_cast<double>(merge_throughput_target_) / kSectorSize;
+    double ratio = merge_rate > 0 ? std::clamp(target / merge_rate, 0.5, 2.0) : 2.0;
+    int throttle = std::clamp(static_cast<int>(copy_throttle_ * ratio + 0.5), 1, 100);
+    if (throttle == copy_throttle_) {
+        return;
+    }
+    if (!android::base::WriteStringToFile(std::to_string(throttle), kCopyThrottlePath)) {
+        PLOG(WARNING) << "Could not write " << kCopyThrottlePath << ", merges will not be paced";
+        copy_throttle_unavailable_ = true;
+        RestoreMergePace();
+        return;
+    }
+    LOG(VERBOSE) << "Merging at " << merge_rate << " sectors/s, copy throttle now " << throttle;
+    copy_throttle_ = throttle;
+}
+
+void SnapshotManager::RestoreMergePace() {
+    auto saved_path = GetCopyThrottleFilePath();
+    int saved_throttle = saved_copy_throttle_;
+    unique_fd fd;
+    if (copy_throttle_ >= 0) {
+        fd = std::move(copy_throttle_fd_);
+    } else {
+        // This process hasn't changed the throttle, but one that died while
+        // pacing may have. One that is still pacing holds the lock.
+        fd = LockCopyThrottleFile(false);
+        if (fd < 0) {
+            return;
+        }
+        if (!ReadSavedCopyThrottle(fd.get(), &saved_throttle)) {
+            LOG(ERROR) << "Invalid copy throttle in " << saved_path;
+            unlink(saved_path.c_str());
+            return;
+        }
+        LOG(INFO) << "Restoring copy throttle " << saved_throttle << " left by an earlier merge";
+    }
+    if (copy_throttle_ != saved_throttle &&
+        !android::base::WriteStringToFile(std::to_string(saved_throttle), kCopyThrottlePath)) {
+        // Keep the saved value, unlocked, so that the next attempt can restore it.
+        PLOG(ERROR) << "Could not restore " << kCopyThrottlePath;
+        copy_throttle_ = -1;
+        return;
+    }
+    // Remove it while still locked, so that it can't be restored twice.
+    unlink(saved_path.c_str());
+    copy_throttle_ = -1;
+}
+
+unique_fd SnapshotManager::LockCopyThrottleFile(bool create) {
+    auto saved_path = GetCopyThrottleFilePath();
+    int flags = O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0);
+    unique_fd fd(open(saved_path.c_str(), flags, 0600));
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            PLOG(ERROR) << "open failed: " << saved_path;
         }
+        return {};
+    }
+    if (flock(fd.get(), LOCK_EX | LOCK_NB) < 0) {
+        if (errno != EWOULDBLOCK) {
+            PLOG(ERROR) << "flock failed: " << saved_path;
+        }
+        return {};
+    }
+    // The previous holder may have removed the file between open() and
+    // flock(), in which case the lock protects nothing.
+    struct stat fd_st, path_st;
+    if (fstat(fd.get(), &fd_st) < 0 || stat(saved_path.c_str(), &path_st) < 0 ||
+        fd_st.st_dev != path_st.st_dev || fd_st.st_ino != path_st.st_ino) {
+        return {};
+    }
+    return fd;
+}
+
+bool SnapshotManager::ReadSavedCopyThrottle(int fd, int* throttle) {
+    std::string contents;
+    if (lseek(fd, 0, SEEK_SET) < 0 || !android::base::ReadFdToString(fd, &contents)) {
+        return false;
+    }
+    return android::base::ParseInt(android::base::Trim(contents), throttle, 0, 100);
+}
+
+bool SnapshotManager::WriteSavedCopyThrottle(int fd, int throttle) {
+    return ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0 &&
+           android::base::WriteStringToFd(std::to_string(throttle), fd) && fsync(fd) == 0;
+}
+
+uint64_t SnapshotMergeMetrics::sectors_merged() const {
+    if (status.sectors_allocated >= initial_status.sectors_allocated) {
+        return 0;
+    }
+    return initial_status.sectors_allocated - status.sectors_allocated;
+}
+
+double SnapshotMergeMetrics::average_merge_rate() const {
+    std::chrono::duration<double> elapsed = sampled_at - first_sampled_at;
+    if (elapsed.count() <= 0) {
+        return 0;
+    }
+    return sectors_merged() / elapsed.count();
+}
 
-        // This wait is not super time sensitive, so we have a relatively
-        // low polling frequency.
-        std::this_thread::sleep_for(kUpdateStateCheckInterval);
+double SnapshotMergeMetrics::cow_fill() const {
+    if (status.total_sectors == 0) {
+        return 0;
     }
+    return static_cast<double>(status.sectors_allocated) / status.total_sectors;
+}
+
+double SnapshotMergeMetrics::io_amplification() const {
+    const auto& initial = initial_status;
+    if (initial.sectors_allocated <= initial.metadata_sectors) {
+        return 1;
+    }
+    return static_cast<double>(initial.sectors_allocated) /
+           (initial.sectors_allocated - initial.metadata_sectors);
 }
 
 UpdateState SnapshotManager::CheckMergeState(const std::function<bool()>& before_cancel) {
@@ -845,6 +1202,8 @@ UpdateState SnapshotManager::CheckMergeState(const std::function<bool()>& before
 
 UpdateState SnapshotManager::CheckMergeState(LockedFile* lock,
                                              const std::function<bool()>& before_cancel) {
+    merging_devices_.clear();
+
     UpdateState state = ReadUpdateState(lock);
     switch (state) {
         case UpdateState::None:
@@ -987,12 +1346,15 @@ UpdateState SnapshotManager::CheckTargetMergeState(LockedFile* lock, const std::
         return UpdateState::MergeFailed;
     }
 
+    UpdateMergeMetrics(dm_name, status);
+
     // These two values are equal when merging is complete.
     if (status.sectors_allocated != status.metadata_sectors) {
         if (snapshot_status.state() == SnapshotState::MERGE_COMPLETED) {
             LOG(ERROR) << "Snapshot " << name << " is merging after being marked merge-complete.";
             return UpdateState::MergeFailed;
         }
+        merging_devices_.push_back(dm_name);
         return UpdateState::Merging;
     }
 
@@ -1870,6 +2232,10 @@ std::string SnapshotManager::GetMergeStateFilePath() const {
     return metadata_dir_ + "/merge_state"s;
 }
 
+std::string SnapshotManager::GetCopyThrottleFilePath() const {
+    return metadata_dir_ + "/"s + kCopyThrottleFileName;
+}
+
 std::string SnapshotManager::GetLockPath() const {
     return metadata_dir_;
 }
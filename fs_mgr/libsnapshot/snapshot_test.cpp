@@ -26,6 +26,7 @@
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
+#include <android-base/parseint.h>
 #include <android-base/properties.h>
 #include <android-base/strings.h>
 #include <android-base/unique_fd.h>
@@ -505,6 +506,118 @@ TEST_F(SnapshotTest, Merge) {
     ASSERT_EQ(test_string, buffer);
 }
 
+TEST_F(SnapshotTest, WatchMetadataDir) {
+    // While a merge is in progress, ProcessUpdateState relies on this to see
+    // state written by another process without re-reading every status file.
+    auto watch_fd = sm->WatchMetadataDir();
+    ASSERT_GE(watch_fd, 0);
+    ASSERT_FALSE(SnapshotManager::ConsumeMetadataChanges(watch_fd.get()));
+
+    // Writes from another SnapshotManager are noticed once.
+    auto other = SnapshotManager::New(new TestDeviceInfo(fake_super));
+    ASSERT_NE(other, nullptr);
+    {
+        auto lock = other->LockExclusive();
+        ASSERT_NE(lock, nullptr);
+        ASSERT_TRUE(other->WriteUpdateState(lock.get(), UpdateState::Initiated));
+    }
+    ASSERT_TRUE(SnapshotManager::ConsumeMetadataChanges(watch_fd.get()));
+    ASSERT_FALSE(SnapshotManager::ConsumeMetadataChanges(watch_fd.get()));
+
+    // Saving the copy throttle while pacing must not look like a change.
+    ASSERT_TRUE(android::base::WriteStringToFile("50", sm->GetCopyThrottleFilePath()));
+    ASSERT_FALSE(SnapshotManager::ConsumeMetadataChanges(watch_fd.get()));
+    ASSERT_EQ(unlink(sm->GetCopyThrottleFilePath().c_str()), 0);
+    ASSERT_FALSE(SnapshotManager::ConsumeMetadataChanges(watch_fd.get()));
+}
+
+TEST_F(SnapshotTest, MergeMetrics) {
+    ASSERT_TRUE(AcquireLock());
+
+    static const uint64_t kDeviceSize = 1024 * 1024;
+    std::string snap_device;
+    ASSERT_TRUE(PrepareOneSnapshot(kDeviceSize, &snap_device));
+
+    {
+        std::string data(kDeviceSize / 2, 'x');
+        unique_fd fd(open(snap_device.c_str(), O_RDWR | O_CLOEXEC | O_SYNC));
+        ASSERT_GE(fd, 0);
+        ASSERT_TRUE(android::base::WriteFully(fd, data.data(), data.size()));
+    }
+
+    lock_ = nullptr;
+    ASSERT_TRUE(sm->FinishedSnapshotWrites(false));
+
+    test_device->set_slot_suffix("_b");
+    ASSERT_TRUE(sm->InitiateMerge());
+
+    // A target far below what the device can do must not stop the merge.
+    sm->SetMergeThroughputTarget(4096);
+    ASSERT_EQ(sm->ProcessUpdateState(), UpdateState::MergeCompleted);
+
+    auto metrics = sm->GetMergeMetrics();
+    ASSERT_EQ(metrics.size(), 1);
+    EXPECT_EQ(metrics[0].dm_name, "test_partition_b");
+    EXPECT_EQ(metrics[0].status.sectors_allocated, metrics[0].status.metadata_sectors);
+    EXPECT_EQ(metrics[0].sectors_merged(), metrics[0].initial_status.sectors_allocated -
+                                                   metrics[0].initial_status.metadata_sectors);
+    EXPECT_GE(metrics[0].io_amplification(), 1.0);
+    EXPECT_GE(metrics[0].cow_fill(), 0.0);
+    EXPECT_LE(metrics[0].cow_fill(), 1.0);
+
+    // The original copy throttle is only saved while pacing.
+    ASSERT_NE(access(sm->GetCopyThrottleFilePath().c_str(), F_OK), 0);
+}
+
+TEST_F(SnapshotTest, RestoreMergePaceAfterCrash) {
+    static constexpr char kCopyThrottlePath[] =
+            "/sys/module/dm_snapshot/parameters/snapshot_copy_throttle";
+    std::string contents;
+    int original;
+    if (!android::base::ReadFileToString(kCopyThrottlePath, &contents) ||
+        !android::base::ParseInt(android::base::Trim(contents), &original)) {
+        GTEST_SKIP() << "dm-snapshot copy throttle not available";
+    }
+
+    // Simulate a process that died while pacing a merge: the throttle was
+    // changed and the original saved, but never put back.
+    ASSERT_TRUE(android::base::WriteStringToFile(std::to_string(original),
+                                                 sm->GetCopyThrottleFilePath()));
+    ASSERT_TRUE(android::base::WriteStringToFile(std::to_string(original % 100 + 1),
+                                                 kCopyThrottlePath));
+
+    sm->ProcessUpdateState();
+
+    ASSERT_TRUE(android::base::ReadFileToString(kCopyThrottlePath, &contents));
+    ASSERT_EQ(android::base::Trim(contents), std::to_string(original));
+    ASSERT_NE(access(sm->GetCopyThrottleFilePath().c_str(), F_OK), 0);
+
+    // A process that is still pacing holds a lock on the saved throttle, and
+    // must be left alone.
+    ASSERT_TRUE(android::base::WriteStringToFile(std::to_string(original),
+                                                 sm->GetCopyThrottleFilePath()));
+    unique_fd saved_fd(open(sm->GetCopyThrottleFilePath().c_str(), O_RDONLY | O_CLOEXEC));
+    ASSERT_GE(saved_fd, 0);
+    ASSERT_EQ(flock(saved_fd.get(), LOCK_EX), 0);
+    auto paced = std::to_string(original % 100 + 1);
+    ASSERT_TRUE(android::base::WriteStringToFile(paced, kCopyThrottlePath));
+
+    sm->ProcessUpdateState();
+
+    ASSERT_TRUE(android::base::ReadFileToString(kCopyThrottlePath, &contents));
+    EXPECT_EQ(android::base::Trim(contents), paced);
+    EXPECT_EQ(access(sm->GetCopyThrottleFilePath().c_str(), F_OK), 0);
+
+    // Once that process is gone, the next ProcessUpdateState() puts the
+    // throttle back.
+    saved_fd.reset();
+    sm->ProcessUpdateState();
+
+    ASSERT_TRUE(android::base::ReadFileToString(kCopyThrottlePath, &contents));
+    ASSERT_EQ(android::base::Trim(contents), std::to_string(original));
+    ASSERT_NE(access(sm->GetCopyThrottleFilePath().c_str(), F_OK), 0);
+}
+
 TEST_F(SnapshotTest, FirstStageMountAndMerge) {
     ASSERT_TRUE(AcquireLock());
 
@@ -131,16 +131,28 @@ class FuseBridgeEntry {
   private:
     friend class BridgeEpollController;
 
+    // Forwards all the replies the proxy has queued, so that replies to
+    // pipelined requests don't take an epoll_wait() each.
     FuseBridgeState ReadFromProxy() {
-        switch (buffer_.response.ReadOrAgain(proxy_fd_)) {
-            case ResultOrAgain::kSuccess:
-                break;
-            case ResultOrAgain::kFailure:
-                return FuseBridgeState::kClosing;
-            case ResultOrAgain::kAgain:
-                return FuseBridgeState::kWaitToReadProxy;
+        for (bool first = true;; first = false) {
+            switch (buffer_.response.ReadOrAgain(proxy_fd_)) {
+                case ResultOrAgain::kSuccess:
+                    break;
+                case ResultOrAgain::kFailure:
+                    return FuseBridgeState::kClosing;
+                case ResultOrAgain::kAgain:
+                    return first ? FuseBridgeState::kWaitToReadProxy
+                                 : FuseBridgeState::kWaitToReadEither;
+            }
+
+            const FuseBridgeState state = WriteToDevice();
+            if (state != FuseBridgeState::kWaitToReadEither) {
+                return state;
+            }
         }
+    }
 
+    FuseBridgeState WriteToDevice() {
         if (!buffer_.response.Write(device_fd_)) {
             LogResponseError("Failed to write a reply from proxy to device", buffer_.response);
             return FuseBridgeState::kClosing;
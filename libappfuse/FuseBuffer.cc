@@ -215,6 +215,7 @@ void FuseBuffer::HandleInit() {
   const uint64_t unique = request.header.unique;
   const uint32_t minor = in->minor;
   const uint32_t max_readahead = in->max_readahead;
+  const uint32_t flags = in->flags;
 
   // Kernel 2.6.16 is the first stable kernel with struct fuse_init_out
   // defined (fuse version 7.6). The structure is the same from 7.6 through
@@ -243,6 +244,9 @@ void FuseBuffer::HandleInit() {
   out->minor = std::min(minor, 15u);
   out->max_readahead = max_readahead;
   out->flags = FUSE_ATOMIC_O_TRUNC | FUSE_BIG_WRITES;
+  // Let the kernel send readahead requests without waiting for each reply,
+  // so that a sequential read keeps several FUSE_READs in flight.
+  out->flags |= flags & FUSE_ASYNC_READ;
   out->max_background = 32;
   out->congestion_threshold = 32;
   out->max_write = kFuseMaxWrite;
@@ -195,6 +195,38 @@ TEST_F(FuseBridgeLoopTest, FuseNotImpl) {
   CheckNotImpl(FUSE_LSEEK);
 }
 
+TEST_F(FuseBridgeLoopTest, PipelinedReads) {
+  constexpr uint64_t kRequests = 4;
+  for (uint64_t unique = 1; unique <= kRequests; unique++) {
+    memset(&request_, 0, sizeof(FuseRequest));
+    request_.header.opcode = FUSE_READ;
+    request_.header.unique = unique;
+    request_.header.len = sizeof(fuse_in_header) + sizeof(fuse_read_in);
+    request_.read_in.size = 16;
+    ASSERT_TRUE(request_.Write(dev_sockets_[0]));
+  }
+  for (uint64_t unique = 1; unique <= kRequests; unique++) {
+    memset(&request_, 0, sizeof(FuseRequest));
+    ASSERT_TRUE(request_.Read(proxy_sockets_[1]));
+    EXPECT_EQ(unique, request_.header.unique);
+  }
+
+  // Reply to all of them at once, the loop must forward every reply.
+  for (uint64_t unique = 1; unique <= kRequests; unique++) {
+    memset(&response_, 0, sizeof(FuseResponse));
+    response_.ResetHeader(16, kFuseSuccess, unique);
+    memset(response_.read_data, static_cast<int>(unique), 16);
+    ASSERT_TRUE(response_.Write(proxy_sockets_[1]));
+  }
+  for (uint64_t unique = 1; unique <= kRequests; unique++) {
+    memset(&response_, 0, sizeof(FuseResponse));
+    ASSERT_TRUE(response_.Read(dev_sockets_[0]));
+    EXPECT_EQ(unique, response_.header.unique);
+    EXPECT_EQ(sizeof(fuse_out_header) + 16, response_.header.len);
+    EXPECT_EQ(static_cast<char>(unique), response_.read_data[15]);
+  }
+}
+
 TEST_F(FuseBridgeLoopTest, Proxy) {
   CheckProxy(FUSE_LOOKUP);
   CheckProxy(FUSE_GETATTR);
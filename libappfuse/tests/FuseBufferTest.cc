@@ -177,6 +177,22 @@ TEST(FuseBufferTest, HandleInit) {
   EXPECT_EQ(kFuseMaxWrite, buffer.response.init_out.max_write);
 }
 
+TEST(FuseBufferTest, HandleInitAsyncRead) {
+  FuseBuffer buffer;
+  memset(&buffer, 0, sizeof(FuseBuffer));
+
+  buffer.request.header.opcode = FUSE_INIT;
+  buffer.request.init_in.major = FUSE_KERNEL_VERSION;
+  buffer.request.init_in.minor = FUSE_KERNEL_MINOR_VERSION;
+  buffer.request.init_in.flags = FUSE_ASYNC_READ | FUSE_POSIX_LOCKS;
+
+  buffer.HandleInit();
+
+  ASSERT_EQ(kFuseSuccess, buffer.response.header.error);
+  EXPECT_EQ(static_cast<unsigned int>(FUSE_ATOMIC_O_TRUNC | FUSE_BIG_WRITES | FUSE_ASYNC_READ),
+      buffer.response.init_out.flags);
+}
+
 TEST(FuseBufferTest, HandleNotImpl) {
   FuseBuffer buffer;
   memset(&buffer, 0, sizeof(FuseBuffer));
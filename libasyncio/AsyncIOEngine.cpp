@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <asyncio/AsyncIOEngine.h>
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <asyncio/AsyncIO.h>
+
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+namespace android {
+namespace asyncio {
+
+AsyncIOEngine::AsyncIOEngine(unsigned queue_depth)
+    : ops_(new Operation[queue_depth]), queue_depth_(queue_depth) {
+    free_slots_.reserve(queue_depth);
+    for (unsigned slot = queue_depth; slot > 0; slot--) {
+        free_slots_.push_back(slot - 1);
+    }
+}
+
+bool AsyncIOEngine::PrepRead(int fd, void* buf, size_t len, uint64_t offset, uint64_t user_data,
+                             int buf_index) {
+    return Prep(fd, true, buf, len, offset, user_data, buf_index);
+}
+
+bool AsyncIOEngine::PrepWrite(int fd, const void* buf, size_t len, uint64_t offset,
+                              uint64_t user_data, int buf_index) {
+    return Prep(fd, false, const_cast<void*>(buf), len, offset, user_data, buf_index);
+}
+
+bool AsyncIOEngine::Prep(int fd, bool read, void* buf, size_t len, uint64_t offset,
+                         uint64_t user_data, int buf_index) {
+    if (free_slots_.empty()) {
+        return false;
+    }
+    unsigned slot = free_slots_.back();
+    free_slots_.pop_back();
+    ops_[slot] = {fd, read, buf_index, {buf, len}, offset, user_data};
+    Prepare(slot);
+    return true;
+}
+
+uint64_t AsyncIOEngine::Release(unsigned slot) {
+    free_slots_.push_back(slot);
+    return ops_[slot].user_data;
+}
+
+namespace {
+
+class AioEngine : public AsyncIOEngine {
+  public:
+    static std::unique_ptr<AsyncIOEngine> Create(unsigned queue_depth) {
+        aio_context_t ctx = 0;
+        if (io_setup(queue_depth, &ctx) == -1) {
+            return nullptr;
+        }
+        return std::unique_ptr<AsyncIOEngine>(new AioEngine(queue_depth, ctx));
+    }
+
+    ~AioEngine() override { io_destroy(ctx_); }
+
+    AsyncIOBackend backend() const override { return AsyncIOBackend::kAio; }
+
+    // Kernel AIO maps the user pages of each operation anyway.
+    int RegisterBuffers(const struct iovec*, unsigned) override {
+        if (in_flight() != 0) {
+            errno = EBUSY;
+            return -1;
+        }
+        return 0;
+    }
+
+    int Submit(unsigned) override {
+        size_t submitted = 0;
+        while (submitted < pending_.size()) {
+            int rc = io_submit(ctx_, pending_.size() - submitted, pending_.data() + submitted);
+            if (rc == -1 && errno == EINTR) {
+                continue;
+            }
+            if (rc == -1 && errno == EAGAIN) {
+                // Out of kernel resources, try the rest next time.
+                break;
+            }
+            if (rc == -1) {
+                // The first one was refused, complete it with the error so
+                // that it doesn't hold up the others.
+                failed_.push_back({pending_[submitted]->aio_data, -errno});
+                submitted++;
+                continue;
+            }
+            submitted += rc;
+        }
+        pending_.erase(pending_.begin(), pending_.begin() + submitted);
+        return submitted;
+    }
+
+    int Reap(AsyncIOCompletion* completions, unsigned max, unsigned min_complete) override {
+        unsigned n = 0;
+        while (!failed_.empty() && n < max) {
+            completions[n++] = {Release(failed_.back().user_data), failed_.back().result};
+            failed_.pop_back();
+        }
+        while (n < max) {
+            long min_nr = n < min_complete ? min_complete - n : 0;
+            int rc = io_getevents(ctx_, min_nr, max - n, events_.get(), nullptr);
+            if (rc == -1 && errno == EINTR) {
+                continue;
+            }
+            if (rc == -1) {
+                return n != 0 ? n : -1;
+            }
+            for (int i = 0; i < rc; i++) {
+                completions[n++] = {Release(events_[i].data), events_[i].res};
+            }
+            if (n >= min_complete) {
+                break;
+            }
+        }
+        return n;
+    }
+
+  protected:
+    void Prepare(unsigned slot) override {
+        const Operation& op = ops_[slot];
+        iocb* cb = &iocbs_[slot];
+        io_prep(cb, op.fd, op.iov.iov_base, op.iov.iov_len, op.offset, op.read);
+        cb->aio_data = slot;
+        pending_.push_back(cb);
+    }
+
+  private:
+    AioEngine(unsigned queue_depth, aio_context_t ctx)
+        : AsyncIOEngine(queue_depth),
+          ctx_(ctx),
+          iocbs_(new iocb[queue_depth]),
+          events_(new io_event[queue_depth]) {
+        pending_.reserve(queue_depth);
+    }
+
+    aio_context_t ctx_;
+    std::unique_ptr<iocb[]> iocbs_;
+    std::unique_ptr<io_event[]> events_;
+    std::vector<iocb*> pending_;
+    // Operations io_submit() refused, as (slot, -errno).
+    std::vector<AsyncIOCompletion> failed_;
+};
+
+#if defined(HAVE_IO_URING)
+
+class IoUringEngine : public AsyncIOEngine {
+  public:
+    static std::unique_ptr<AsyncIOEngine> Create(unsigned queue_depth) {
+        std::unique_ptr<IoUringEngine> engine(new IoUringEngine(queue_depth));
+        if (!engine->Init()) {
+            return nullptr;
+        }
+        return engine;
+    }
+
+    ~IoUringEngine() override {
+        if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_size_);
+        if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) munmap(cq_ring_, cq_ring_size_);
+        if (sq_ring_ != MAP_FAILED) munmap(sq_ring_, sq_ring_size_);
+        if (ring_fd_ != -1) close(ring_fd_);
+    }
+
+    AsyncIOBackend backend() const override { return AsyncIOBackend::kIoUring; }
+
+    int RegisterBuffers(const struct iovec* buffers, unsigned count) override {
+        if (in_flight() != 0) {
+            errno = EBUSY;
+            return -1;
+        }
+        if (buffers_registered_) {
+            if (Register(IORING_UNREGISTER_BUFFERS, nullptr, 0) == -1) {
+                return -1;
+            }
+            buffers_registered_ = false;
+        }
+        if (count == 0) {
+            return 0;
+        }
+        if (Register(IORING_REGISTER_BUFFERS, buffers, count) == -1) {
+            return -1;
+        }
+        buffers_registered_ = true;
+        return 0;
+    }
+
+    int Submit(unsigned wait_nr) override {
+        __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+        // Entries the kernel hasn't consumed yet, including any it left
+        // behind on a previous call.
+        unsigned to_submit = sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (to_submit == 0 && wait_nr == 0) {
+            return 0;
+        }
+        unsigned flags = wait_nr != 0 ? IORING_ENTER_GETEVENTS : 0;
+        int rc;
+        do {
+            rc = Enter(to_submit, wait_nr, flags);
+        } while (rc == -1 && errno == EINTR && to_submit == 0);
+        if (rc == -1 && errno == EINTR) {
+            // Interrupted before submitting anything, the next call will.
+            return 0;
+        }
+        return rc;
+    }
+
+    int Reap(AsyncIOCompletion* completions, unsigned max, unsigned min_complete) override {
+        unsigned n = 0;
+        while (true) {
+            unsigned head = *cq_head_;
+            unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+            for (; head != tail && n < max; head++) {
+                const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+                completions[n++] = {Release(cqe.user_data), cqe.res};
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+            if (n >= min_complete || n == max) {
+                return n;
+            }
+            if (Enter(0, min_complete - n, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR) {
+                return n != 0 ? n : -1;
+            }
+        }
+    }
+
+  protected:
+    void Prepare(unsigned slot) override {
+        Operation& op = ops_[slot];
+        unsigned index = sqe_tail_ & *sq_mask_;
+        io_uring_sqe* sqe = &sqes_[index];
+        memset(sqe, 0, sizeof(*sqe));
+        if (op.buf_index >= 0) {
+            sqe->opcode = op.read ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+            sqe->addr = reinterpret_cast<uintptr_t>(op.iov.iov_base);
+            sqe->len = op.iov.iov_len;
+            sqe->buf_index = op.buf_index;
+        } else {
+            // The vectored opcodes are the ones every io_uring kernel has. The
+            // iovec lives in the slot, so it outlasts the operation.
+            sqe->opcode = op.read ? IORING_OP_READV : IORING_OP_WRITEV;
+            sqe->addr = reinterpret_cast<uintptr_t>(&op.iov);
+            sqe->len = 1;
+        }
+        sqe->fd = op.fd;
+        sqe->off = op.offset;
+        sqe->user_data = slot;
+        sq_array_[index] = index;
+        sqe_tail_++;
+    }
+
+  private:
+    explicit IoUringEngine(unsigned queue_depth) : AsyncIOEngine(queue_depth) {}
+
+    bool Init() {
+        io_uring_params params = {};
+        ring_fd_ = syscall(__NR_io_uring_setup, queue_depth(), &params);
+        if (ring_fd_ == -1) {
+            return false;
+        }
+
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = false;
+#if defined(IORING_FEAT_SINGLE_MMAP)
+        single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+#endif
+        if (single_mmap) {
+            sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+        }
+        sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring_fd_, IORING_OFF_SQ_RING);
+        if (sq_ring_ == MAP_FAILED) {
+            return false;
+        }
+        if (single_mmap) {
+            cq_ring_ = sq_ring_;
+        } else {
+            cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+            if (cq_ring_ == MAP_FAILED) {
+                return false;
+            }
+        }
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_POPULATE, ring_fd_,
+                                                IORING_OFF_SQES));
+        if (sqes_ == MAP_FAILED) {
+            return false;
+        }
+
+        char* sq = static_cast<char*>(sq_ring_);
+        sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        char* cq = static_cast<char*>(cq_ring_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        sqe_tail_ = *sq_tail_;
+        return true;
+    }
+
+    int Enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+        return syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete, flags, nullptr, 0);
+    }
+
+    int Register(unsigned opcode, const void* arg, unsigned nr_args) {
+        return syscall(__NR_io_uring_register, ring_fd_, opcode, arg, nr_args);
+    }
+
+    int ring_fd_ = -1;
+    void* sq_ring_ = MAP_FAILED;
+    size_t sq_ring_size_ = 0;
+    void* cq_ring_ = MAP_FAILED;
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe* sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_mask_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned* cq_mask_ = nullptr;
+    io_uring_cqe* cqes_ = nullptr;
+
+    // Tail of the entries prepared so far, published to the kernel on Submit().
+    unsigned sqe_tail_ = 0;
+    bool buffers_registered_ = false;
+};
+
+#endif  // HAVE_IO_URING
+
+}  // namespace
+
+std::unique_ptr<AsyncIOEngine> AsyncIOEngine::Create(unsigned queue_depth,
+                                                     AsyncIOBackend backend) {
+    if (queue_depth == 0) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    switch (backend) {
+        case AsyncIOBackend::kAuto:
+#if defined(HAVE_IO_URING)
+            // io_uring may be missing from the kernel or denied by policy.
+            if (auto engine = IoUringEngine::Create(queue_depth)) {
+                return engine;
+            }
+#endif
+            return AioEngine::Create(queue_depth);
+        case AsyncIOBackend::kAio:
+            return AioEngine::Create(queue_depth);
+        case AsyncIOBackend::kIoUring:
+#if defined(HAVE_IO_URING)
+            return IoUringEngine::Create(queue_depth);
+#else
+            errno = ENOSYS;
+            return nullptr;
+#endif
+    }
+    errno = EINVAL;
+    return nullptr;
+}
+
+}  // namespace asyncio
+}  // namespace android
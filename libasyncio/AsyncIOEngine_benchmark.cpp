@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <asyncio/AsyncIOEngine.h>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <android-base/file.h>
+#include <benchmark/benchmark.h>
+
+using namespace android::asyncio;
+
+static constexpr size_t kBlockSize = 4096;
+static constexpr size_t kFileSize = 16 * 1024 * 1024;
+static constexpr size_t kBlocks = kFileSize / kBlockSize;
+
+static TemporaryFile* TestFile() {
+    static TemporaryFile* tf = [] {
+        TemporaryFile* tf = new TemporaryFile;
+        std::string data(kFileSize, 'x');
+        android::base::WriteStringToFd(data, tf->fd);
+        fsync(tf->fd);
+        return tf;
+    }();
+    return tf;
+}
+
+// One pread() per block, as a baseline.
+static void BM_pread(benchmark::State& state) {
+    int fd = TestFile()->fd;
+    std::vector<char> buf(kBlockSize);
+    size_t block = 0;
+    for (auto _ : state) {
+        block = (block * 7 + 1) % kBlocks;
+        pread(fd, buf.data(), kBlockSize, block * kBlockSize);
+    }
+    state.SetBytesProcessed(state.iterations() * kBlockSize);
+}
+BENCHMARK(BM_pread);
+
+// Random 4KiB reads keeping state.range(1) of them in flight.
+static void BM_AsyncIORead(benchmark::State& state) {
+    AsyncIOBackend backend = static_cast<AsyncIOBackend>(state.range(0));
+    unsigned depth = state.range(1);
+    bool registered = state.range(2);
+    auto engine = AsyncIOEngine::Create(depth, backend);
+    if (!engine) {
+        state.SkipWithError("backend not available");
+        return;
+    }
+
+    int fd = TestFile()->fd;
+    std::vector<char> buf(depth * kBlockSize);
+    if (registered) {
+        struct iovec iov = {buf.data(), buf.size()};
+        engine->RegisterBuffers(&iov, 1);
+    }
+    std::vector<AsyncIOCompletion> completions(depth);
+    size_t block = 0;
+    auto prep = [&](uint64_t slot) {
+        block = (block * 7 + 1) % kBlocks;
+        engine->PrepRead(fd, &buf[slot * kBlockSize], kBlockSize, block * kBlockSize, slot,
+                         registered ? 0 : -1);
+    };
+
+    for (unsigned i = 0; i < depth; i++) prep(i);
+    uint64_t completed = 0;
+    for (auto _ : state) {
+        // Top the queue back up with whatever completed.
+        engine->Submit(1);
+        int n = engine->Reap(completions.data(), depth, 1);
+        for (int i = 0; i < n; i++) prep(completions[i].user_data);
+        completed += n;
+    }
+    engine->Submit();
+    engine->Reap(completions.data(), depth, engine->in_flight());
+    state.SetBytesProcessed(completed * kBlockSize);
+    state.counters["completions"] =
+            benchmark::Counter(completed, benchmark::Counter::kAvgIterations);
+}
+
+static void AsyncIOReadArgs(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"backend", "depth", "registered"});
+    for (int depth : {1, 8, 32}) {
+        b->Args({static_cast<int>(AsyncIOBackend::kAio), depth, 0});
+        b->Args({static_cast<int>(AsyncIOBackend::kIoUring), depth, 0});
+        b->Args({static_cast<int>(AsyncIOBackend::kIoUring), depth, 1});
+    }
+}
+BENCHMARK(BM_AsyncIORead)->Apply(AsyncIOReadArgs);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <asyncio/AsyncIOEngine.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+using namespace android::asyncio;
+
+class AsyncIOEngineTest : public ::testing::TestWithParam<AsyncIOBackend> {
+  protected:
+    void SetUp() override {
+        engine_ = AsyncIOEngine::Create(kDepth, GetParam());
+        if (!engine_ && GetParam() == AsyncIOBackend::kIoUring) {
+            GTEST_SKIP() << "io_uring is not available: " << strerror(errno);
+        }
+        ASSERT_NE(nullptr, engine_) << strerror(errno);
+        ASSERT_NE(-1, tf_.fd);
+    }
+
+    // Reaps everything in flight, sorted by user data.
+    std::vector<AsyncIOCompletion> ReapAll() {
+        std::vector<AsyncIOCompletion> completions(kDepth);
+        unsigned count = engine_->in_flight();
+        EXPECT_EQ(static_cast<int>(count), engine_->Reap(completions.data(), kDepth, count));
+        completions.resize(count);
+        std::sort(completions.begin(), completions.end(),
+                  [](const auto& a, const auto& b) { return a.user_data < b.user_data; });
+        return completions;
+    }
+
+    static constexpr unsigned kDepth = 8;
+    static constexpr size_t kBlockSize = 4096;
+
+    std::unique_ptr<AsyncIOEngine> engine_;
+    TemporaryFile tf_;
+};
+
+TEST_P(AsyncIOEngineTest, WriteThenRead) {
+    std::vector<char> out(kDepth * kBlockSize);
+    for (size_t i = 0; i < out.size(); i++) {
+        out[i] = static_cast<char>(i / kBlockSize + 1);
+    }
+    for (unsigned i = 0; i < kDepth; i++) {
+        ASSERT_TRUE(engine_->PrepWrite(tf_.fd, &out[i * kBlockSize], kBlockSize, i * kBlockSize,
+                                       100 + i));
+    }
+    ASSERT_EQ(static_cast<int>(kDepth), engine_->Submit());
+    auto completions = ReapAll();
+    ASSERT_EQ(kDepth, completions.size());
+    for (unsigned i = 0; i < kDepth; i++) {
+        EXPECT_EQ(100 + i, completions[i].user_data);
+        EXPECT_EQ(static_cast<int64_t>(kBlockSize), completions[i].result);
+    }
+
+    // Read the blocks back in reverse, waiting as part of the submission.
+    std::vector<char> in(out.size());
+    for (unsigned i = kDepth; i > 0; i--) {
+        ASSERT_TRUE(engine_->PrepRead(tf_.fd, &in[(i - 1) * kBlockSize], kBlockSize,
+                                      (i - 1) * kBlockSize, i - 1));
+    }
+    ASSERT_EQ(static_cast<int>(kDepth), engine_->Submit(kDepth));
+    completions = ReapAll();
+    ASSERT_EQ(kDepth, completions.size());
+    for (unsigned i = 0; i < kDepth; i++) {
+        EXPECT_EQ(i, completions[i].user_data);
+        EXPECT_EQ(static_cast<int64_t>(kBlockSize), completions[i].result);
+    }
+    EXPECT_EQ(out, in);
+}
+
+TEST_P(AsyncIOEngineTest, QueueFull) {
+    char buf[16];
+    for (unsigned i = 0; i < kDepth; i++) {
+        ASSERT_TRUE(engine_->PrepRead(tf_.fd, buf, sizeof(buf), 0, i));
+    }
+    EXPECT_FALSE(engine_->PrepRead(tf_.fd, buf, sizeof(buf), 0, kDepth));
+    EXPECT_EQ(kDepth, engine_->in_flight());
+
+    ASSERT_EQ(static_cast<int>(kDepth), engine_->Submit());
+    EXPECT_EQ(kDepth, ReapAll().size());
+    EXPECT_EQ(0U, engine_->in_flight());
+    EXPECT_TRUE(engine_->PrepRead(tf_.fd, buf, sizeof(buf), 0, 0));
+}
+
+TEST_P(AsyncIOEngineTest, RegisteredBuffers) {
+    ASSERT_TRUE(android::base::WriteStringToFd("registered", tf_.fd));
+    std::vector<char> buf(kBlockSize);
+    struct iovec iov = {buf.data(), buf.size()};
+    ASSERT_EQ(0, engine_->RegisterBuffers(&iov, 1)) << strerror(errno);
+
+    ASSERT_TRUE(engine_->PrepRead(tf_.fd, buf.data() + 100, 10, 0, 7, 0));
+    ASSERT_EQ(1, engine_->Submit());
+    // Buffers can't change while they're in use.
+    EXPECT_EQ(-1, engine_->RegisterBuffers(nullptr, 0));
+    EXPECT_EQ(EBUSY, errno);
+
+    auto completions = ReapAll();
+    ASSERT_EQ(1U, completions.size());
+    EXPECT_EQ(7U, completions[0].user_data);
+    EXPECT_EQ(10, completions[0].result);
+    EXPECT_EQ("registered", std::string(buf.data() + 100, 10));
+    EXPECT_EQ(0, engine_->RegisterBuffers(nullptr, 0));
+}
+
+TEST_P(AsyncIOEngineTest, Errors) {
+    char buf[16];
+    ASSERT_TRUE(engine_->PrepRead(tf_.fd, buf, sizeof(buf), 0, 1));
+    ASSERT_TRUE(engine_->PrepRead(-1, buf, sizeof(buf), 0, 2));
+    ASSERT_TRUE(engine_->PrepRead(tf_.fd, buf, sizeof(buf), 0, 3));
+    ASSERT_EQ(3, engine_->Submit());
+
+    auto completions = ReapAll();
+    ASSERT_EQ(3U, completions.size());
+    EXPECT_EQ(0, completions[0].result);
+    EXPECT_EQ(-EBADF, completions[1].result);
+    EXPECT_EQ(0, completions[2].result);
+}
+
+TEST_P(AsyncIOEngineTest, ReapNothing) {
+    AsyncIOCompletion completion;
+    EXPECT_EQ(0, engine_->Reap(&completion, 1, 0));
+    EXPECT_EQ(0, engine_->Submit());
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, AsyncIOEngineTest,
+                         ::testing::Values(AsyncIOBackend::kAio, AsyncIOBackend::kIoUring,
+                                           AsyncIOBackend::kAuto),
+                         [](const ::testing::TestParamInfo<AsyncIOBackend>& info) {
+                             switch (info.param) {
+                                 case AsyncIOBackend::kAio:
+                                     return "Aio";
+                                 case AsyncIOBackend::kIoUring:
+                                     return "IoUring";
+                                 default:
+                                     return "Auto";
+                             }
+                         });
+
+TEST(AsyncIOEngineCreateTest, ZeroDepth) {
+    EXPECT_EQ(nullptr, AsyncIOEngine::Create(0));
+    EXPECT_EQ(EINVAL, errno);
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <memory>
+#include <vector>
+
+namespace android {
+namespace asyncio {
+
+enum class AsyncIOBackend {
+    // io_uring if the kernel lets us use it, kernel AIO otherwise.
+    kAuto,
+    kAio,
+    kIoUring,
+};
+
+struct AsyncIOCompletion {
+    // The value passed when the operation was prepared.
+    uint64_t user_data;
+    // Bytes transferred, or -errno.
+    int64_t result;
+};
+
+/**
+ * A submission/completion queue for reads and writes.
+ *
+ * Operations are prepared into the queue without any syscall, go to the
+ * kernel together on Submit(), and come back through Reap(). At most
+ * queue_depth() operations can be prepared or in flight at once. An engine
+ * is not thread safe.
+ *
+ * Functions returning int return -1 and set errno on failure.
+ */
+class AsyncIOEngine {
+  public:
+    static std::unique_ptr<AsyncIOEngine> Create(unsigned queue_depth,
+                                                 AsyncIOBackend backend = AsyncIOBackend::kAuto);
+    virtual ~AsyncIOEngine() = default;
+
+    virtual AsyncIOBackend backend() const = 0;
+    unsigned queue_depth() const { return queue_depth_; }
+    // Operations prepared or submitted and not reaped yet.
+    unsigned in_flight() const { return queue_depth_ - free_slots_.size(); }
+
+    /**
+     * Registers buffers that operations can then refer to by index, sparing
+     * the kernel from mapping them again for each operation. Replaces any
+     * previous registration, and can only be done with nothing in flight.
+     */
+    virtual int RegisterBuffers(const struct iovec* buffers, unsigned count) = 0;
+
+    /**
+     * Prepares a read or a write of |len| bytes at |offset|. |buf_index| is
+     * the index of the registered buffer that contains |buf|, or -1. Returns
+     * false if the queue is full.
+     */
+    bool PrepRead(int fd, void* buf, size_t len, uint64_t offset, uint64_t user_data,
+                  int buf_index = -1);
+    bool PrepWrite(int fd, const void* buf, size_t len, uint64_t offset, uint64_t user_data,
+                   int buf_index = -1);
+
+    /**
+     * Submits everything prepared since the last call, and waits for
+     * |wait_nr| completions on the way when the backend can do both at once.
+     * Returns the number of operations submitted.
+     */
+    virtual int Submit(unsigned wait_nr = 0) = 0;
+
+    /**
+     * Collects up to |max| completions, waiting until there are at least
+     * |min_complete|. Returns the number collected.
+     */
+    virtual int Reap(AsyncIOCompletion* completions, unsigned max, unsigned min_complete) = 0;
+
+  protected:
+    struct Operation {
+        int fd;
+        bool read;
+        int buf_index;
+        struct iovec iov;
+        uint64_t offset;
+        uint64_t user_data;
+    };
+
+    explicit AsyncIOEngine(unsigned queue_depth);
+
+    // Queues |ops_[slot]| for the next Submit().
+    virtual void Prepare(unsigned slot) = 0;
+    // Returns the slot of a reaped operation to the free list.
+    uint64_t Release(unsigned slot);
+
+    // One slot per operation that can be in flight, indexed by the value the
+    // kernel hands back on completion.
+    std::unique_ptr<Operation[]> ops_;
+
+  private:
+    bool Prep(int fd, bool read, void* buf, size_t len, uint64_t offset, uint64_t user_data,
+              int buf_index);
+
+    const unsigned queue_depth_;
+    std::vector<unsigned> free_slots_;
+};
+
+}  // namespace asyncio
+}  // namespace android
@@ -29,10 +29,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <android-base/strings.h>
 #include <log/log.h>
@@ -306,68 +314,243 @@ static bool fs_config_cmp(bool dir, const char* prefix, size_t len, const char*
 auto __for_testing_only__fs_config_cmp = fs_config_cmp;
 #endif
 
-void fs_config(const char* path, int dir, const char* target_out_path, unsigned* uid, unsigned* gid,
-               unsigned* mode, uint64_t* capabilities) {
-    const struct fs_path_config* pc;
-    size_t which, plen;
+namespace {
+
+// All the rules fs_config() applies to either files or directories, the override files first in
+// |conf| order and then the built-in ones, so that the first rule that matches wins. Rules without
+// wildcards are looked up by hash, only the others go through fnmatch().
+class FsConfigIndex {
+  public:
+    FsConfigIndex(bool dir, const char* target_out_path);
+    ~FsConfigIndex();
+
+    const fs_path_config& Lookup(const char* path, size_t plen) const;
+    // Whether the device's override files are still the ones the index was loaded from.
+    bool IsCurrent() const;
+
+  private:
+    struct Glob {
+        size_t rule;
+        // Length of the prefix before the first wildcard, which inputs must start with.
+        size_t literal_len;
+    };
+
+    // Identifies a version of an override file, all zero if there was none.
+    struct FileId {
+        dev_t dev;
+        ino_t ino;
+        time_t mtime;
+        off_t size;
+
+        bool operator==(const FileId& rhs) const {
+            return dev == rhs.dev && ino == rhs.ino && mtime == rhs.mtime && size == rhs.size;
+        }
+    };
+    static FileId GetFileId(const struct stat& st) {
+        return {st.st_dev, st.st_ino, st.st_mtime, st.st_size};
+    }
 
-    if (path[0] == '/') {
-        path++;
+    void Load(int which, const char* target_out_path);
+    void Add(const fs_path_config& rule);
+
+    bool dir_;
+    // One per entry of |conf|.
+    std::vector<FileId> files_;
+    std::vector<std::pair<void*, size_t>> mappings_;
+    std::vector<fs_path_config> rules_;
+    // Rules without wildcards, by prefix. For directories the prefix has no trailing '/'.
+    std::unordered_map<std::string_view, size_t> literals_;
+    std::vector<Glob> globs_;
+    const fs_path_config* default_;
+};
+
+FsConfigIndex::FsConfigIndex(bool dir, const char* target_out_path) : dir_(dir) {
+    for (size_t which = 0; which < (sizeof(conf) / sizeof(conf[0])); ++which) {
+        Load(which, target_out_path);
     }
 
-    plen = strlen(path);
+    const fs_path_config* pc;
+    for (pc = dir ? android_dirs : android_files; pc->prefix; pc++) {
+        Add(*pc);
+    }
+    default_ = pc;
+}
 
-    for (which = 0; which < (sizeof(conf) / sizeof(conf[0])); ++which) {
-        struct fs_path_config_from_file header;
+FsConfigIndex::~FsConfigIndex() {
+    for (const auto& [addr, size] : mappings_) {
+        munmap(addr, size);
+    }
+}
 
-        int fd = fs_config_open(dir, which, target_out_path);
-        if (fd < 0) continue;
+bool FsConfigIndex::IsCurrent() const {
+    for (size_t which = 0; which < files_.size(); ++which) {
+        struct stat st;
+        FileId id = {};
+        if (stat(conf[which][dir_], &st) == 0) {
+            id = GetFileId(st);
+        }
+        if (!(id == files_[which])) return false;
+    }
+    return true;
+}
 
-        while (TEMP_FAILURE_RETRY(read(fd, &header, sizeof(header))) == sizeof(header)) {
-            char* prefix;
-            uint16_t host_len = header.len;
-            ssize_t len, remainder = host_len - sizeof(header);
-            if (remainder <= 0) {
-                ALOGE("%s len is corrupted", conf[which][dir]);
-                break;
-            }
-            prefix = static_cast<char*>(calloc(1, remainder));
-            if (!prefix) {
-                ALOGE("%s out of memory", conf[which][dir]);
-                break;
-            }
-            if (TEMP_FAILURE_RETRY(read(fd, prefix, remainder)) != remainder) {
-                free(prefix);
-                ALOGE("%s prefix is truncated", conf[which][dir]);
-                break;
-            }
-            len = strnlen(prefix, remainder);
-            if (len >= remainder) {  // missing a terminating null
-                free(prefix);
-                ALOGE("%s is corrupted", conf[which][dir]);
-                break;
-            }
-            if (fs_config_cmp(dir, prefix, len, path, plen)) {
-                free(prefix);
-                close(fd);
-                *uid = header.uid;
-                *gid = header.gid;
-                *mode = (*mode & (~07777)) | header.mode;
-                *capabilities = header.capabilities;
-                return;
+void FsConfigIndex::Load(int which, const char* target_out_path) {
+    int fd = fs_config_open(dir_, which, target_out_path);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) == -1) {
+        files_.push_back({});
+        if (fd >= 0) close(fd);
+        return;
+    }
+    files_.push_back(GetFileId(st));
+    if (st.st_size <= 0) {
+        close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    // The prefixes of the rules point into the mapping, it goes with the index.
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        ALOGE("%s mmap failed: %s", conf[which][dir_], strerror(errno));
+        return;
+    }
+    mappings_.emplace_back(addr, size);
+
+    const char* data = static_cast<const char*>(addr);
+    size_t offset = 0;
+    while (size - offset >= sizeof(fs_path_config_from_file)) {
+        fs_path_config_from_file header;
+        memcpy(&header, data + offset, sizeof(header));
+        ssize_t remainder = header.len - sizeof(header);
+        if (remainder <= 0) {
+            ALOGE("%s len is corrupted", conf[which][dir_]);
+            break;
+        }
+        if (static_cast<size_t>(header.len) > size - offset) {
+            ALOGE("%s prefix is truncated", conf[which][dir_]);
+            break;
+        }
+        const char* prefix = data + offset + sizeof(header);
+        if (strnlen(prefix, remainder) >= static_cast<size_t>(remainder)) {
+            // missing a terminating null
+            ALOGE("%s is corrupted", conf[which][dir_]);
+            break;
+        }
+        Add({header.mode, header.uid, header.gid, header.capabilities, prefix});
+        offset += header.len;
+    }
+}
+
+void FsConfigIndex::Add(const fs_path_config& rule) {
+    size_t index = rules_.size();
+    rules_.push_back(rule);
+
+    std::string_view prefix(rule.prefix);
+    size_t literal_len = prefix.find_first_of("*?[");
+    if (literal_len != std::string_view::npos || prefix.empty()) {
+        globs_.push_back({index, literal_len == std::string_view::npos ? 0 : literal_len});
+        return;
+    }
+
+    // A directory rule "a/b" matches "a/b" and everything under it, see fs_config_cmp().
+    if (dir_ && EndsWith(prefix, "/")) {
+        prefix.remove_suffix(1);
+    }
+    // Only the first of several identical rules can ever match.
+    literals_.emplace(prefix, index);
+}
+
+const fs_path_config& FsConfigIndex::Lookup(const char* path, size_t plen) const {
+    // The path as fs_config_cmp() matches it, plus its aliases in logical partitions.
+    std::string input(path, plen);
+    if (dir_ && !EndsWith(input, "/")) {
+        input.append("/");
+    }
+    std::vector<std::string_view> candidates = {input};
+    static constexpr const char* kLogicalPartitions[] = {"system/product/", "system/system_ext/",
+                                                         "system/vendor/", "vendor/odm/"};
+    for (auto& logical_partition : kLogicalPartitions) {
+        if (StartsWith(input, logical_partition)) {
+            std::string_view input_in_partition(input);
+            input_in_partition.remove_prefix(input.find('/') + 1);
+            if (is_partition(std::string(input_in_partition))) {
+                candidates.push_back(input_in_partition);
             }
-            free(prefix);
         }
-        close(fd);
     }
 
-    for (pc = dir ? android_dirs : android_files; pc->prefix; pc++) {
-        if (fs_config_cmp(dir, pc->prefix, strlen(pc->prefix), path, plen)) {
+    size_t best = rules_.size();
+    auto find = [&](std::string_view key) {
+        auto it = literals_.find(key);
+        if (it != literals_.end() && it->second < best) best = it->second;
+    };
+    for (std::string_view candidate : candidates) {
+        if (!dir_) {
+            find(candidate);
+            continue;
+        }
+        // A directory matches rules for itself and for each of its parents.
+        std::string_view key = candidate.substr(0, candidate.size() - 1);
+        for (;;) {
+            find(key);
+            size_t slash = key.rfind('/');
+            if (slash == std::string_view::npos) break;
+            key = key.substr(0, slash);
+        }
+    }
+
+    for (const auto& glob : globs_) {
+        if (glob.rule >= best) break;
+        const char* prefix = rules_[glob.rule].prefix;
+        bool possible = false;
+        for (std::string_view candidate : candidates) {
+            if (candidate.compare(0, glob.literal_len, prefix, glob.literal_len) == 0) {
+                possible = true;
+                break;
+            }
+        }
+        if (possible && fs_config_cmp(dir_, prefix, strlen(prefix), path, plen)) {
+            best = glob.rule;
             break;
         }
     }
-    *uid = pc->uid;
-    *gid = pc->gid;
-    *mode = (*mode & (~07777)) | pc->mode;
-    *capabilities = pc->capabilities;
+
+    return best < rules_.size() ? rules_[best] : *default_;
+}
+
+// The indexes are built on first use for each target_out_path. Image builders look up every file
+// of the image, and the override files of a build don't change under them, so their indexes are
+// kept for the life of the process. The device's own override files can be replaced at any time,
+// e.g. pushed after adb remount, so without a target_out_path the index is rebuilt once they
+// have changed.
+std::shared_ptr<const FsConfigIndex> GetFsConfigIndex(bool dir, const char* target_out_path) {
+    static std::mutex lock;
+    static auto* indexes =
+            new std::map<std::pair<bool, std::string>, std::shared_ptr<const FsConfigIndex>>;
+
+    std::lock_guard<std::mutex> guard(lock);
+    bool on_device = !target_out_path || !*target_out_path;
+    auto key = std::make_pair(dir, std::string(on_device ? "" : target_out_path));
+    auto& index = (*indexes)[key];
+    if (!index || (on_device && !index->IsCurrent())) {
+        index = std::make_shared<const FsConfigIndex>(dir, target_out_path);
+    }
+    return index;
+}
+
+}  // namespace
+
+void fs_config(const char* path, int dir, const char* target_out_path, unsigned* uid, unsigned* gid,
+               unsigned* mode, uint64_t* capabilities) {
+    if (path[0] == '/') {
+        path++;
+    }
+
+    auto index = GetFsConfigIndex(dir, target_out_path);
+    const fs_path_config& pc = index->Lookup(path, strlen(path));
+    *uid = pc.uid;
+    *gid = pc.gid;
+    *mode = (*mode & (~07777)) | pc.mode;
+    *capabilities = pc.capabilities;
 }
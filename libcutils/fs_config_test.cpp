@@ -15,8 +15,12 @@
  */
 
 #include <inttypes.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <map>
 #include <string>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -25,6 +29,7 @@
 #include <android-base/strings.h>
 
 #include <private/android_filesystem_config.h>
+#include <private/fs_config.h>
 
 #include "fs_config.h"
 
@@ -258,3 +263,149 @@ TEST(fs_config, odm_files_alias) {
 TEST(fs_config, system_alias) {
     EXPECT_FALSE(check_fs_config_cmp(fs_config_cmp_tests));
 }
+
+// Override files under a target_out_path, for all partitions so that the device's own files are
+// not used.
+class FsConfigOverrides {
+  public:
+    FsConfigOverrides() {
+        for (const char* partition : {"system", "vendor", "oem", "odm", "product", "system_ext"}) {
+            std::string etc = std::string(dir_.path) + "/" + partition + "/etc";
+            mkdir((std::string(dir_.path) + "/" + partition).c_str(), 0700);
+            mkdir(etc.c_str(), 0700);
+            files_.push_back(etc + "/fs_config_dirs");
+            files_.push_back(etc + "/fs_config_files");
+            content_[files_[files_.size() - 2]];
+            content_[files_.back()];
+        }
+    }
+
+    ~FsConfigOverrides() {
+        for (const auto& file : files_) {
+            unlink(file.c_str());
+            std::string etc = file.substr(0, file.rfind('/'));
+            rmdir(etc.c_str());
+            rmdir(etc.substr(0, etc.rfind('/')).c_str());
+        }
+    }
+
+    void Add(const char* partition, bool dir, unsigned mode, unsigned uid, const char* prefix) {
+        std::string file = std::string(dir_.path) + "/" + partition + "/etc/fs_config_" +
+                           (dir ? "dirs" : "files");
+        size_t len = sizeof(fs_path_config_from_file) + strlen(prefix) + 1;
+        len = (len + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+        std::string entry(len, '\0');
+        auto* pc = reinterpret_cast<fs_path_config_from_file*>(entry.data());
+        pc->len = len;
+        pc->mode = mode;
+        pc->uid = uid;
+        pc->gid = uid;
+        pc->capabilities = 0;
+        strcpy(pc->prefix, prefix);
+        content_[file] += entry;
+    }
+
+    std::string Write() {
+        for (const auto& [file, content] : content_) {
+            EXPECT_TRUE(android::base::WriteStringToFile(content, file)) << file;
+        }
+        return std::string(dir_.path) + "/system";
+    }
+
+  private:
+    TemporaryDir dir_;
+    std::vector<std::string> files_;
+    std::map<std::string, std::string> content_;
+};
+
+static unsigned fs_config_uid(const char* path, bool dir, const std::string& target_out_path,
+                              unsigned* mode = nullptr) {
+    unsigned uid, gid, tmp_mode = 0;
+    uint64_t capabilities;
+    fs_config(path, dir, target_out_path.c_str(), &uid, &gid, mode ? mode : &tmp_mode,
+              &capabilities);
+    return uid;
+}
+
+TEST(fs_config, overrides) {
+    FsConfigOverrides overrides;
+    overrides.Add("system", false, 0700, 1001, "system/bin/foo");
+    overrides.Add("system", false, 0600, 1002, "odm/lib/*");
+    overrides.Add("odm", false, 0640, 1003, "odm/lib/x.so");
+    overrides.Add("vendor", false, 0750, 1004, "vendor/bin/*");
+    overrides.Add("vendor", true, 0750, 1005, "data/foo");
+    overrides.Add("product", true, 0750, 1006, "product/*/dir/");
+    std::string target_out_path = overrides.Write();
+
+    unsigned mode = 0;
+    EXPECT_EQ(1001U, fs_config_uid("system/bin/foo", false, target_out_path, &mode));
+    EXPECT_EQ(0700U, mode);
+    EXPECT_EQ(AID_ROOT, fs_config_uid("/system/bin/foobar", false, target_out_path, &mode));
+    EXPECT_EQ(0755U, mode);
+
+    // Earlier override files win, even over a more specific rule.
+    EXPECT_EQ(1002U, fs_config_uid("odm/lib/x.so", false, target_out_path));
+    // Logical partitions.
+    EXPECT_EQ(1002U, fs_config_uid("vendor/odm/lib/x.so", false, target_out_path));
+    EXPECT_EQ(1004U, fs_config_uid("system/vendor/bin/sh", false, target_out_path));
+    EXPECT_EQ(AID_ROOT, fs_config_uid("system/vendor/bin", false, target_out_path));
+
+    // Directory rules apply to subdirectories.
+    EXPECT_EQ(1005U, fs_config_uid("data/foo", true, target_out_path));
+    EXPECT_EQ(1005U, fs_config_uid("data/foo/", true, target_out_path));
+    EXPECT_EQ(1005U, fs_config_uid("data/foo/bar/baz", true, target_out_path));
+    EXPECT_EQ(AID_SYSTEM, fs_config_uid("data/foobar", true, target_out_path));
+    EXPECT_EQ(1006U, fs_config_uid("product/a/dir/b", true, target_out_path));
+    EXPECT_EQ(AID_ROOT, fs_config_uid("product/a/dirb", true, target_out_path));
+}
+
+TEST(fs_config, matches_built_in_rules_in_order) {
+    FsConfigOverrides overrides;
+    std::string target_out_path = overrides.Write();
+
+    static const char* paths[] = {
+            "",
+            "bin/sh",
+            "data",
+            "data/app/foo.apk",
+            "data/local/tmp/x",
+            "data/misc/dhcp/y",
+            "data/nativetest/tests.txt",
+            "data/nativetest/foo/bar",
+            "fstab.device",
+            "init.rc",
+            "odm/bin/x",
+            "system/apex/com.android.foo/bin/bar",
+            "system/bin/run-as",
+            "system/bin/sh",
+            "system/etc/fs_config_dirs",
+            "system/etc/ppp/ip-up",
+            "system/etc/rc.local",
+            "system/product/bin/x",
+            "system/vendor/bin/x",
+            "system/xbin/su",
+            "vendor/bin/install-recovery.sh",
+            "vendor/lib/libfoo.so",
+            "vendor/odm/bin/x",
+    };
+    for (bool dir : {false, true}) {
+        const fs_path_config* rules =
+                dir ? __for_testing_only__android_dirs : __for_testing_only__android_files;
+        for (const char* path : paths) {
+            const fs_path_config* pc;
+            for (pc = rules; pc->prefix; pc++) {
+                if (__for_testing_only__fs_config_cmp(dir, pc->prefix, strlen(pc->prefix), path,
+                                                      strlen(path))) {
+                    break;
+                }
+            }
+            unsigned uid, gid, mode = 0;
+            uint64_t capabilities;
+            fs_config(path, dir, target_out_path.c_str(), &uid, &gid, &mode, &capabilities);
+            EXPECT_EQ(pc->uid, uid) << path << (dir ? " (dir)" : "");
+            EXPECT_EQ(pc->gid, gid) << path << (dir ? " (dir)" : "");
+            EXPECT_EQ(pc->mode, mode) << path << (dir ? " (dir)" : "");
+            EXPECT_EQ(pc->capabilities, capabilities) << path << (dir ? " (dir)" : "");
+        }
+    }
+}
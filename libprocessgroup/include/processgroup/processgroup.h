@@ -32,6 +32,14 @@ bool CgroupGetAttributePathForTask(const std::string& attr_name, int tid, std::s
 bool SetTaskProfiles(int tid, const std::vector<std::string>& profiles, bool use_fd_cache = false);
 bool SetProcessProfiles(uid_t uid, pid_t pid, const std::vector<std::string>& profiles);
 
+// Batched versions of SetTaskProfiles() and SetProcessProfiles(). Each cgroup file is opened once
+// for the whole batch rather than once per thread or process, and with use_fd_cache, app-dependent
+// cgroup.procs files stay open for the next batches.
+bool SetTasksProfiles(const std::vector<int>& tids, const std::vector<std::string>& profiles,
+                      bool use_fd_cache = false);
+bool SetProcessesProfiles(uid_t uid, const std::vector<pid_t>& pids,
+                          const std::vector<std::string>& profiles, bool use_fd_cache = false);
+
 #ifndef __ANDROID_VNDK__
 
 static constexpr const char* CGROUPS_RC_PATH = "/dev/cgroup_info/cgroup.rc";
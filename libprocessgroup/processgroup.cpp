@@ -22,13 +22,17 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <chrono>
 #include <map>
 #include <memory>
@@ -36,12 +40,14 @@
 #include <set>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/properties.h>
 #include <android-base/stringprintf.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <cutils/android_filesystem_config.h>
 #include <processgroup/processgroup.h>
 #include <task_profiles.h>
@@ -49,11 +55,25 @@
 using android::base::GetBoolProperty;
 using android::base::StartsWith;
 using android::base::StringPrintf;
+using android::base::unique_fd;
 using android::base::WriteStringToFile;
 
 using namespace std::chrono_literals;
 
 #define PROCESSGROUP_CGROUP_PROCS_FILE "/cgroup.procs"
+#define PROCESSGROUP_CGROUP_KILL_FILE "/cgroup.kill"
+#define PROCESSGROUP_CGROUP_EVENTS_FILE "/cgroup.events"
+
+#ifndef __NR_pidfd_open
+#define __NR_pidfd_open 434
+#endif
+
+// How long KillProcessGroup() waits for the processes it signalled before
+// looking at the cgroup again.
+static constexpr auto kKillRetryPeriod = 5ms;
+
+// Bounds the pidfds held while waiting for a single process cgroup.
+static constexpr size_t kMaxWaitPidfds = 64;
 
 bool CgroupGetControllerPath(const std::string& cgroup_name, std::string* path) {
     auto controller = CgroupMap::GetInstance().FindController(cgroup_name);
@@ -123,6 +143,16 @@ bool SetTaskProfiles(int tid, const std::vector<std::string>& profiles, bool use
     return TaskProfiles::GetInstance().SetTaskProfiles(tid, profiles, use_fd_cache);
 }
 
+bool SetTasksProfiles(const std::vector<int>& tids, const std::vector<std::string>& profiles,
+                      bool use_fd_cache) {
+    return TaskProfiles::GetInstance().SetTasksProfiles(tids, profiles, use_fd_cache);
+}
+
+bool SetProcessesProfiles(uid_t uid, const std::vector<pid_t>& pids,
+                          const std::vector<std::string>& profiles, bool use_fd_cache) {
+    return TaskProfiles::GetInstance().SetProcessesProfiles(uid, pids, profiles, use_fd_cache);
+}
+
 static std::string ConvertUidToPath(const char* cgroup, uid_t uid) {
     return StringPrintf("%s/uid_%d", cgroup, uid);
 }
@@ -227,11 +257,90 @@ static bool MkdirAndChown(const std::string& path, mode_t mode, uid_t uid, gid_t
     return true;
 }
 
+static unique_fd PidfdOpen(pid_t pid) {
+    return unique_fd(static_cast<int>(syscall(__NR_pidfd_open, pid, 0)));
+}
+
+// Kills everything in a cgroup v2 process cgroup with a single write, instead
+// of signalling each process. Only SIGKILL can be sent this way.
+static bool CgroupKill(const std::string& cgroup_path) {
+    unique_fd fd(open((cgroup_path + PROCESSGROUP_CGROUP_KILL_FILE).c_str(), O_WRONLY | O_CLOEXEC));
+    if (fd == -1) {
+        return false;
+    }
+    if (TEMP_FAILURE_RETRY(write(fd, "1", 1)) != 1) {
+        PLOG(WARNING) << "Failed to write to " << cgroup_path << PROCESSGROUP_CGROUP_KILL_FILE;
+        return false;
+    }
+    return true;
+}
+
+// Returns true if cgroup.events still reports processes in the cgroup. Errors
+// are reported as populated, callers then go back to cgroup.procs.
+static bool IsCgroupPopulated(int events_fd) {
+    char buf[128];
+    ssize_t len = TEMP_FAILURE_RETRY(pread(events_fd, buf, sizeof(buf) - 1, 0));
+    if (len <= 0) {
+        return true;
+    }
+    buf[len] = '\0';
+    return strstr(buf, "populated 0") == nullptr;
+}
+
+// Waits until the cgroup watched by |events_fd| is empty or |timeout| passes.
+// The kernel notifies changes to cgroup.events with POLLPRI.
+static void WaitForCgroupEmpty(int events_fd, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (IsCgroupPopulated(events_fd)) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+        if (left <= 0ms) {
+            return;
+        }
+        pollfd pfd = {.fd = events_fd, .events = POLLPRI};
+        if (TEMP_FAILURE_RETRY(poll(&pfd, 1, left.count())) <= 0) {
+            return;
+        }
+    }
+}
+
+// Waits until every process in |pidfds| has exited or |timeout| passes. A
+// pidfd becomes readable once its process exits, which is also when the
+// process leaves its cgroup.
+static void WaitForPidfds(std::vector<unique_fd>* pidfds, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    std::vector<pollfd> pfds;
+    pfds.reserve(pidfds->size());
+    for (const auto& pidfd : *pidfds) {
+        pfds.push_back({.fd = pidfd.get(), .events = POLLIN});
+    }
+
+    while (!pfds.empty()) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+        if (left <= 0ms) {
+            break;
+        }
+        if (TEMP_FAILURE_RETRY(poll(pfds.data(), pfds.size(), left.count())) <= 0) {
+            break;
+        }
+        pfds.erase(std::remove_if(pfds.begin(), pfds.end(),
+                                  [](const pollfd& pfd) { return pfd.revents != 0; }),
+                   pfds.end());
+    }
+    pidfds->clear();
+}
+
 // Returns number of processes killed on success
 // Returns 0 if there are no processes in the process cgroup left to kill
 // Returns -1 on error
-static int DoKillProcessGroupOnce(const char* cgroup, uid_t uid, int initialPid, int signal) {
-    auto path = ConvertUidPidToPath(cgroup, uid, initialPid) + PROCESSGROUP_CGROUP_PROCS_FILE;
+// Unless the whole cgroup could be killed through cgroup.kill, pidfds for the
+// processes signalled are added to |pidfds| so that the caller can wait for
+// them to exit.
+static int DoKillProcessGroupOnce(const char* cgroup, uid_t uid, int initialPid, int signal,
+                                  bool use_cgroup_kill, std::vector<unique_fd>* pidfds) {
+    auto cgroup_path = ConvertUidPidToPath(cgroup, uid, initialPid);
+    auto path = cgroup_path + PROCESSGROUP_CGROUP_PROCS_FILE;
     std::unique_ptr<FILE, decltype(&fclose)> fd(fopen(path.c_str(), "re"), fclose);
     if (!fd) {
         if (errno == ENOENT) {
@@ -258,6 +367,16 @@ static int DoKillProcessGroupOnce(const char* cgroup, uid_t uid, int initialPid,
             LOG(WARNING) << "Yikes, we've been told to kill pid 0!  How about we don't do that?";
             continue;
         }
+        if (use_cgroup_kill) {
+            continue;
+        }
+        // Open the pidfd before signalling so that it can't refer to a recycled pid.
+        if (pidfds->size() < kMaxWaitPidfds) {
+            unique_fd pidfd = PidfdOpen(pid);
+            if (pidfd != -1) {
+                pidfds->push_back(std::move(pidfd));
+            }
+        }
         pid_t pgid = getpgid(pid);
         if (pgid == -1) PLOG(ERROR) << "getpgid(" << pid << ") failed";
         if (pgid == pid) {
@@ -267,6 +386,16 @@ static int DoKillProcessGroupOnce(const char* cgroup, uid_t uid, int initialPid,
         }
     }
 
+    if (use_cgroup_kill) {
+        if ((processes == 0 && feof(fd.get())) || CgroupKill(cgroup_path)) {
+            LOG(VERBOSE) << "Killed process cgroup " << initialPid << " in uid " << uid
+                         << " through " << PROCESSGROUP_CGROUP_KILL_FILE;
+            return feof(fd.get()) ? processes : -1;
+        }
+        // The write failed, signal the processes one by one instead.
+        return DoKillProcessGroupOnce(cgroup, uid, initialPid, signal, false, pidfds);
+    }
+
     // Erase all pids that will be killed when we kill the process groups.
     for (auto it = pids.begin(); it != pids.end();) {
         pid_t pgid = getpgid(*it);
@@ -320,15 +449,35 @@ static int KillProcessGroup(uid_t uid, int initialPid, int signal, int retries,
         *max_processes = 0;
     }
 
+    // On a cgroup v2 hierarchy, SIGKILL goes to the whole cgroup through cgroup.kill and
+    // cgroup.events tells when it is empty. Otherwise we wait on pidfds for the processes
+    // signalled, and sleep only if the kernel has no pidfds.
+    auto cgroup_path = ConvertUidPidToPath(cgroup, uid, initialPid);
+    bool use_cgroup_kill =
+            signal == SIGKILL && !access((cgroup_path + PROCESSGROUP_CGROUP_KILL_FILE).c_str(), W_OK);
+    unique_fd events_fd;
+    if (use_cgroup_kill && retries > 0) {
+        events_fd.reset(
+                open((cgroup_path + PROCESSGROUP_CGROUP_EVENTS_FILE).c_str(), O_RDONLY | O_CLOEXEC));
+    }
+
     int retry = retries;
     int processes;
-    while ((processes = DoKillProcessGroupOnce(cgroup, uid, initialPid, signal)) > 0) {
+    std::vector<unique_fd> pidfds;
+    while ((processes = DoKillProcessGroupOnce(cgroup, uid, initialPid, signal, use_cgroup_kill,
+                                               &pidfds)) > 0) {
         if (max_processes != nullptr && processes > *max_processes) {
             *max_processes = processes;
         }
         LOG(VERBOSE) << "Killed " << processes << " processes for processgroup " << initialPid;
         if (retry > 0) {
-            std::this_thread::sleep_for(5ms);
+            if (events_fd != -1) {
+                WaitForCgroupEmpty(events_fd, kKillRetryPeriod);
+            } else if (!pidfds.empty()) {
+                WaitForPidfds(&pidfds, kKillRetryPeriod);
+            } else {
+                std::this_thread::sleep_for(kKillRetryPeriod);
+            }
             --retry;
         } else {
             break;
@@ -19,6 +19,8 @@
 
 #include <fcntl.h>
 #include <task_profiles.h>
+#include <algorithm>
+#include <chrono>
 #include <string>
 
 #include <android-base/file.h>
@@ -44,6 +46,9 @@ using android::base::WriteStringToFile;
 #define TASK_PROFILE_DB_FILE "/etc/task_profiles.json"
 #define TASK_PROFILE_DB_VENDOR_FILE "/vendor/etc/task_profiles.json"
 
+// Profile actions taking longer than this on a batch of processes or threads are logged
+static constexpr auto kSlowActionThreshold = std::chrono::milliseconds(20);
+
 void ProfileAttribute::Reset(const CgroupController& controller, const std::string& file_name) {
     controller_ = controller;
     file_name_ = file_name;
@@ -68,6 +73,22 @@ bool ProfileAttribute::GetPathForTask(int tid, std::string* path) const {
     return true;
 }
 
+bool ProfileAction::ExecuteForProcesses(uid_t uid, std::vector<pid_t>* pids) const {
+    size_t count = pids->size();
+    pids->erase(std::remove_if(pids->begin(), pids->end(),
+                               [this, uid](pid_t pid) { return !ExecuteForProcess(uid, pid); }),
+                pids->end());
+    return pids->size() == count;
+}
+
+bool ProfileAction::ExecuteForTasks(std::vector<int>* tids) const {
+    size_t count = tids->size();
+    tids->erase(std::remove_if(tids->begin(), tids->end(),
+                               [this](int tid) { return !ExecuteForTask(tid); }),
+                tids->end());
+    return tids->size() == count;
+}
+
 bool SetClampsAction::ExecuteForProcess(uid_t, pid_t) const {
     // TODO: add support when kernel supports util_clamp
     LOG(WARNING) << "SetClampsAction::ExecuteForProcess is not supported";
@@ -156,6 +177,7 @@ SetCgroupAction::SetCgroupAction(const CgroupController& c, const std::string& p
 
 void SetCgroupAction::EnableResourceCaching() {
     std::lock_guard<std::mutex> lock(fd_mutex_);
+    cache_procs_fds_ = true;
     if (fd_ != FDS_NOT_CACHED) {
         return;
     }
@@ -180,6 +202,8 @@ void SetCgroupAction::EnableResourceCaching() {
 
 void SetCgroupAction::DropResourceCaching() {
     std::lock_guard<std::mutex> lock(fd_mutex_);
+    cache_procs_fds_ = false;
+    procs_fds_.clear();
     if (fd_ == FDS_NOT_CACHED) {
         return;
     }
@@ -205,14 +229,87 @@ bool SetCgroupAction::AddTidToCgroup(int tid, int fd) {
     return true;
 }
 
+// Returns a writable fd for |procs_path|, or -1 with errno set. While resource caching is enabled
+// the fd comes from a small LRU cache, otherwise it is owned by |tmp_fd|. Paths that name the pid
+// are only ever used once, so they bypass the cache. fd_mutex_ must be held.
+int SetCgroupAction::GetProcsFd(const std::string& procs_path, unique_fd* tmp_fd) const {
+    bool cache = cache_procs_fds_ && path_.find("<pid>", 0) == std::string::npos;
+    if (cache) {
+        for (auto it = procs_fds_.begin(); it != procs_fds_.end(); ++it) {
+            if (it->first == procs_path) {
+                procs_fds_.splice(procs_fds_.begin(), procs_fds_, it);
+                return procs_fds_.front().second.get();
+            }
+        }
+    }
+
+    unique_fd fd(TEMP_FAILURE_RETRY(open(procs_path.c_str(), O_WRONLY | O_CLOEXEC)));
+    if (fd < 0) {
+        return -1;
+    }
+
+    if (!cache) {
+        *tmp_fd = std::move(fd);
+        return tmp_fd->get();
+    }
+
+    if (procs_fds_.size() >= kMaxCachedProcsFds) {
+        procs_fds_.pop_back();
+    }
+    procs_fds_.emplace_front(procs_path, std::move(fd));
+    return procs_fds_.front().second.get();
+}
+
+// Called after writing |pid| through |*fd| failed. A cached fd may refer to a cgroup that has been
+// removed and recreated since it was opened, so it is dropped, and the write retried once through
+// a freshly opened fd, which replaces it in |*fd|. fd_mutex_ must be held.
+bool SetCgroupAction::RetryWithFreshProcsFd(const std::string& procs_path, pid_t pid,
+                                            unique_fd* tmp_fd, int* fd) const {
+    if (*fd == tmp_fd->get()) {
+        // Not cached, it was just opened.
+        return false;
+    }
+    for (auto it = procs_fds_.begin(); it != procs_fds_.end(); ++it) {
+        if (it->first == procs_path) {
+            procs_fds_.erase(it);
+            break;
+        }
+    }
+
+    *fd = GetProcsFd(procs_path, tmp_fd);
+    if (*fd < 0) {
+        PLOG(WARNING) << "Failed to reopen " << procs_path;
+        return false;
+    }
+    return AddTidToCgroup(pid, *fd);
+}
+
+// Returns a writable fd for the tasks file of path_, or -1 with errno set. Unless the fd is
+// cached, it is owned by |tmp_fd|. fd_mutex_ must be held.
+int SetCgroupAction::GetTasksFd(unique_fd* tmp_fd) const {
+    if (IsFdValid()) {
+        return fd_;
+    }
+
+    std::string tasks_path = controller()->GetTasksFilePath(path_);
+    tmp_fd->reset(TEMP_FAILURE_RETRY(open(tasks_path.c_str(), O_WRONLY | O_CLOEXEC)));
+    if (*tmp_fd < 0) {
+        PLOG(WARNING) << "Failed to open " << tasks_path;
+        return -1;
+    }
+    return tmp_fd->get();
+}
+
 bool SetCgroupAction::ExecuteForProcess(uid_t uid, pid_t pid) const {
     std::string procs_path = controller()->GetProcsFilePath(path_, uid, pid);
-    unique_fd tmp_fd(TEMP_FAILURE_RETRY(open(procs_path.c_str(), O_WRONLY | O_CLOEXEC)));
-    if (tmp_fd < 0) {
+    std::lock_guard<std::mutex> lock(fd_mutex_);
+    unique_fd tmp_fd;
+    int fd = GetProcsFd(procs_path, &tmp_fd);
+    if (fd < 0) {
         PLOG(WARNING) << "Failed to open " << procs_path;
         return false;
     }
-    if (!AddTidToCgroup(pid, tmp_fd)) {
+    if (!AddTidToCgroup(pid, fd) && !RetryWithFreshProcsFd(procs_path, pid, &tmp_fd, &fd)) {
         LOG(ERROR) << "Failed to add task into cgroup";
         return false;
     }
@@ -222,15 +319,6 @@ bool SetCgroupAction::ExecuteForProcess(uid_t uid, pid_t pid) const {
 
 bool SetCgroupAction::ExecuteForTask(int tid) const {
     std::lock_guard<std::mutex> lock(fd_mutex_);
-    if (IsFdValid()) {
-        // fd is cached, reuse it
-        if (!AddTidToCgroup(tid, fd_)) {
-            LOG(ERROR) << "Failed to add task into cgroup";
-            return false;
-        }
-        return true;
-    }
-
     if (fd_ == FDS_INACCESSIBLE) {
         // no permissions to access the file, ignore
         return true;
@@ -242,14 +330,13 @@ bool SetCgroupAction::ExecuteForTask(int tid) const {
         return false;
     }
 
-    // fd was not cached because cached fd can't be used
-    std::string tasks_path = controller()->GetTasksFilePath(path_);
-    unique_fd tmp_fd(TEMP_FAILURE_RETRY(open(tasks_path.c_str(), O_WRONLY | O_CLOEXEC)));
-    if (tmp_fd < 0) {
-        PLOG(WARNING) << "Failed to open " << tasks_path << ": " << strerror(errno);
+    // use the cached fd, or open the file if it can't be cached
+    unique_fd tmp_fd;
+    int fd = GetTasksFd(&tmp_fd);
+    if (fd < 0) {
         return false;
     }
-    if (!AddTidToCgroup(tid, tmp_fd)) {
+    if (!AddTidToCgroup(tid, fd)) {
         LOG(ERROR) << "Failed to add task into cgroup";
         return false;
     }
@@ -257,6 +344,70 @@ bool SetCgroupAction::ExecuteForTask(int tid) const {
     return true;
 }
 
+bool SetCgroupAction::ExecuteForProcesses(uid_t uid, std::vector<pid_t>* pids) const {
+    std::lock_guard<std::mutex> lock(fd_mutex_);
+    size_t count = pids->size();
+    // Processes of the same uid usually share the path, open it once for all of them.
+    std::string last_path;
+    unique_fd tmp_fd;
+    int fd = -1;
+    auto failed = [&](pid_t pid) {
+        std::string procs_path = controller()->GetProcsFilePath(path_, uid, pid);
+        if (procs_path != last_path) {
+            tmp_fd.reset();
+            fd = GetProcsFd(procs_path, &tmp_fd);
+            if (fd < 0) {
+                PLOG(WARNING) << "Failed to open " << procs_path;
+            }
+            last_path = std::move(procs_path);
+        }
+        if (fd < 0) {
+            return true;
+        }
+        if (!AddTidToCgroup(pid, fd) && !RetryWithFreshProcsFd(last_path, pid, &tmp_fd, &fd)) {
+            LOG(ERROR) << "Failed to add task into cgroup";
+            return true;
+        }
+        return false;
+    };
+    pids->erase(std::remove_if(pids->begin(), pids->end(), failed), pids->end());
+    return pids->size() == count;
+}
+
+bool SetCgroupAction::ExecuteForTasks(std::vector<int>* tids) const {
+    std::lock_guard<std::mutex> lock(fd_mutex_);
+    if (fd_ == FDS_INACCESSIBLE) {
+        // no permissions to access the file, ignore
+        return true;
+    }
+
+    if (fd_ == FDS_APP_DEPENDENT) {
+        // application-dependent path can't be used with tid
+        PLOG(ERROR) << "Application profile can't be applied to a thread";
+        tids->clear();
+        return false;
+    }
+
+    unique_fd tmp_fd;
+    int fd = GetTasksFd(&tmp_fd);
+    if (fd < 0) {
+        tids->clear();
+        return false;
+    }
+
+    size_t count = tids->size();
+    tids->erase(std::remove_if(tids->begin(), tids->end(),
+                               [fd](int tid) {
+                                   if (!AddTidToCgroup(tid, fd)) {
+                                       LOG(ERROR) << "Failed to add task into cgroup";
+                                       return true;
+                                   }
+                                   return false;
+                               }),
+                tids->end());
+    return tids->size() == count;
+}
+
 bool ApplyProfileAction::ExecuteForProcess(uid_t uid, pid_t pid) const {
     for (const auto& profile : profiles_) {
         if (!profile->ExecuteForProcess(uid, pid)) {
@@ -275,6 +426,26 @@ bool ApplyProfileAction::ExecuteForTask(int tid) const {
     return true;
 }
 
+bool ApplyProfileAction::ExecuteForProcesses(uid_t uid, std::vector<pid_t>* pids) const {
+    for (const auto& profile : profiles_) {
+        std::vector<pid_t> profile_pids(*pids);
+        if (!profile->ExecuteForProcesses(uid, &profile_pids)) {
+            PLOG(WARNING) << "ExecuteForProcesses failed for aggregate profile";
+        }
+    }
+    return true;
+}
+
+bool ApplyProfileAction::ExecuteForTasks(std::vector<int>* tids) const {
+    for (const auto& profile : profiles_) {
+        std::vector<int> profile_tids(*tids);
+        if (!profile->ExecuteForTasks(&profile_tids)) {
+            PLOG(WARNING) << "ExecuteForTasks failed for aggregate profile";
+        }
+    }
+    return true;
+}
+
 void ApplyProfileAction::EnableResourceCaching() {
     for (const auto& profile : profiles_) {
         profile->EnableResourceCaching();
@@ -313,6 +484,49 @@ bool TaskProfile::ExecuteForTask(int tid) const {
     return true;
 }
 
+// Runs |execute| for each element in turn, on whatever the previous elements did not fail for,
+// and reports how long each element took for the whole batch.
+template <typename T, typename F>
+static bool ExecuteForBatch(const std::vector<std::unique_ptr<ProfileAction>>& elements,
+                            std::vector<T>* ids, F execute) {
+    bool ret = true;
+    for (const auto& element : elements) {
+        if (ids->empty()) {
+            break;
+        }
+        size_t count = ids->size();
+        auto start = std::chrono::steady_clock::now();
+        if (!execute(element.get(), ids)) {
+            ret = false;
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+        if (elapsed >= kSlowActionThreshold) {
+            LOG(WARNING) << element->Name() << " took " << us << "us for " << count << " tasks";
+        } else {
+            LOG(VERBOSE) << element->Name() << " took " << us << "us for " << count << " tasks";
+        }
+    }
+    return ret;
+}
+
+bool TaskProfile::ExecuteForProcesses(uid_t uid, std::vector<pid_t>* pids) const {
+    return ExecuteForBatch(elements_, pids, [uid](ProfileAction* element, std::vector<pid_t>* ids) {
+        return element->ExecuteForProcesses(uid, ids);
+    });
+}
+
+bool TaskProfile::ExecuteForTasks(std::vector<int>* tids) const {
+    for (auto& tid : *tids) {
+        if (tid == 0) {
+            tid = GetThreadId();
+        }
+    }
+    return ExecuteForBatch(elements_, tids, [](ProfileAction* element, std::vector<int>* ids) {
+        return element->ExecuteForTasks(ids);
+    });
+}
+
 void TaskProfile::EnableResourceCaching() {
     if (res_cached_) {
         return;
@@ -558,3 +772,46 @@ bool TaskProfiles::SetTaskProfiles(int tid, const std::vector<std::string>& prof
     }
     return true;
 }
+
+bool TaskProfiles::SetProcessesProfiles(uid_t uid, const std::vector<pid_t>& pids,
+                                        const std::vector<std::string>& profiles,
+                                        bool use_fd_cache) {
+    for (const auto& name : profiles) {
+        TaskProfile* profile = GetProfile(name);
+        if (profile != nullptr) {
+            if (use_fd_cache) {
+                profile->EnableResourceCaching();
+            }
+            std::vector<pid_t> profile_pids(pids);
+            if (!profile->ExecuteForProcesses(uid, &profile_pids)) {
+                PLOG(WARNING) << "Failed to apply " << name << " process profile to "
+                              << pids.size() - profile_pids.size() << " of " << pids.size()
+                              << " processes";
+            }
+        } else {
+            PLOG(WARNING) << "Failed to find " << name << "process profile";
+        }
+    }
+    return true;
+}
+
+bool TaskProfiles::SetTasksProfiles(const std::vector<int>& tids,
+                                    const std::vector<std::string>& profiles, bool use_fd_cache) {
+    for (const auto& name : profiles) {
+        TaskProfile* profile = GetProfile(name);
+        if (profile != nullptr) {
+            if (use_fd_cache) {
+                profile->EnableResourceCaching();
+            }
+            std::vector<int> profile_tids(tids);
+            if (!profile->ExecuteForTasks(&profile_tids)) {
+                PLOG(WARNING) << "Failed to apply " << name << " task profile to "
+                              << tids.size() - profile_tids.size() << " of " << tids.size()
+                              << " tasks";
+            }
+        } else {
+            PLOG(WARNING) << "Failed to find " << name << "task profile";
+        }
+    }
+    return true;
+}
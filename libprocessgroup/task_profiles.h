@@ -18,6 +18,7 @@
 
 #include <sys/cdefs.h>
 #include <sys/types.h>
+#include <list>
 #include <map>
 #include <mutex>
 #include <string>
@@ -47,10 +48,18 @@ class ProfileAction {
   public:
     virtual ~ProfileAction() {}
 
+    virtual const char* Name() const = 0;
+
     // Default implementations will fail
     virtual bool ExecuteForProcess(uid_t, pid_t) const { return false; };
     virtual bool ExecuteForTask(int) const { return false; };
 
+    // Apply the action to several processes or threads at once. Those the action failed for are
+    // removed from |pids| or |tids|, and false is returned if there were any. Default
+    // implementations go through ExecuteForProcess() and ExecuteForTask() one by one.
+    virtual bool ExecuteForProcesses(uid_t uid, std::vector<pid_t>* pids) const;
+    virtual bool ExecuteForTasks(std::vector<int>* tids) const;
+
     virtual void EnableResourceCaching() {}
     virtual void DropResourceCaching() {}
 };
@@ -60,6 +69,7 @@ class SetClampsAction : public ProfileAction {
   public:
     SetClampsAction(int boost, int clamp) noexcept : boost_(boost), clamp_(clamp) {}
 
+    virtual const char* Name() const { return "SetClamps"; }
     virtual bool ExecuteForProcess(uid_t uid, pid_t pid) const;
     virtual bool ExecuteForTask(int tid) const;
 
@@ -75,6 +85,7 @@ class SetTimerSlackAction : public ProfileAction {
   public:
     SetTimerSlackAction(unsigned long slack) noexcept : slack_(slack) {}
 
+    virtual const char* Name() const { return "SetTimerSlack"; }
     virtual bool ExecuteForTask(int tid) const;
 
   private:
@@ -89,6 +100,7 @@ class SetTimerSlackAction : public ProfileAction {
   public:
     SetTimerSlackAction(unsigned long) noexcept {}
 
+    virtual const char* Name() const { return "SetTimerSlack"; }
     virtual bool ExecuteForTask(int) const { return true; }
 };
 
@@ -100,6 +112,7 @@ class SetAttributeAction : public ProfileAction {
     SetAttributeAction(const ProfileAttribute* attribute, const std::string& value)
         : attribute_(attribute), value_(value) {}
 
+    virtual const char* Name() const { return "SetAttribute"; }
     virtual bool ExecuteForProcess(uid_t uid, pid_t pid) const;
     virtual bool ExecuteForTask(int tid) const;
 
@@ -113,8 +126,11 @@ class SetCgroupAction : public ProfileAction {
   public:
     SetCgroupAction(const CgroupController& c, const std::string& p);
 
+    virtual const char* Name() const { return "JoinCgroup"; }
     virtual bool ExecuteForProcess(uid_t uid, pid_t pid) const;
     virtual bool ExecuteForTask(int tid) const;
+    virtual bool ExecuteForProcesses(uid_t uid, std::vector<pid_t>* pids) const;
+    virtual bool ExecuteForTasks(std::vector<int>* tids) const;
     virtual void EnableResourceCaching();
     virtual void DropResourceCaching();
 
@@ -128,15 +144,26 @@ class SetCgroupAction : public ProfileAction {
         FDS_NOT_CACHED = -3,
     };
 
+    // Number of cgroup.procs fds kept open for app-dependent paths
+    static constexpr size_t kMaxCachedProcsFds = 16;
+
     CgroupController controller_;
     std::string path_;
     android::base::unique_fd fd_;
+    // cgroup.procs fds used by ExecuteForProcess(), most recently used first. Only kept while
+    // resource caching is enabled, and only for paths that don't depend on the pid.
+    mutable std::list<std::pair<std::string, android::base::unique_fd>> procs_fds_;
+    bool cache_procs_fds_ = false;
     mutable std::mutex fd_mutex_;
 
     static bool IsAppDependentPath(const std::string& path);
     static bool AddTidToCgroup(int tid, int fd);
 
     bool IsFdValid() const { return fd_ > FDS_INACCESSIBLE; }
+    int GetProcsFd(const std::string& procs_path, android::base::unique_fd* tmp_fd) const;
+    bool RetryWithFreshProcsFd(const std::string& procs_path, pid_t pid,
+                               android::base::unique_fd* tmp_fd, int* fd) const;
+    int GetTasksFd(android::base::unique_fd* tmp_fd) const;
 };
 
 class TaskProfile {
@@ -148,6 +175,8 @@ class TaskProfile {
 
     bool ExecuteForProcess(uid_t uid, pid_t pid) const;
     bool ExecuteForTask(int tid) const;
+    bool ExecuteForProcesses(uid_t uid, std::vector<pid_t>* pids) const;
+    bool ExecuteForTasks(std::vector<int>* tids) const;
     void EnableResourceCaching();
     void DropResourceCaching();
 
@@ -162,8 +191,11 @@ class ApplyProfileAction : public ProfileAction {
     ApplyProfileAction(const std::vector<std::shared_ptr<TaskProfile>>& profiles)
         : profiles_(profiles) {}
 
+    virtual const char* Name() const { return "ApplyProfile"; }
     virtual bool ExecuteForProcess(uid_t uid, pid_t pid) const;
     virtual bool ExecuteForTask(int tid) const;
+    virtual bool ExecuteForProcesses(uid_t uid, std::vector<pid_t>* pids) const;
+    virtual bool ExecuteForTasks(std::vector<int>* tids) const;
     virtual void EnableResourceCaching();
     virtual void DropResourceCaching();
 
@@ -181,6 +213,10 @@ class TaskProfiles {
     void DropResourceCaching() const;
     bool SetProcessProfiles(uid_t uid, pid_t pid, const std::vector<std::string>& profiles);
     bool SetTaskProfiles(int tid, const std::vector<std::string>& profiles, bool use_fd_cache);
+    bool SetProcessesProfiles(uid_t uid, const std::vector<pid_t>& pids,
+                              const std::vector<std::string>& profiles, bool use_fd_cache);
+    bool SetTasksProfiles(const std::vector<int>& tids, const std::vector<std::string>& profiles,
+                          bool use_fd_cache);
 
   private:
     std::map<std::string, std::shared_ptr<TaskProfile>> profiles_;
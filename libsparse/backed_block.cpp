@@ -20,6 +20,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <iterator>
+#include <map>
+#include <new>
+
 #include "backed_block.h"
 #include "sparse_defs.h"
 
@@ -46,12 +50,51 @@ struct backed_block {
   struct backed_block* next;
 };
 
+/*
+ * The blocks are kept in a singly linked list sorted by block number, which is
+ * what the iterators walk.  The list is also indexed by block number so that
+ * finding the insertion point for a new block, or the predecessor of a block
+ * being moved, is O(log n) instead of a walk from the head of the list.
+ */
 struct backed_block_list {
-  struct backed_block* data_blocks;
-  struct backed_block* last_used;
-  unsigned int block_size;
+  struct backed_block* data_blocks = nullptr;
+  std::multimap<unsigned int, struct backed_block*> index;
+  unsigned int block_size = 0;
 };
 
+static void index_insert(struct backed_block_list* bbl, struct backed_block* bb) {
+  bbl->index.emplace(bb->block, bb);
+}
+
+static void index_erase(struct backed_block_list* bbl, struct backed_block* bb) {
+  auto range = bbl->index.equal_range(bb->block);
+  for (auto it = range.first; it != range.second; ++it) {
+    if (it->second == bb) {
+      bbl->index.erase(it);
+      return;
+    }
+  }
+  assert(false);
+}
+
+/* Returns the last block in the list that is ordered before a block numbered
+ * 'block' would be, or nullptr if it belongs at the head.  If 'inclusive' is
+ * set, blocks with the same number count as ordered before it. */
+static struct backed_block* find_prev(struct backed_block_list* bbl, unsigned int block,
+                                      bool inclusive) {
+  auto it = inclusive ? bbl->index.upper_bound(block) : bbl->index.lower_bound(block);
+  if (it == bbl->index.begin()) {
+    return nullptr;
+  }
+  struct backed_block* bb = std::prev(it)->second;
+  /* Blocks sharing a number may be indexed in a different order than they
+   * are linked, so finish the search on the list itself. */
+  while (bb->next && (bb->next->block < block || (inclusive && bb->next->block == block))) {
+    bb = bb->next;
+  }
+  return bb;
+}
+
 struct backed_block* backed_block_iter_new(struct backed_block_list* bbl) {
   return bbl->data_blocks;
 }
@@ -110,9 +153,10 @@ void backed_block_destroy(struct backed_block* bb) {
 }
 
 struct backed_block_list* backed_block_list_new(unsigned int block_size) {
-  struct backed_block_list* b =
-      reinterpret_cast<backed_block_list*>(calloc(sizeof(struct backed_block_list), 1));
-  b->block_size = block_size;
+  struct backed_block_list* b = new (std::nothrow) backed_block_list;
+  if (b) {
+    b->block_size = block_size;
+  }
   return b;
 }
 
@@ -126,7 +170,7 @@ void backed_block_list_destroy(struct backed_block_list* bbl) {
     }
   }
 
-  free(bbl);
+  delete bbl;
 }
 
 void backed_block_list_move(struct backed_block_list* from, struct backed_block_list* to,
@@ -146,12 +190,29 @@ void backed_block_list_move(struct backed_block_list* from, struct backed_block_
     return;
   }
 
-  from->last_used = nullptr;
-  to->last_used = nullptr;
+  if (from->data_blocks == start && !end->next && !to->data_blocks) {
+    /* Moving a whole list into an empty one, so just hand over the index. */
+    from->data_blocks = nullptr;
+    to->data_blocks = start;
+    std::swap(from->index, to->index);
+    return;
+  }
+
+  for (bb = start;; bb = bb->next) {
+    index_erase(from, bb);
+    if (bb == end) {
+      break;
+    }
+  }
+
   if (from->data_blocks == start) {
     from->data_blocks = end->next;
   } else {
-    for (bb = from->data_blocks; bb; bb = bb->next) {
+    bb = find_prev(from, start->block, false);
+    if (!bb) {
+      bb = from->data_blocks;
+    }
+    for (; bb; bb = bb->next) {
       if (bb->next == start) {
         bb->next = end->next;
         break;
@@ -163,12 +224,18 @@ void backed_block_list_move(struct backed_block_list* from, struct backed_block_
     to->data_blocks = start;
     end->next = nullptr;
   } else {
-    for (bb = to->data_blocks; bb; bb = bb->next) {
-      if (!bb->next || bb->next->block > start->block) {
-        end->next = bb->next;
-        bb->next = start;
-        break;
-      }
+    bb = find_prev(to, start->block, true);
+    if (!bb) {
+      bb = to->data_blocks;
+    }
+    end->next = bb->next;
+    bb->next = start;
+  }
+
+  for (bb = start;; bb = bb->next) {
+    index_insert(to, bb);
+    if (bb == end) {
+      break;
     }
   }
 }
@@ -222,6 +289,7 @@ static int merge_bb(struct backed_block_list* bbl, struct backed_block* a, struc
   a->len += b->len;
   a->next = b->next;
 
+  index_erase(bbl, b);
   backed_block_destroy(b);
 
   return 0;
@@ -232,39 +300,28 @@ static int queue_bb(struct backed_block_list* bbl, struct backed_block* new_bb)
 
   if (bbl->data_blocks == nullptr) {
     bbl->data_blocks = new_bb;
+    index_insert(bbl, new_bb);
     return 0;
   }
 
   if (bbl->data_blocks->block > new_bb->block) {
     new_bb->next = bbl->data_blocks;
     bbl->data_blocks = new_bb;
+    index_insert(bbl, new_bb);
     return 0;
   }
 
-  /* Optimization: blocks are mostly queued in sequence, so save the
-     pointer to the last bb that was added, and start searching from
-     there if the next block number is higher */
-  if (bbl->last_used && new_bb->block > bbl->last_used->block)
-    bb = bbl->last_used;
-  else
+  bb = find_prev(bbl, new_bb->block, false);
+  if (!bb) {
     bb = bbl->data_blocks;
-  bbl->last_used = new_bb;
-
-  for (; bb->next && bb->next->block < new_bb->block; bb = bb->next)
-    ;
-
-  if (bb->next == nullptr) {
-    bb->next = new_bb;
-  } else {
-    new_bb->next = bb->next;
-    bb->next = new_bb;
   }
 
+  new_bb->next = bb->next;
+  bb->next = new_bb;
+  index_insert(bbl, new_bb);
+
   merge_bb(bbl, new_bb, new_bb->next);
-  if (!merge_bb(bbl, bb, new_bb)) {
-    /* new_bb destroyed, point to retained as last_used */
-    bbl->last_used = bb;
-  }
+  merge_bb(bbl, bb, new_bb);
 
   return 0;
 }
@@ -361,6 +418,7 @@ int backed_block_split(struct backed_block_list* bbl, struct backed_block* bb,
   new_bb->next = bb->next;
   bb->next = new_bb;
   bb->len = max_len;
+  index_insert(bbl, new_bb);
 
   switch (bb->type) {
     case BACKED_BLOCK_DATA:
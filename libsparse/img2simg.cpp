@@ -38,7 +38,8 @@
 #endif
 
 void usage() {
-  fprintf(stderr, "Usage: img2simg <raw_image_file> <sparse_image_file> [<block_size>]\n");
+  fprintf(stderr, "Usage: img2simg [-s] <raw_image_file> <sparse_image_file> [<block_size>]\n");
+  fprintf(stderr, "  -s  skip holes in the raw image instead of reading them\n");
 }
 
 int main(int argc, char* argv[]) {
@@ -48,6 +49,21 @@ int main(int argc, char* argv[]) {
   struct sparse_file* s;
   unsigned int block_size = 4096;
   off64_t len;
+  bool skip_holes = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s")) != -1) {
+    switch (opt) {
+      case 's':
+        skip_holes = true;
+        break;
+      default:
+        usage();
+        exit(-1);
+    }
+  }
+  argc -= optind - 1;
+  argv += optind - 1;
 
   if (argc < 3 || argc > 4) {
     usage();
@@ -93,7 +109,11 @@ int main(int argc, char* argv[]) {
   }
 
   sparse_file_verbose(s);
-  ret = sparse_file_read(s, in, false, false);
+  if (skip_holes) {
+    ret = sparse_file_read_holes(s, in);
+  } else {
+    ret = sparse_file_read(s, in, false, false);
+  }
   if (ret) {
     fprintf(stderr, "Failed to read file\n");
     exit(-1);
@@ -245,6 +245,21 @@ int sparse_file_foreach_chunk(struct sparse_file *s, bool sparse, bool crc,
  */
 int sparse_file_read(struct sparse_file *s, int fd, bool sparse, bool crc);
 
+/**
+ * sparse_file_read_holes - read a raw file into a sparse file cookie, skipping holes
+ *
+ * @s - sparse file cookie
+ * @fd - file descriptor to read from
+ *
+ * Behaves like sparse_file_read() with sparse set to false, except that ranges
+ * the filesystem reports as holes (via SEEK_DATA/SEEK_HOLE) are not read and
+ * are left as don't care chunks.  Falls back to reading every block if the
+ * platform or filesystem doesn't support SEEK_DATA.
+ *
+ * Returns 0 on success, negative errno on error.
+ */
+int sparse_file_read_holes(struct sparse_file *s, int fd);
+
 /**
  * sparse_file_read_buf - read a buffer into a sparse file cookie
  *
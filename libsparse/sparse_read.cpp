@@ -410,55 +410,135 @@ static int sparse_file_read_sparse(struct sparse_file* s, SparseFileSource* sour
   return 0;
 }
 
-static int sparse_file_read_normal(struct sparse_file* s, int fd) {
+/*
+ * A block can be stored as a fill chunk if every 32-bit word equals its neighbour. Comparing the
+ * block against itself shifted by one word lets the C library's vectorized memcmp do the scan.
+ */
+static bool is_fill_block(const uint32_t* buf, unsigned int block_size) {
+  return memcmp(buf, buf + 1, block_size - sizeof(uint32_t)) == 0;
+}
+
+/*
+ * Reads len bytes starting at offset from the current position of fd, adding each block either
+ * as a fill chunk or as a reference to the file. Reads are batched into buf, which holds
+ * COPY_BUF_SIZE bytes, to avoid a read() per block.
+ */
+static int do_sparse_file_read_normal(struct sparse_file* s, int fd, uint32_t* buf,
+                                      int64_t offset, int64_t len) {
   int ret;
-  uint32_t* buf = (uint32_t*)malloc(s->block_size);
-  unsigned int block = 0;
-  int64_t remain = s->len;
-  int64_t offset = 0;
-  unsigned int to_read;
-  unsigned int i;
-  bool sparse_block;
+  unsigned int block = offset / s->block_size;
+  int64_t max_read = COPY_BUF_SIZE / s->block_size * s->block_size;
 
-  if (!buf) {
-    return -ENOMEM;
+  if (max_read == 0) {
+    max_read = s->block_size;
   }
 
-  while (remain > 0) {
-    to_read = std::min(remain, (int64_t)(s->block_size));
+  while (len > 0) {
+    int64_t to_read = std::min(len, max_read);
     ret = read_all(fd, buf, to_read);
     if (ret < 0) {
       error("failed to read sparse file");
-      free(buf);
       return ret;
     }
 
-    if (to_read == s->block_size) {
-      sparse_block = true;
-      for (i = 1; i < s->block_size / sizeof(uint32_t); i++) {
-        if (buf[0] != buf[i]) {
-          sparse_block = false;
-          break;
-        }
+    for (int64_t pos = 0; pos < to_read; pos += s->block_size) {
+      unsigned int block_len = std::min(to_read - pos, (int64_t)(s->block_size));
+      const uint32_t* block_buf = buf + pos / sizeof(uint32_t);
+
+      if (block_len == s->block_size && is_fill_block(block_buf, s->block_size)) {
+        /* TODO: add flag to use skip instead of fill for buf[0] == 0 */
+        sparse_file_add_fill(s, block_buf[0], block_len, block);
+      } else {
+        sparse_file_add_fd(s, fd, offset + pos, block_len, block);
       }
-    } else {
-      sparse_block = false;
+      block++;
     }
 
-    if (sparse_block) {
-      /* TODO: add flag to use skip instead of fill for buf[0] == 0 */
-      sparse_file_add_fill(s, buf[0], to_read, block);
-    } else {
-      sparse_file_add_fd(s, fd, offset, to_read, block);
+    len -= to_read;
+    offset += to_read;
+  }
+
+  return 0;
+}
+
+static uint32_t* alloc_read_buf(struct sparse_file* s) {
+  return (uint32_t*)malloc(std::max(COPY_BUF_SIZE, (int64_t)(s->block_size)));
+}
+
+static int sparse_file_read_normal(struct sparse_file* s, int fd) {
+  int ret;
+  uint32_t* buf = alloc_read_buf(s);
+
+  if (!buf) {
+    return -ENOMEM;
+  }
+
+  ret = do_sparse_file_read_normal(s, fd, buf, 0, s->len);
+  free(buf);
+  return ret;
+}
+
+int sparse_file_read_holes(struct sparse_file* s, int fd) {
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+  int ret = 0;
+  uint32_t* buf = alloc_read_buf(s);
+  int64_t end = s->len;
+  int64_t data = 0;
+  int64_t hole;
+  bool found_data = false;
+
+  if (!buf) {
+    return -ENOMEM;
+  }
+
+  while (data < end) {
+    data = lseek64(fd, data, SEEK_DATA);
+    if (data < 0) {
+      if (errno == ENXIO) {
+        /* The rest of the file is a hole. */
+        break;
+      }
+      if (errno == EINVAL && !found_data) {
+        /* SEEK_DATA is not supported by this filesystem; read every block instead. */
+        free(buf);
+        if (lseek64(fd, 0, SEEK_SET) < 0) {
+          return -errno;
+        }
+        return sparse_file_read_normal(s, fd);
+      }
+      ret = -errno;
+      break;
+    }
+    found_data = true;
+    hole = lseek64(fd, data, SEEK_HOLE);
+    if (hole < 0) {
+      ret = -errno;
+      break;
     }
 
-    remain -= to_read;
-    offset += to_read;
-    block++;
+    /* Holes are left out of the sparse file, so they become don't-care chunks. Round the data
+     * range out to whole blocks so that partial blocks are still read. */
+    data = data / s->block_size * s->block_size;
+    hole = std::min(ALIGN(hole, s->block_size), end);
+    if (data >= hole) {
+      break;
+    }
+    if (lseek64(fd, data, SEEK_SET) < 0) {
+      ret = -errno;
+      break;
+    }
+    ret = do_sparse_file_read_normal(s, fd, buf, data, hole - data);
+    if (ret < 0) {
+      break;
+    }
+    data = hole;
   }
 
   free(buf);
-  return 0;
+  return ret;
+#else
+  return sparse_file_read_normal(s, fd);
+#endif
 }
 
 int sparse_file_read(struct sparse_file* s, int fd, bool sparse, bool crc) {
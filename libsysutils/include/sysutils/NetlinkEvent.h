@@ -38,16 +38,24 @@ public:
 
 private:
     int  mSeq;
-    char *mPath;
+    const char *mPath;
     Action mAction;
-    char *mSubsystem;
-    char *mParams[NL_PARAMS_MAX];
+    const char *mSubsystem;
+    // Point into the decoded buffer for ASCII messages, which always have a
+    // path, and are allocated for binary messages, which never do.
+    const char *mParams[NL_PARAMS_MAX];
 
 public:
     NetlinkEvent();
     virtual ~NetlinkEvent();
 
+    /*
+     * Decodes a message without copying it: the path and the parameters of
+     * ASCII messages point into |buffer|, which must outlive the event.
+     */
     bool decode(char *buffer, int size, int format = NetlinkListener::NETLINK_FORMAT_ASCII);
+    /* Clears the event, so that it can decode another message. */
+    void reset();
     const char *findParam(const char *paramName);
 
     const char *getSubsystem() { return mSubsystem; }
@@ -65,6 +73,7 @@ public:
     bool parseRtMessage(const struct nlmsghdr *nh);
     bool parseNdUserOptMessage(const struct nlmsghdr *nh);
     struct nlattr* findNlAttr(const nlmsghdr* nl, size_t hdrlen, uint16_t attr);
+    bool addParam(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
 };
 
 #endif
@@ -29,6 +29,8 @@ class SocketListener {
     int                     mSock;
     std::unordered_map<int, SocketClient*> mClients;
     pthread_mutex_t         mClientsLock;
+    // [0] is the epoll set the listener thread waits on, [1] the eventfd
+    // stopListener() signals through it.
     int                     mCtrlPipe[2];
     pthread_t               mThread;
     bool                    mUseCmdNum;
@@ -59,7 +61,9 @@ private:
     // while processing it.
     std::vector<SocketClient*> snapshotClients();
 
+    // |wakeup| is unused: released clients leave the epoll set directly.
     bool release(SocketClient *c, bool wakeup);
+    bool addClient(SocketClient *c);
     void runListener();
     void init(const char *socketName, int socketFd, bool listen, bool useCmdNum);
 };
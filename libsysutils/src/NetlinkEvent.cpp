@@ -62,23 +62,50 @@ typedef struct ulog_packet_msg {
 using android::base::ParseInt;
 
 NetlinkEvent::NetlinkEvent() {
+    mPath = nullptr;
+    memset(mParams, 0, sizeof(mParams));
+    reset();
+}
+
+NetlinkEvent::~NetlinkEvent() {
+    reset();
+}
+
+void NetlinkEvent::reset() {
+    if (mPath == nullptr) {
+        for (int i = 0; i < NL_PARAMS_MAX && mParams[i] != nullptr; i++) {
+            free(const_cast<char*>(mParams[i]));
+        }
+    }
+    mSeq = 0;
     mAction = Action::kUnknown;
     memset(mParams, 0, sizeof(mParams));
     mPath = nullptr;
     mSubsystem = nullptr;
 }
 
-NetlinkEvent::~NetlinkEvent() {
-    int i;
-    if (mPath)
-        free(mPath);
-    if (mSubsystem)
-        free(mSubsystem);
-    for (i = 0; i < NL_PARAMS_MAX; i++) {
-        if (!mParams[i])
-            break;
-        free(mParams[i]);
+/*
+ * Appends a parameter formatted from a binary message.
+ */
+bool NetlinkEvent::addParam(const char *fmt, ...) {
+    int i = 0;
+    while (i < NL_PARAMS_MAX && mParams[i] != nullptr) {
+        i++;
     }
+    if (i == NL_PARAMS_MAX) {
+        return false;
+    }
+
+    char *param;
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vasprintf(&param, fmt, ap);
+    va_end(ap);
+    if (len < 0) {
+        return false;
+    }
+    mParams[i] = param;
+    return true;
 }
 
 void NetlinkEvent::dump() {
@@ -155,16 +182,16 @@ bool NetlinkEvent::parseIfInfoMessage(const struct nlmsghdr *nh) {
     for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
         switch(rta->rta_type) {
             case IFLA_IFNAME:
-                asprintf(&mParams[0], "INTERFACE=%s", (char *) RTA_DATA(rta));
+                addParam("INTERFACE=%s", (char *) RTA_DATA(rta));
                 // We can get the interface change information from sysfs update
                 // already. But in case we missed those message when devices start.
                 // We do a update again when received a kLinkUp event. To make
                 // the message consistent, use IFINDEX here as well since sysfs
                 // uses IFINDEX.
-                asprintf(&mParams[1], "IFINDEX=%d", ifi->ifi_index);
+                addParam("IFINDEX=%d", ifi->ifi_index);
                 mAction = (ifi->ifi_flags & IFF_LOWER_UP) ? Action::kLinkUp :
                                                             Action::kLinkDown;
-                mSubsystem = strdup("net");
+                mSubsystem = "net";
                 return true;
         }
     }
@@ -260,18 +287,18 @@ bool NetlinkEvent::parseIfAddrMessage(const struct nlmsghdr *nh) {
     // Fill in netlink event information.
     mAction = (type == RTM_NEWADDR) ? Action::kAddressUpdated :
                                       Action::kAddressRemoved;
-    mSubsystem = strdup("net");
-    asprintf(&mParams[0], "ADDRESS=%s/%d", addrstr, ifaddr->ifa_prefixlen);
-    asprintf(&mParams[1], "INTERFACE=%s", ifname);
-    asprintf(&mParams[2], "FLAGS=%u", flags);
-    asprintf(&mParams[3], "SCOPE=%u", ifaddr->ifa_scope);
-    asprintf(&mParams[4], "IFINDEX=%u", ifaddr->ifa_index);
+    mSubsystem = "net";
+    addParam("ADDRESS=%s/%d", addrstr, ifaddr->ifa_prefixlen);
+    addParam("INTERFACE=%s", ifname);
+    addParam("FLAGS=%u", flags);
+    addParam("SCOPE=%u", ifaddr->ifa_scope);
+    addParam("IFINDEX=%u", ifaddr->ifa_index);
 
     if (cacheinfo) {
-        asprintf(&mParams[5], "PREFERRED=%u", cacheinfo->ifa_prefered);
-        asprintf(&mParams[6], "VALID=%u", cacheinfo->ifa_valid);
-        asprintf(&mParams[7], "CSTAMP=%u", cacheinfo->cstamp);
-        asprintf(&mParams[8], "TSTAMP=%u", cacheinfo->tstamp);
+        addParam("PREFERRED=%u", cacheinfo->ifa_prefered);
+        addParam("VALID=%u", cacheinfo->ifa_valid);
+        addParam("CSTAMP=%u", cacheinfo->cstamp);
+        addParam("TSTAMP=%u", cacheinfo->tstamp);
     }
 
     return true;
@@ -287,9 +314,9 @@ bool NetlinkEvent::parseUlogPacketMessage(const struct nlmsghdr *nh) {
         return false;
 
     devname = pm->indev_name[0] ? pm->indev_name : pm->outdev_name;
-    asprintf(&mParams[0], "ALERT_NAME=%s", pm->prefix);
-    asprintf(&mParams[1], "INTERFACE=%s", devname);
-    mSubsystem = strdup("qlog");
+    addParam("ALERT_NAME=%s", pm->prefix);
+    addParam("INTERFACE=%s", devname);
+    mSubsystem = "qlog";
     mAction = Action::kChange;
     return true;
 }
@@ -327,17 +354,17 @@ bool NetlinkEvent::parseNfPacketMessage(struct nlmsghdr *nh) {
         raw = (char*)nlAttrData(payload);
     }
 
-    size_t hexSize = 5 + (len * 2);
-    char* hex = (char*)calloc(1, hexSize);
-    strlcpy(hex, "HEX=", hexSize);
+    char hex[5 + 256 * 2];
+    strlcpy(hex, "HEX=", sizeof(hex));
     for (int i = 0; i < len; i++) {
         hex[4 + (i * 2)] = "0123456789abcdef"[(raw[i] >> 4) & 0xf];
         hex[5 + (i * 2)] = "0123456789abcdef"[raw[i] & 0xf];
     }
+    hex[4 + len * 2] = '\0';
 
-    asprintf(&mParams[0], "UID=%d", uid);
-    mParams[1] = hex;
-    mSubsystem = strdup("strict");
+    addParam("UID=%d", uid);
+    addParam("%s", hex);
+    mSubsystem = "strict";
     mAction = Action::kChange;
     return true;
 }
@@ -427,10 +454,10 @@ bool NetlinkEvent::parseRtMessage(const struct nlmsghdr *nh) {
     // Fill in netlink event information.
     mAction = (type == RTM_NEWROUTE) ? Action::kRouteUpdated :
                                        Action::kRouteRemoved;
-    mSubsystem = strdup("net");
-    asprintf(&mParams[0], "ROUTE=%s/%d", dst, prefixLength);
-    asprintf(&mParams[1], "GATEWAY=%s", (*gw) ? gw : "");
-    asprintf(&mParams[2], "INTERFACE=%s", (*dev) ? dev : "");
+    mSubsystem = "net";
+    addParam("ROUTE=%s/%d", dst, prefixLength);
+    addParam("GATEWAY=%s", (*gw) ? gw : "");
+    addParam("INTERFACE=%s", (*dev) ? dev : "");
 
     return true;
 }
@@ -506,8 +533,10 @@ bool NetlinkEvent::parseNdUserOptMessage(const struct nlmsghdr *nh) {
         // last address are followed by ','; the last is followed by '\0'.
         static const size_t kMaxSingleAddressLength =
                 INET6_ADDRSTRLEN + strlen("%") + IFNAMSIZ + strlen(",");
+        // Most RAs carry a handful of servers, which fit on the stack.
+        char stackbuf[256];
         const size_t bufsize = numaddrs * kMaxSingleAddressLength;
-        char *buf = (char *) malloc(bufsize);
+        char *buf = bufsize <= sizeof(stackbuf) ? stackbuf : (char *) malloc(bufsize);
         if (!buf) {
             SLOGE("RDNSS option: out of memory\n");
             return false;
@@ -529,11 +558,11 @@ bool NetlinkEvent::parseNdUserOptMessage(const struct nlmsghdr *nh) {
         buf[pos] = '\0';
 
         mAction = Action::kRdnss;
-        mSubsystem = strdup("net");
-        asprintf(&mParams[0], "INTERFACE=%s", ifname);
-        asprintf(&mParams[1], "LIFETIME=%u", lifetime);
-        asprintf(&mParams[2], "SERVERS=%s", buf);
-        free(buf);
+        mSubsystem = "net";
+        addParam("INTERFACE=%s", ifname);
+        addParam("LIFETIME=%u", lifetime);
+        addParam("SERVERS=%s", buf);
+        if (buf != stackbuf) free(buf);
     } else if (opthdr->nd_opt_type == ND_OPT_DNSSL) {
         // TODO: support DNSSL.
     } else if (opthdr->nd_opt_type == ND_OPT_CAPTIVE_PORTAL) {
@@ -651,7 +680,7 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
                     return false;
                 }
             }
-            mPath = strdup(p+1);
+            mPath = p+1;
             first = 0;
         } else {
             const char* a;
@@ -667,9 +696,9 @@ bool NetlinkEvent::parseAsciiNetlinkMessage(char *buffer, int size) {
                     SLOGE("NetlinkEvent::parseAsciiNetlinkMessage: failed to parse SEQNUM=%s", a);
                 }
             } else if ((a = HAS_CONST_PREFIX(s, end, "SUBSYSTEM=")) != nullptr) {
-                mSubsystem = strdup(a);
+                mSubsystem = a;
             } else if (param_idx < NL_PARAMS_MAX) {
-                mParams[param_idx++] = strdup(s);
+                mParams[param_idx++] = s;
             }
         }
         s += strlen(s) + 1;
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sysutils/NetlinkEvent.h>
+
+#include <arpa/inet.h>
+#include <linux/rtnetlink.h>
+#include <string.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+// Builds an ASCII uevent the way the kernel sends it: NUL separated.
+std::string uevent(const std::vector<std::string>& lines) {
+    std::string msg;
+    for (const auto& line : lines) {
+        msg += line;
+        msg += '\0';
+    }
+    return msg;
+}
+
+}  // unnamed namespace
+
+TEST(NetlinkEventTest, DecodesAsciiInPlace) {
+    std::string msg = uevent({"add@/devices/virtual/net/wlan0", "ACTION=add",
+                              "DEVPATH=/devices/virtual/net/wlan0", "SUBSYSTEM=net",
+                              "INTERFACE=wlan0", "IFINDEX=7", "SEQNUM=1234"});
+    NetlinkEvent evt;
+    ASSERT_TRUE(evt.decode(msg.data(), msg.size()));
+
+    EXPECT_EQ(NetlinkEvent::Action::kAdd, evt.getAction());
+    EXPECT_STREQ("net", evt.getSubsystem());
+    EXPECT_STREQ("wlan0", evt.findParam("INTERFACE"));
+    EXPECT_STREQ("7", evt.findParam("IFINDEX"));
+    EXPECT_EQ(nullptr, evt.findParam("IFINDE"));
+
+    // Nothing was copied.
+    const char* interface = evt.findParam("INTERFACE");
+    EXPECT_GE(interface, msg.data());
+    EXPECT_LT(interface, msg.data() + msg.size());
+}
+
+TEST(NetlinkEventTest, Reset) {
+    std::string first = uevent({"remove@/devices/a", "ACTION=remove", "SUBSYSTEM=block",
+                                "MAJOR=8"});
+    std::string second = uevent({"change@/devices/b", "ACTION=change", "MINOR=1"});
+
+    NetlinkEvent evt;
+    ASSERT_TRUE(evt.decode(first.data(), first.size()));
+    EXPECT_EQ(NetlinkEvent::Action::kRemove, evt.getAction());
+
+    evt.reset();
+    ASSERT_TRUE(evt.decode(second.data(), second.size()));
+    EXPECT_EQ(NetlinkEvent::Action::kChange, evt.getAction());
+    EXPECT_EQ(nullptr, evt.getSubsystem());
+    EXPECT_EQ(nullptr, evt.findParam("MAJOR"));
+    EXPECT_STREQ("1", evt.findParam("MINOR"));
+}
+
+TEST(NetlinkEventTest, DecodesAddressMessage) {
+    struct {
+        nlmsghdr nh;
+        ifaddrmsg ifa;
+        rtattr rta;
+        in_addr addr;
+        rtattr cache_rta;
+        ifa_cacheinfo cache;
+    } __attribute__((packed)) msg = {};
+    static_assert(sizeof(msg) == NLMSG_LENGTH(sizeof(ifaddrmsg)) + RTA_LENGTH(sizeof(in_addr)) +
+                                         RTA_LENGTH(sizeof(ifa_cacheinfo)),
+                  "unexpected padding");
+    msg.nh.nlmsg_len = sizeof(msg);
+    msg.nh.nlmsg_type = RTM_NEWADDR;
+    msg.ifa.ifa_family = AF_INET;
+    msg.ifa.ifa_prefixlen = 24;
+    msg.ifa.ifa_index = 0x7fffffff;  // No such interface.
+    msg.rta.rta_len = RTA_LENGTH(sizeof(in_addr));
+    msg.rta.rta_type = IFA_ADDRESS;
+    inet_pton(AF_INET, "192.0.2.1", &msg.addr);
+    msg.cache_rta.rta_len = RTA_LENGTH(sizeof(ifa_cacheinfo));
+    msg.cache_rta.rta_type = IFA_CACHEINFO;
+    msg.cache.ifa_valid = 3600;
+
+    NetlinkEvent evt;
+    ASSERT_TRUE(evt.decode(reinterpret_cast<char*>(&msg), sizeof(msg),
+                           NetlinkListener::NETLINK_FORMAT_BINARY));
+    EXPECT_EQ(NetlinkEvent::Action::kAddressUpdated, evt.getAction());
+    EXPECT_STREQ("net", evt.getSubsystem());
+    EXPECT_STREQ("192.0.2.1/24", evt.findParam("ADDRESS"));
+    EXPECT_STREQ("", evt.findParam("INTERFACE"));
+    EXPECT_STREQ("2147483647", evt.findParam("IFINDEX"));
+    EXPECT_STREQ("3600", evt.findParam("VALID"));
+}
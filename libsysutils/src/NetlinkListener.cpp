@@ -18,16 +18,47 @@
 
 #include <errno.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <linux/netlink.h> /* out of order because must follow sys/socket.h */
 
-#include <cutils/uevent.h>
 #include <log/log.h>
 #include <sysutils/NetlinkEvent.h>
 
+// How many messages a single wakeup takes in at most.
+static constexpr size_t kBatchSize = 8;
+static constexpr size_t kSlotSize = 64 * 1024;
+
+namespace {
+
+// Slots for all but the first message of a batch, which goes in mBuffer.
+// Each is as large as mBuffer so that batching truncates nothing, but only
+// the pages that messages are actually written to get backed by memory.
+class BatchSlots {
+  public:
+    BatchSlots() {
+        void* slots = mmap(nullptr, kSize, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        mSlots = (slots == MAP_FAILED) ? nullptr : static_cast<char*>(slots);
+    }
+    ~BatchSlots() {
+        if (mSlots) munmap(mSlots, kSize);
+    }
+
+    // Returns the slot for message |i| of a batch, 1 <= i < kBatchSize, or
+    // nullptr if they couldn't be allocated.
+    char* get(size_t i) { return mSlots ? mSlots + (i - 1) * kSlotSize : nullptr; }
+
+  private:
+    static constexpr size_t kSize = (kBatchSize - 1) * kSlotSize;
+    char* mSlots;
+};
+
+}  // namespace
+
 #if 1
 /* temporary version until we can get Motorola to update their
  * ril.so.  Their prebuilt ril.so is using this private class
@@ -46,30 +77,78 @@ NetlinkListener::NetlinkListener(int socket, int format) :
 bool NetlinkListener::onDataAvailable(SocketClient *cli)
 {
     int socket = cli->getSocket();
-    ssize_t count;
-    uid_t uid = -1;
 
     bool require_group = true;
     if (mFormat == NETLINK_FORMAT_BINARY_UNICAST) {
         require_group = false;
     }
 
-    count = TEMP_FAILURE_RETRY(uevent_kernel_recv(socket,
-            mBuffer, sizeof(mBuffer), require_group, &uid));
+    // Take in as many messages as are queued, up to kBatchSize, with a
+    // single recvmmsg(). The slots belong to the thread rather than the
+    // listener so that the listener's layout stays the same. Without them,
+    // one message at a time goes in mBuffer.
+    static_assert(sizeof(mBuffer) == kSlotSize, "slots must fit the largest message");
+    static thread_local BatchSlots slots;
+    const size_t batch = slots.get(1) ? kBatchSize : 1;
+
+    mmsghdr msgs[kBatchSize];
+    iovec iovs[kBatchSize];
+    sockaddr_nl addrs[kBatchSize];
+    char controls[kBatchSize][CMSG_SPACE(sizeof(ucred))];
+    for (size_t i = 0; i < batch; i++) {
+        iovs[i] = {i == 0 ? mBuffer : slots.get(i), kSlotSize};
+        msgs[i].msg_hdr = {
+            .msg_name = &addrs[i],
+            .msg_namelen = sizeof(addrs[i]),
+            .msg_iov = &iovs[i],
+            .msg_iovlen = 1,
+            .msg_control = controls[i],
+            .msg_controllen = sizeof(controls[i]),
+        };
+    }
+
+    int count = TEMP_FAILURE_RETRY(recvmmsg(socket, msgs, batch, MSG_DONTWAIT, nullptr));
     if (count < 0) {
-        SLOGE("recvmsg failed (%s)", strerror(errno));
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        }
+        SLOGE("recvmmsg failed (%s)", strerror(errno));
         return false;
     }
 
-    NetlinkEvent *evt = new NetlinkEvent();
-    if (evt->decode(mBuffer, count, mFormat)) {
-        onEvent(evt);
-    } else if (mFormat != NETLINK_FORMAT_BINARY) {
-        // Don't complain if parseBinaryNetlinkMessage returns false. That can
-        // just mean that the buffer contained no messages we're interested in.
-        SLOGE("Error decoding NetlinkEvent");
+    NetlinkEvent evt;
+    for (int i = 0; i < count; i++) {
+        const msghdr& hdr = msgs[i].msg_hdr;
+        char* buffer = static_cast<char*>(hdr.msg_iov->iov_base);
+
+        // The same checks as uevent_kernel_recv().
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+        if (cmsg == nullptr || cmsg->cmsg_type != SCM_CREDENTIALS) {
+            // ignoring netlink message with no sender credentials
+            continue;
+        }
+        if (addrs[i].nl_pid != 0) {
+            // ignore non-kernel
+            continue;
+        }
+        if (require_group && addrs[i].nl_groups == 0) {
+            // ignore unicast messages when requested
+            continue;
+        }
+        if (hdr.msg_flags & MSG_TRUNC) {
+            SLOGE("Dropping truncated netlink message");
+            continue;
+        }
+
+        evt.reset();
+        if (evt.decode(buffer, msgs[i].msg_len, mFormat)) {
+            onEvent(&evt);
+        } else if (mFormat != NETLINK_FORMAT_BINARY) {
+            // Don't complain if parseBinaryNetlinkMessage returns false. That can
+            // just mean that the buffer contained no messages we're interested in.
+            SLOGE("Error decoding NetlinkEvent");
+        }
     }
 
-    delete evt;
     return true;
 }
@@ -19,7 +19,8 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -33,8 +34,8 @@
 #include <sysutils/SocketListener.h>
 #include <sysutils/SocketClient.h>
 
-#define CtrlPipe_Shutdown 0
-#define CtrlPipe_Wakeup   1
+// How many ready fds a single epoll_wait() returns at most.
+static constexpr int kMaxEvents = 64;
 
 SocketListener::SocketListener(const char *socketName, bool listen) {
     init(socketName, -1, listen, false);
@@ -53,6 +54,7 @@ void SocketListener::init(const char *socketName, int socketFd, bool listen, boo
     mSocketName = socketName;
     mSock = socketFd;
     mUseCmdNum = useCmdNum;
+    mCtrlPipe[0] = mCtrlPipe[1] = -1;
     pthread_mutex_init(&mClientsLock, nullptr);
 }
 
@@ -62,6 +64,8 @@ SocketListener::~SocketListener() {
 
     if (mCtrlPipe[0] != -1) {
         close(mCtrlPipe[0]);
+    }
+    if (mCtrlPipe[1] != -1) {
         close(mCtrlPipe[1]);
     }
     for (auto pair : mClients) {
@@ -92,11 +96,34 @@ int SocketListener::startListener(int backlog) {
     if (mListen && listen(mSock, backlog) < 0) {
         SLOGE("Unable to listen on socket (%s)", strerror(errno));
         return -1;
-    } else if (!mListen)
-        mClients[mSock] = new SocketClient(mSock, false, mUseCmdNum);
+    }
 
-    if (pipe2(mCtrlPipe, O_CLOEXEC)) {
-        SLOGE("pipe failed (%s)", strerror(errno));
+    // Sockets stay registered with epoll from accept() to release(), so each
+    // wakeup only has to look at the ones that are ready.
+    mCtrlPipe[0] = epoll_create1(EPOLL_CLOEXEC);
+    if (mCtrlPipe[0] < 0) {
+        SLOGE("epoll_create1 failed (%s)", strerror(errno));
+        return -1;
+    }
+    mCtrlPipe[1] = eventfd(0, EFD_CLOEXEC);
+    if (mCtrlPipe[1] < 0) {
+        SLOGE("eventfd failed (%s)", strerror(errno));
+        return -1;
+    }
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = mCtrlPipe[1];
+    if (epoll_ctl(mCtrlPipe[0], EPOLL_CTL_ADD, mCtrlPipe[1], &ev)) {
+        SLOGE("epoll_ctl failed (%s)", strerror(errno));
+        return -1;
+    }
+    if (mListen) {
+        ev.data.fd = mSock;
+        if (epoll_ctl(mCtrlPipe[0], EPOLL_CTL_ADD, mSock, &ev)) {
+            SLOGE("epoll_ctl failed (%s)", strerror(errno));
+            return -1;
+        }
+    } else if (!addClient(new SocketClient(mSock, false, mUseCmdNum))) {
         return -1;
     }
 
@@ -109,11 +136,11 @@ int SocketListener::startListener(int backlog) {
 }
 
 int SocketListener::stopListener() {
-    char c = CtrlPipe_Shutdown;
+    uint64_t shutdown = 1;
     int  rc;
 
-    rc = TEMP_FAILURE_RETRY(write(mCtrlPipe[1], &c, 1));
-    if (rc != 1) {
+    rc = TEMP_FAILURE_RETRY(write(mCtrlPipe[1], &shutdown, sizeof(shutdown)));
+    if (rc != sizeof(shutdown)) {
         SLOGE("Error writing to control pipe (%s)", strerror(errno));
         return -1;
     }
@@ -148,67 +175,67 @@ void *SocketListener::threadStart(void *obj) {
     return nullptr;
 }
 
-void SocketListener::runListener() {
-    while (true) {
-        std::vector<pollfd> fds;
+bool SocketListener::addClient(SocketClient* c) {
+    const int fd = c->getSocket();
+    pthread_mutex_lock(&mClientsLock);
+    mClients[fd] = c;
+    pthread_mutex_unlock(&mClientsLock);
 
+    epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(mCtrlPipe[0], EPOLL_CTL_ADD, fd, &ev)) {
+        SLOGE("epoll_ctl failed for fd %d (%s)", fd, strerror(errno));
         pthread_mutex_lock(&mClientsLock);
-        fds.reserve(2 + mClients.size());
-        fds.push_back({.fd = mCtrlPipe[0], .events = POLLIN});
-        if (mListen) fds.push_back({.fd = mSock, .events = POLLIN});
-        for (auto pair : mClients) {
-            // NB: calling out to an other object with mClientsLock held (safe)
-            const int fd = pair.second->getSocket();
-            if (fd != pair.first) SLOGE("fd mismatch: %d != %d", fd, pair.first);
-            fds.push_back({.fd = fd, .events = POLLIN});
-        }
+        mClients.erase(fd);
         pthread_mutex_unlock(&mClientsLock);
+        c->decRef();
+        return false;
+    }
+    return true;
+}
 
+void SocketListener::runListener() {
+    epoll_event events[kMaxEvents];
+    std::vector<SocketClient*> pending;
+    pending.reserve(kMaxEvents);
+
+    while (true) {
         SLOGV("mListen=%d, mSocketName=%s", mListen, mSocketName);
-        int rc = TEMP_FAILURE_RETRY(poll(fds.data(), fds.size(), -1));
+        int rc = TEMP_FAILURE_RETRY(epoll_wait(mCtrlPipe[0], events, kMaxEvents, -1));
         if (rc < 0) {
-            SLOGE("poll failed (%s) mListen=%d", strerror(errno), mListen);
+            SLOGE("epoll_wait failed (%s) mListen=%d", strerror(errno), mListen);
             sleep(1);
             continue;
         }
 
-        if (fds[0].revents & (POLLIN | POLLERR)) {
-            char c = CtrlPipe_Shutdown;
-            TEMP_FAILURE_RETRY(read(mCtrlPipe[0], &c, 1));
-            if (c == CtrlPipe_Shutdown) {
-                break;
-            }
-            continue;
-        }
-        if (mListen && (fds[1].revents & (POLLIN | POLLERR))) {
-            int c = TEMP_FAILURE_RETRY(accept4(mSock, nullptr, nullptr, SOCK_CLOEXEC));
-            if (c < 0) {
-                SLOGE("accept failed (%s)", strerror(errno));
-                sleep(1);
-                continue;
-            }
-            pthread_mutex_lock(&mClientsLock);
-            mClients[c] = new SocketClient(c, true, mUseCmdNum);
-            pthread_mutex_unlock(&mClientsLock);
-        }
+        bool accepting = false;
+        pending.clear();
 
-        // Add all active clients to the pending list first, so we can release
+        // Add all ready clients to the pending list first, so we can release
         // the lock before invoking the callbacks.
-        std::vector<SocketClient*> pending;
         pthread_mutex_lock(&mClientsLock);
-        const int size = fds.size();
-        for (int i = mListen ? 2 : 1; i < size; ++i) {
-            const struct pollfd& p = fds[i];
-            if (p.revents & (POLLIN | POLLERR)) {
-                auto it = mClients.find(p.fd);
-                if (it == mClients.end()) {
-                    SLOGE("fd vanished: %d", p.fd);
-                    continue;
+        for (int i = 0; i < rc; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == mCtrlPipe[1]) {
+                pthread_mutex_unlock(&mClientsLock);
+                for (SocketClient* c : pending) {
+                    c->decRef();
                 }
-                SocketClient* c = it->second;
-                pending.push_back(c);
-                c->incRef();
+                return;
+            }
+            if (mListen && fd == mSock) {
+                accepting = true;
+                continue;
+            }
+            auto it = mClients.find(fd);
+            if (it == mClients.end()) {
+                SLOGE("fd vanished: %d", fd);
+                continue;
             }
+            SocketClient* c = it->second;
+            pending.push_back(c);
+            c->incRef();
         }
         pthread_mutex_unlock(&mClientsLock);
 
@@ -216,14 +243,26 @@ void SocketListener::runListener() {
             // Process it, if false is returned, remove from the map
             SLOGV("processing fd %d", c->getSocket());
             if (!onDataAvailable(c)) {
-                release(c, false);
+                release(c);
             }
             c->decRef();
         }
+
+        // Accept after the clients are processed, so that a new client can't
+        // take the fd of one that was released since epoll_wait() returned.
+        if (accepting) {
+            int c = TEMP_FAILURE_RETRY(accept4(mSock, nullptr, nullptr, SOCK_CLOEXEC));
+            if (c < 0) {
+                SLOGE("accept failed (%s)", strerror(errno));
+                sleep(1);
+                continue;
+            }
+            addClient(new SocketClient(c, true, mUseCmdNum));
+        }
     }
 }
 
-bool SocketListener::release(SocketClient* c, bool wakeup) {
+bool SocketListener::release(SocketClient* c, bool /* wakeup */) {
     bool ret = false;
     /* if our sockets are connection-based, remove and destroy it */
     if (mListen && c) {
@@ -231,13 +270,14 @@ bool SocketListener::release(SocketClient* c, bool wakeup) {
         SLOGV("going to zap %d for %s", c->getSocket(), mSocketName);
         pthread_mutex_lock(&mClientsLock);
         ret = (mClients.erase(c->getSocket()) != 0);
+        if (ret) {
+            // Other references may keep the socket open, so it has to be
+            // taken out of the set explicitly.
+            epoll_ctl(mCtrlPipe[0], EPOLL_CTL_DEL, c->getSocket(), nullptr);
+        }
         pthread_mutex_unlock(&mClientsLock);
         if (ret) {
             ret = c->decRef();
-            if (wakeup) {
-                char b = CtrlPipe_Wakeup;
-                TEMP_FAILURE_RETRY(write(mCtrlPipe[1], &b, 1));
-            }
         }
     }
     return ret;
@@ -181,3 +181,31 @@ TEST_F(FrameworkListenerTest, MultipleClients) {
     EXPECT_EQ(std::string("42 test,2") + '\0', recvReply(client2.get()));
     EXPECT_EQ(std::string("42 test,1") + '\0', recvReply(client1.get()));
 }
+
+TEST_F(FrameworkListenerTest, ManyClients) {
+    // Connect one at a time, the listen backlog is small.
+    std::vector<unique_fd> clients;
+    for (int i = 0; i < 200; ++i) {
+        clients.push_back(clientSocket(mSocketPath));
+        sendCmd(clients.back().get(), "test");
+        EXPECT_EQ(std::string("42 test") + '\0', recvReply(clients.back().get()));
+    }
+
+    // All of them at once.
+    for (size_t i = 0; i < clients.size(); ++i) {
+        sendCmd(clients[i].get(), ("test " + std::to_string(i)).c_str());
+    }
+    for (size_t i = 0; i < clients.size(); ++i) {
+        EXPECT_EQ("42 test," + std::to_string(i) + '\0', recvReply(clients[i].get()));
+    }
+
+    // Drop every other client, the rest must still be served.
+    for (size_t i = 0; i < clients.size(); i += 2) {
+        clients[i].reset();
+    }
+    for (size_t i = 1; i < clients.size(); i += 2) {
+        sendCmd(clients[i].get(), "test again");
+        EXPECT_EQ(std::string("42 test,again") + '\0', recvReply(clients[i].get()));
+    }
+    testCommand("test", "42 test");
+}
@@ -16,6 +16,8 @@
 #include <utils/Looper.h>
 
 #include <sys/eventfd.h>
+#include <algorithm>
+#include <atomic>
 #include <cinttypes>
 
 namespace android {
@@ -59,6 +61,15 @@ static const int EPOLL_MAX_EVENTS = 16;
 static pthread_once_t gTLSOnce = PTHREAD_ONCE_INIT;
 static pthread_key_t gTLSKey = 0;
 
+// Sequence numbers of sent messages. Shared by all loopers, it only needs to grow.
+static std::atomic<uint64_t> gNextMessageSeq(0);
+
+// Orders the message heap so that the earliest message, and among those the first sent,
+// is at the front.
+bool Looper::messageEnvelopeAfter(const MessageEnvelope& a, const MessageEnvelope& b) {
+    return a.uptime > b.uptime || (a.uptime == b.uptime && a.seq > b.seq);
+}
+
 Looper::Looper(bool allowNonCallbacks)
     : mAllowNonCallbacks(allowNonCallbacks),
       mSendingMessage(false),
@@ -314,7 +325,7 @@ Done: ;
             { // obtain handler
                 sp<MessageHandler> handler = messageEnvelope.handler;
                 Message message = messageEnvelope.message;
-                mMessageEnvelopes.removeAt(0);
+                popMessageEnvelopeLocked();
                 mSendingMessage = true;
                 mLock.unlock();
 
@@ -590,17 +601,15 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
             this, uptime, handler.get(), message.what);
 #endif
 
-    size_t i = 0;
+    bool atHead;
     { // acquire lock
         AutoMutex _l(mLock);
 
-        size_t messageCount = mMessageEnvelopes.size();
-        while (i < messageCount && uptime >= mMessageEnvelopes.itemAt(i).uptime) {
-            i += 1;
-        }
-
         MessageEnvelope messageEnvelope(uptime, handler, message);
-        mMessageEnvelopes.insertAt(messageEnvelope, i, 1);
+        messageEnvelope.seq = gNextMessageSeq.fetch_add(1, std::memory_order_relaxed);
+        mMessageEnvelopes.push(messageEnvelope);
+        std::push_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(), messageEnvelopeAfter);
+        atHead = mMessageEnvelopes.itemAt(0).seq == messageEnvelope.seq;
 
         // Optimization: If the Looper is currently sending a message, then we can skip
         // the call to wake() because the next thing the Looper will do after processing
@@ -612,7 +621,7 @@ void Looper::sendMessageAtTime(nsecs_t uptime, const sp<MessageHandler>& handler
     } // release lock
 
     // Wake the poll loop only when we enqueue a new message at the head.
-    if (i == 0) {
+    if (atHead) {
         wake();
     }
 }
@@ -625,12 +634,17 @@ void Looper::removeMessages(const sp<MessageHandler>& handler) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
+        size_t messageCount = mMessageEnvelopes.size();
+        for (size_t i = messageCount; i != 0; ) {
             const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
             if (messageEnvelope.handler == handler) {
                 mMessageEnvelopes.removeAt(i);
             }
         }
+        if (mMessageEnvelopes.size() != messageCount) {
+            std::make_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                           messageEnvelopeAfter);
+        }
     } // release lock
 }
 
@@ -642,16 +656,27 @@ void Looper::removeMessages(const sp<MessageHandler>& handler, int what) {
     { // acquire lock
         AutoMutex _l(mLock);
 
-        for (size_t i = mMessageEnvelopes.size(); i != 0; ) {
+        size_t messageCount = mMessageEnvelopes.size();
+        for (size_t i = messageCount; i != 0; ) {
             const MessageEnvelope& messageEnvelope = mMessageEnvelopes.itemAt(--i);
             if (messageEnvelope.handler == handler
                     && messageEnvelope.message.what == what) {
                 mMessageEnvelopes.removeAt(i);
             }
         }
+        if (mMessageEnvelopes.size() != messageCount) {
+            std::make_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(),
+                           messageEnvelopeAfter);
+        }
     } // release lock
 }
 
+// Removes the message at the head of the heap. The caller must hold mLock.
+void Looper::popMessageEnvelopeLocked() {
+    std::pop_heap(mMessageEnvelopes.begin(), mMessageEnvelopes.end(), messageEnvelopeAfter);
+    mMessageEnvelopes.pop();
+}
+
 bool Looper::isPolling() const {
     return mPolling;
 }
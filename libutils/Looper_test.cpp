@@ -9,6 +9,9 @@
 #include <unistd.h>
 #include <time.h>
 
+#include <thread>
+#include <vector>
+
 #include <utils/threads.h>
 
 // b/141212746 - increased for virtual platforms with higher volatility
@@ -539,6 +542,65 @@ TEST_F(LooperTest, SendMessage_WhenMultipleMessagesAreEnqueued_ShouldInvokeHandl
             << "handled message";
 }
 
+TEST_F(LooperTest, SendMessage_WhenSentFromManyThreads_ShouldInvokeHandlersInOrderOfEachThread) {
+    static constexpr int kThreads = 4;
+    static constexpr int kMessages = 2000;
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([this, handler, t]() {
+            for (int i = 0; i < kMessages; i++) {
+                mLooper->sendMessage(handler, Message(t * kMessages + i));
+            }
+        });
+    }
+
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) + seconds_to_nanoseconds(10);
+    while (handler->messages.size() < size_t(kThreads * kMessages)
+            && systemTime(SYSTEM_TIME_MONOTONIC) < deadline) {
+        mLooper->pollOnce(100);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    ASSERT_EQ(size_t(kThreads * kMessages), handler->messages.size())
+            << "all messages should have been handled";
+    int next[kThreads] = {};
+    for (size_t i = 0; i < handler->messages.size(); i++) {
+        int what = handler->messages[i].what;
+        int t = what / kMessages;
+        ASSERT_EQ(next[t], what % kMessages)
+                << "messages from a thread should be handled in the order they were sent";
+        next[t]++;
+    }
+}
+
+TEST_F(LooperTest, SendMessageAtTime_WhenSentOutOfOrder_ShouldInvokeHandlersInTimeOrder) {
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    mLooper->sendMessageAtTime(now - ms2ns(10), handler, Message(MSG_TEST3));
+    mLooper->sendMessageAtTime(now - ms2ns(30), handler, Message(MSG_TEST1));
+    mLooper->sendMessageAtTime(now - ms2ns(10), handler, Message(MSG_TEST4));
+    mLooper->sendMessageAtTime(now - ms2ns(20), handler, Message(MSG_TEST2));
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because messages were sent";
+    ASSERT_EQ(size_t(4), handler->messages.size())
+            << "handled messages";
+    EXPECT_EQ(MSG_TEST1, handler->messages[0].what)
+            << "earliest message handled first";
+    EXPECT_EQ(MSG_TEST2, handler->messages[1].what)
+            << "handled message";
+    EXPECT_EQ(MSG_TEST3, handler->messages[2].what)
+            << "messages with the same time handled in the order they were sent";
+    EXPECT_EQ(MSG_TEST4, handler->messages[3].what)
+            << "messages with the same time handled in the order they were sent";
+}
+
 TEST_F(LooperTest, SendMessageDelayed_WhenSentToTheFuture_ShouldInvokeHandlerAfterDelayTime) {
     sp<StubMessageHandler> handler = new StubMessageHandler();
     mLooper->sendMessageDelayed(ms2ns(100), handler, Message(MSG_TEST1));
@@ -744,4 +806,59 @@ TEST_F(LooperTest, RemoveMessage_WhenRemovingSomeMessagesForHandler_ShouldRemove
             << "no more messages to handle";
 }
 
+TEST_F(LooperTest, SendMessageAtTime_WhenManySentAtSameTimes_ShouldInvokeHandlersInOrderSent) {
+    static constexpr int kMessages = 60;
+    static constexpr int kTimes = 3;
+    sp<StubMessageHandler> handler = new StubMessageHandler();
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < kMessages; i++) {
+        // Interleave the times so that equal-time messages end up spread
+        // across the heap.
+        mLooper->sendMessageAtTime(now - ms2ns(10 * (kTimes - i % kTimes)), handler, Message(i));
+    }
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because messages were sent";
+    ASSERT_EQ(size_t(kMessages), handler->messages.size())
+            << "handled messages";
+    for (int i = 0; i < kMessages; i++) {
+        int expected = (i / (kMessages / kTimes)) + (i % (kMessages / kTimes)) * kTimes;
+        EXPECT_EQ(expected, handler->messages[i].what)
+                << "messages handled in time order, and in the order sent for the same time";
+    }
+}
+
+TEST_F(LooperTest, RemoveMessage_WhenRemovingFromMiddleOfQueue_ShouldKeepTimeOrderOfOthers) {
+    static constexpr int kMessages = 40;
+    sp<StubMessageHandler> handler1 = new StubMessageHandler();
+    sp<StubMessageHandler> handler2 = new StubMessageHandler();
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < kMessages; i++) {
+        // Send out of time order, alternating handlers, so that the removed
+        // messages are scattered through the heap.
+        int slot = (i * 7) % kMessages;
+        mLooper->sendMessageAtTime(now - ms2ns(kMessages - slot),
+                i % 2 ? handler2 : handler1, Message(slot));
+    }
+    mLooper->removeMessages(handler1);
+    mLooper->removeMessages(handler2, 21);
+
+    int result = mLooper->pollOnce(0);
+
+    EXPECT_EQ(Looper::POLL_CALLBACK, result)
+            << "pollOnce result should be Looper::POLL_CALLBACK because messages were sent";
+    EXPECT_EQ(size_t(0), handler1->messages.size())
+            << "no messages to handle";
+    ASSERT_EQ(size_t(kMessages / 2 - 1), handler2->messages.size())
+            << "handled messages";
+    for (size_t i = 1; i < handler2->messages.size(); i++) {
+        EXPECT_LT(handler2->messages[i - 1].what, handler2->messages[i].what)
+                << "remaining messages handled in time order";
+        EXPECT_NE(21, handler2->messages[i].what)
+                << "removed message not handled";
+    }
+}
+
 } // namespace android
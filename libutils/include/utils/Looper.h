@@ -438,12 +438,14 @@ private:
     };
 
     struct MessageEnvelope {
-        MessageEnvelope() : uptime(0) { }
+        MessageEnvelope() : uptime(0), seq(0) { }
 
         MessageEnvelope(nsecs_t u, sp<MessageHandler> h, const Message& m)
-            : uptime(u), handler(std::move(h)), message(m) {}
+            : uptime(u), seq(0), handler(std::move(h)), message(m) {}
 
         nsecs_t uptime;
+        // Orders messages with the same uptime by the time they were sent.
+        uint64_t seq;
         sp<MessageHandler> handler;
         Message message;
     };
@@ -453,6 +455,7 @@ private:
     android::base::unique_fd mWakeEventFd;  // immutable
     Mutex mLock;
 
+    // Messages waiting to be delivered, a min-heap on (uptime, seq).
     Vector<MessageEnvelope> mMessageEnvelopes; // guarded by mLock
     bool mSendingMessage; // guarded by mLock
 
@@ -479,9 +482,11 @@ private:
     void pushResponse(int events, const Request& request);
     void rebuildEpollLocked();
     void scheduleEpollRebuildLocked();
+    void popMessageEnvelopeLocked();
 
     static void initTLSKey();
     static void threadDestructor(void *st);
+    static bool messageEnvelopeAfter(const MessageEnvelope& a, const MessageEnvelope& b);
     static void initEpollEvent(struct epoll_event* eventItem);
 };
 
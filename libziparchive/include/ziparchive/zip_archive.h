@@ -25,8 +25,10 @@
 #include <sys/cdefs.h>
 #include <sys/types.h>
 
+#include <functional>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include "android-base/off64_t.h"
 
@@ -181,6 +183,8 @@ int32_t FindEntry(const ZipArchiveHandle archive, const std::string_view entryNa
  *
  * This method also accepts optional prefix and suffix to restrict iteration to
  * entry names that start with |optional_prefix| or end with |optional_suffix|.
+ * Iteration with a prefix visits only the matching entries, in name order,
+ * using an index of the names that the first such call builds.
  *
  * Returns 0 on success and negative values on failure.
  */
@@ -224,6 +228,19 @@ int32_t ExtractEntryToFile(ZipArchiveHandle archive, ZipEntry* entry, int fd);
  */
 int32_t ExtractToMemory(ZipArchiveHandle archive, ZipEntry* entry, uint8_t* begin, uint32_t size);
 
+/*
+ * Returns a view of the contents of an uncompressed (kCompressStored) entry
+ * directly in the archive's memory, without copying. This is only possible
+ * for archives opened with OpenArchiveFromMemory; the view is valid until the
+ * memory region is unmapped. Unlike the Extract* functions, the CRC of the
+ * data is not verified.
+ *
+ * Returns 0 on success and negative values on failure, including when the
+ * entry is compressed or the archive is backed by a file descriptor.
+ */
+int32_t GetStoredEntryView(ZipArchiveHandle archive, const ZipEntry* entry,
+                           std::string_view* view);
+
 int GetFileDescriptor(const ZipArchiveHandle archive);
 
 /**
@@ -243,6 +260,28 @@ typedef bool (*ProcessZipEntryFunction)(const uint8_t* buf, size_t buf_size, voi
  */
 int32_t ProcessZipEntryContents(ZipArchiveHandle archive, ZipEntry* entry,
                                 ProcessZipEntryFunction func, void* cookie);
+
+/*
+ * Returns a file descriptor open for writing that the entry |name| should be
+ * extracted to, or -1 to skip the entry. Ownership of the descriptor passes to
+ * the caller of the function, which closes it once the entry is written.
+ * May be called concurrently from several threads.
+ */
+typedef std::function<int(const ZipEntry& entry, const std::string& name)> OpenEntryFileFunction;
+
+/*
+ * Extract the entries named in |names| on up to |num_threads| threads, each
+ * to the file descriptor returned by |open_fn| as if by ExtractEntryToFile.
+ * Entries are read with pread from the archive's shared file descriptor or
+ * memory, and larger entries are started first to balance the threads.
+ *
+ * On failure, no further entries are started, |failed_name| (if non-null) is
+ * set to the name of the entry that failed and its error is returned. Returns
+ * 0 once every entry has been extracted or skipped.
+ */
+int32_t ExtractEntriesToFiles(ZipArchiveHandle archive, const std::vector<std::string>& names,
+                              size_t num_threads, const OpenEntryFileFunction& open_fn,
+                              std::string* failed_name = nullptr);
 #endif
 
 namespace zip_archive {
@@ -252,6 +291,14 @@ class Writer {
   virtual bool Append(uint8_t* buf, size_t buf_size) = 0;
   virtual ~Writer();
 
+  // Returns a pointer to the next |length| bytes of the writer's destination
+  // so that callers can produce data in place instead of calling Append, and
+  // treats them as written. Returns nullptr if the writer has no such buffer
+  // or fewer than |length| bytes are left; callers must then use Append.
+  //
+  // Declared after the destructor so existing vtable slots keep their order.
+  virtual uint8_t* GetBuffer(size_t length);
+
  protected:
   Writer() = default;
 
@@ -265,6 +312,12 @@ class Reader {
   virtual bool ReadAtOffset(uint8_t* buf, size_t len, uint32_t offset) const = 0;
   virtual ~Reader();
 
+  // Returns a pointer to |len| bytes at |offset| if the reader can provide
+  // them without copying, or nullptr otherwise, in which case callers should
+  // use ReadAtOffset. Declared after the destructor so existing vtable slots
+  // keep their order.
+  virtual const uint8_t* AccessAtOffset(size_t len, uint32_t offset) const;
+
  protected:
   Reader() = default;
 
@@ -97,6 +97,22 @@ class ZipWriter {
   // Move assignment.
   ZipWriter& operator=(ZipWriter&& zipWriter) noexcept;
 
+  ~ZipWriter();
+
+  /**
+   * Compresses the data of subsequent ZipWriter::kCompress entries on |num_threads| threads.
+   * Entry data is split into blocks of kParallelBlockSize bytes that are deflated independently
+   * (each primed with the previous block's last 32KiB, as pigz does) and written in order, so
+   * entries and their alignment are laid out exactly as before. The compressed data is still a
+   * single deflate stream, but is not byte-identical to single-threaded output and is slightly
+   * larger. A |num_threads| of 0 or 1 restores single-threaded compression.
+   * Must not be called while an entry is being written.
+   * Returns 0 on success, and an error value < 0 on failure.
+   */
+  int32_t SetCompressionThreads(size_t num_threads);
+
+  static constexpr size_t kParallelBlockSize = 128 * 1024;
+
   /**
    * Starts a new zip entry with the given path and flags.
    * Flags can be a bitwise OR of ZipWriter::kCompress and ZipWriter::kAlign.
@@ -167,6 +183,9 @@ class ZipWriter {
   int32_t CompressBytes(FileEntry* file, const void* data, uint32_t len);
   int32_t FlushCompressedBytes(FileEntry* file);
   bool ShouldUseDataDescriptor() const;
+  int32_t WriteCompressedBlock(FileEntry* file, const std::vector<uint8_t>& data);
+
+  class ParallelDeflater;
 
   enum class State {
     kWritingZip,
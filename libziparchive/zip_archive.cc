@@ -31,7 +31,10 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <thread>
 #include <vector>
 
 #if defined(__APPLE__)
@@ -102,8 +105,43 @@ static uint32_t RoundUpPower2(uint32_t val) {
   return val;
 }
 
-static uint32_t ComputeHash(std::string_view name) {
-  return static_cast<uint32_t>(std::hash<std::string_view>{}(name));
+/*
+ * Hash an entry name. This consumes the name eight bytes at a time with one
+ * multiply per word and finishes with the murmur3 avalanche, which spreads the
+ * long common prefixes of APK entry names ("res/drawable-...") across both the
+ * low bits used to pick a slot and the high bits used as the slot's tag.
+ */
+static uint64_t ComputeHash(std::string_view name) {
+  constexpr uint64_t kMultiplier = 0x9e3779b97f4a7c15ULL;
+  const char* data = name.data();
+  size_t remaining = name.size();
+
+  uint64_t hash = remaining * kMultiplier;
+  while (remaining >= sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    hash = (hash ^ word) * kMultiplier;
+    hash ^= hash >> 32;
+    data += sizeof(word);
+    remaining -= sizeof(word);
+  }
+  if (remaining > 0) {
+    uint64_t word = 0;
+    memcpy(&word, data, remaining);
+    hash = (hash ^ word) * kMultiplier;
+    hash ^= hash >> 32;
+  }
+
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static uint16_t HashTag(uint64_t hash) {
+  return static_cast<uint16_t>(hash >> 48);
 }
 
 /*
@@ -112,12 +150,13 @@ static uint32_t ComputeHash(std::string_view name) {
  */
 static int64_t EntryToIndex(const ZipStringOffset* hash_table, const uint32_t hash_table_size,
                             std::string_view name, const uint8_t* start) {
-  const uint32_t hash = ComputeHash(name);
+  const uint64_t hash = ComputeHash(name);
+  const uint16_t tag = HashTag(hash);
 
   // NOTE: (hash_table_size - 1) is guaranteed to be non-negative.
   uint32_t ent = hash & (hash_table_size - 1);
   while (hash_table[ent].name_offset != 0) {
-    if (hash_table[ent].ToStringView(start) == name) {
+    if (hash_table[ent].hash_tag == tag && hash_table[ent].ToStringView(start) == name) {
       return ent;
     }
     ent = (ent + 1) & (hash_table_size - 1);
@@ -133,6 +172,7 @@ static int64_t EntryToIndex(const ZipStringOffset* hash_table, const uint32_t ha
 static int32_t AddToHash(ZipStringOffset* hash_table, const uint32_t hash_table_size,
                          std::string_view name, const uint8_t* start) {
   const uint64_t hash = ComputeHash(name);
+  const uint16_t tag = HashTag(hash);
   uint32_t ent = hash & (hash_table_size - 1);
 
   /*
@@ -140,7 +180,7 @@ static int32_t AddToHash(ZipStringOffset* hash_table, const uint32_t hash_table_
    * Further, we guarantee that the hashtable size is not 0.
    */
   while (hash_table[ent].name_offset != 0) {
-    if (hash_table[ent].ToStringView(start) == name) {
+    if (hash_table[ent].hash_tag == tag && hash_table[ent].ToStringView(start) == name) {
       // We've found a duplicate entry. We don't accept duplicates.
       ALOGW("Zip: Found duplicate entry %.*s", static_cast<int>(name.size()), name.data());
       return kDuplicateEntry;
@@ -152,6 +192,7 @@ static int32_t AddToHash(ZipStringOffset* hash_table, const uint32_t hash_table_
   const char* start_char = reinterpret_cast<const char*>(start);
   hash_table[ent].name_offset = static_cast<uint32_t>(name.data() - start_char);
   hash_table[ent].name_length = static_cast<uint16_t>(name.size());
+  hash_table[ent].hash_tag = tag;
   return 0;
 }
 
@@ -170,7 +211,8 @@ ZipArchive::ZipArchive(MappedZipFile&& map, bool assume_ownership)
       directory_map(),
       num_entries(0),
       hash_table_size(0),
-      hash_table(nullptr) {
+      hash_table(nullptr),
+      sorted_index_built(false) {
 #if defined(__BIONIC__)
   if (assume_ownership) {
     CHECK(mapped_zip.HasFd());
@@ -187,7 +229,8 @@ ZipArchive::ZipArchive(const void* address, size_t length)
       directory_map(),
       num_entries(0),
       hash_table_size(0),
-      hash_table(nullptr) {}
+      hash_table(nullptr),
+      sorted_index_built(false) {}
 
 ZipArchive::~ZipArchive() {
   if (close_file && mapped_zip.GetFileDescriptor() >= 0) {
@@ -699,12 +742,35 @@ struct IterationHandle {
   std::string prefix;
   std::string suffix;
 
+  // With a prefix, |position| indexes archive->sorted_index within
+  // [begin, end); otherwise it indexes the hash table directly.
+  bool use_sorted_index = false;
   uint32_t position = 0;
+  uint32_t begin = 0;
+  uint32_t end = 0;
 
   IterationHandle(ZipArchive* archive, std::string_view in_prefix, std::string_view in_suffix)
       : archive(archive), prefix(in_prefix), suffix(in_suffix) {}
 };
 
+static const std::vector<uint32_t>& GetSortedIndex(ZipArchive* archive) {
+  std::lock_guard<std::mutex> lock(archive->sorted_index_lock);
+  if (!archive->sorted_index_built) {
+    const uint8_t* start = archive->central_directory.GetBasePtr();
+    const ZipStringOffset* hash_table = archive->hash_table;
+    std::vector<uint32_t>& index = archive->sorted_index;
+    index.reserve(archive->num_entries);
+    for (uint32_t i = 0; i < archive->hash_table_size; ++i) {
+      if (hash_table[i].name_offset != 0) index.push_back(i);
+    }
+    std::sort(index.begin(), index.end(), [hash_table, start](uint32_t lhs, uint32_t rhs) {
+      return hash_table[lhs].ToStringView(start) < hash_table[rhs].ToStringView(start);
+    });
+    archive->sorted_index_built = true;
+  }
+  return archive->sorted_index;
+}
+
 int32_t StartIteration(ZipArchiveHandle archive, void** cookie_ptr,
                        const std::string_view optional_prefix,
                        const std::string_view optional_suffix) {
@@ -719,7 +785,27 @@ int32_t StartIteration(ZipArchiveHandle archive, void** cookie_ptr,
     return kInvalidEntryName;
   }
 
-  *cookie_ptr = new IterationHandle(archive, optional_prefix, optional_suffix);
+  auto* handle = new IterationHandle(archive, optional_prefix, optional_suffix);
+  if (!optional_prefix.empty()) {
+    // Names with a common prefix are contiguous in sorted order, so binary
+    // search for the range rather than testing every entry in Next.
+    const std::vector<uint32_t>& index = GetSortedIndex(archive);
+    const uint8_t* start = archive->central_directory.GetBasePtr();
+    const ZipStringOffset* hash_table = archive->hash_table;
+    auto first = std::lower_bound(index.begin(), index.end(), optional_prefix,
+                                  [hash_table, start](uint32_t ent, std::string_view prefix) {
+                                    return hash_table[ent].ToStringView(start) < prefix;
+                                  });
+    auto last = std::upper_bound(first, index.end(), optional_prefix,
+                                 [hash_table, start](std::string_view prefix, uint32_t ent) {
+                                   return prefix < hash_table[ent].ToStringView(start).substr(
+                                                       0, prefix.size());
+                                 });
+    handle->use_sorted_index = true;
+    handle->begin = handle->position = static_cast<uint32_t>(first - index.begin());
+    handle->end = static_cast<uint32_t>(last - index.begin());
+  }
+  *cookie_ptr = handle;
   return 0;
 }
 
@@ -769,6 +855,26 @@ int32_t Next(void* cookie, ZipEntry* data, std::string_view* name) {
   const uint32_t currentOffset = handle->position;
   const uint32_t hash_table_length = archive->hash_table_size;
   const ZipStringOffset* hash_table = archive->hash_table;
+  if (handle->use_sorted_index) {
+    // Every entry in [position, end) has the prefix; only the suffix needs checking.
+    const std::vector<uint32_t>& index = archive->sorted_index;
+    for (uint32_t i = currentOffset; i < handle->end; ++i) {
+      const uint32_t ent = index[i];
+      const std::string_view entry_name =
+          hash_table[ent].ToStringView(archive->central_directory.GetBasePtr());
+      if (android::base::EndsWith(entry_name, handle->suffix)) {
+        handle->position = (i + 1);
+        const int error = FindEntry(archive, ent, data);
+        if (!error && name) {
+          *name = entry_name;
+        }
+        return error;
+      }
+    }
+    handle->position = handle->begin;
+    return kIterationEnd;
+  }
+
   for (uint32_t i = currentOffset; i < hash_table_length; ++i) {
     const std::string_view entry_name =
         hash_table[i].ToStringView(archive->central_directory.GetBasePtr());
@@ -806,6 +912,15 @@ class MemoryWriter : public zip_archive::Writer {
     return true;
   }
 
+  virtual uint8_t* GetBuffer(size_t length) override {
+    if (length > size_ - bytes_written_) {
+      return nullptr;
+    }
+    uint8_t* result = buf_ + bytes_written_;
+    bytes_written_ += length;
+    return result;
+  }
+
  private:
   uint8_t* const buf_;
   const size_t size_;
@@ -915,6 +1030,10 @@ class EntryReader : public zip_archive::Reader {
     return zip_file_.ReadAtOffset(buf, len, entry_->offset + offset);
   }
 
+  virtual const uint8_t* AccessAtOffset(size_t len, uint32_t offset) const override {
+    return zip_file_.AccessAtOffset(len, entry_->offset + offset);
+  }
+
   virtual ~EntryReader() {}
 
  private:
@@ -936,6 +1055,14 @@ namespace zip_archive {
 Reader::~Reader() {}
 Writer::~Writer() {}
 
+const uint8_t* Reader::AccessAtOffset(size_t, uint32_t) const {
+  return nullptr;
+}
+
+uint8_t* Writer::GetBuffer(size_t) {
+  return nullptr;
+}
+
 int32_t Inflate(const Reader& reader, const uint32_t compressed_length,
                 const uint32_t uncompressed_length, Writer* writer, uint64_t* crc_out) {
   const size_t kBufSize = 32768;
@@ -981,6 +1108,24 @@ int32_t Inflate(const Reader& reader, const uint32_t compressed_length,
   const bool compute_crc = (crc_out != nullptr);
   uLong crc = 0;
   uint32_t remaining_bytes = compressed_length;
+
+  // If the whole compressed stream is already in memory (an archive opened from
+  // memory), feed it to zlib directly rather than copying it through read_buf.
+  if (const uint8_t* data = reader.AccessAtOffset(compressed_length, 0); data != nullptr) {
+    zstream.next_in = data;
+    zstream.avail_in = compressed_length;
+    remaining_bytes = 0;
+  }
+
+  // Likewise, if the writer can hand out its destination (ExtractToMemory),
+  // inflate straight into it rather than through write_buf.
+  uint8_t* direct_out =
+      (uncompressed_length > 0) ? writer->GetBuffer(uncompressed_length) : nullptr;
+  if (direct_out != nullptr) {
+    zstream.next_out = direct_out;
+    zstream.avail_out = uncompressed_length;
+  }
+
   do {
     /* read as much as we can */
     if (zstream.avail_in == 0) {
@@ -1006,6 +1151,20 @@ int32_t Inflate(const Reader& reader, const uint32_t compressed_length,
       return kZlibError;
     }
 
+    if (direct_out != nullptr) {
+      /* the writer's buffer already holds the data; once it's full, any further
+       * output means the entry is larger than declared, which Append reports */
+      if (zstream.avail_out == 0 || zerr == Z_STREAM_END) {
+        if (compute_crc) {
+          crc = crc32(crc, direct_out, static_cast<uInt>(zstream.next_out - direct_out));
+        }
+        direct_out = nullptr;
+        zstream.next_out = &write_buf[0];
+        zstream.avail_out = kBufSize;
+      }
+      continue;
+    }
+
     /* write when we're full or when we're done */
     if (zstream.avail_out == 0 || (zerr == Z_STREAM_END && zstream.avail_out != kBufSize)) {
       const size_t write_size = zstream.next_out - &write_buf[0];
@@ -1059,6 +1218,19 @@ static int32_t CopyEntryToWriter(MappedZipFile& mapped_zip, const ZipEntry* entr
   const uint32_t length = entry->uncompressed_length;
   uint32_t count = 0;
   uLong crc = 0;
+
+  // Archives opened from memory can be handed to the writer without a bounce buffer.
+  if (const uint8_t* data = mapped_zip.AccessAtOffset(length, entry->offset); data != nullptr) {
+    // Writers only read from the buffer passed to Append.
+    if (length > 0 && !writer->Append(const_cast<uint8_t*>(data), length)) {
+      return kIoError;
+    }
+    if (crc_out) {
+      *crc_out = crc32(crc, data, length);
+    }
+    return 0;
+  }
+
   while (count < length) {
     uint32_t remaining = length - count;
     off64_t offset = entry->offset + count;
@@ -1124,6 +1296,26 @@ int32_t ExtractToMemory(ZipArchiveHandle archive, ZipEntry* entry, uint8_t* begi
   return ExtractToWriter(archive, entry, &writer);
 }
 
+int32_t GetStoredEntryView(ZipArchiveHandle archive, const ZipEntry* entry,
+                           std::string_view* view) {
+  if (entry->method != kCompressStored) {
+    ALOGW("Zip: entry is compressed (method %" PRIu16 "), no view available", entry->method);
+    return kInvalidHandle;
+  }
+  if (archive->mapped_zip.HasFd()) {
+    ALOGW("Zip: archive is not memory backed, no view available");
+    return kInvalidHandle;
+  }
+
+  const uint8_t* data = archive->mapped_zip.AccessAtOffset(entry->uncompressed_length,
+                                                           entry->offset);
+  if (data == nullptr) {
+    return kInvalidOffset;
+  }
+  *view = std::string_view(reinterpret_cast<const char*>(data), entry->uncompressed_length);
+  return 0;
+}
+
 int32_t ExtractEntryToFile(ZipArchiveHandle archive, ZipEntry* entry, int fd) {
   auto writer = FileWriter::Create(fd, entry);
   if (!writer.IsValid()) {
@@ -1176,6 +1368,68 @@ int32_t ProcessZipEntryContents(ZipArchiveHandle archive, ZipEntry* entry,
   return ExtractToWriter(archive, entry, &writer);
 }
 
+int32_t ExtractEntriesToFiles(ZipArchiveHandle archive, const std::vector<std::string>& names,
+                              size_t num_threads, const OpenEntryFileFunction& open_fn,
+                              std::string* failed_name) {
+  // Find every entry first so that a missing one fails before anything is
+  // written, and so that the work can be ordered largest first.
+  std::vector<ZipEntry> entries(names.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    int32_t result = FindEntry(archive, names[i], &entries[i]);
+    if (result != 0) {
+      if (failed_name != nullptr) *failed_name = names[i];
+      return result;
+    }
+  }
+
+  std::vector<size_t> order(names.size());
+  for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&entries](size_t lhs, size_t rhs) {
+    return entries[lhs].compressed_length > entries[rhs].compressed_length;
+  });
+
+  // FindEntry and ExtractToWriter only read the archive through pread or the
+  // mapped memory, so the workers can share the handle.
+  std::atomic<size_t> next_index{0};
+  std::atomic<bool> failed{false};
+  std::atomic<int32_t> first_error{0};
+  std::atomic<size_t> failed_index{0};
+  auto worker = [&]() {
+    size_t i;
+    while (!failed.load(std::memory_order_relaxed) &&
+           (i = next_index.fetch_add(1, std::memory_order_relaxed)) < order.size()) {
+      const size_t index = order[i];
+      ZipEntry* entry = &entries[index];
+      int fd = open_fn(*entry, names[index]);
+      if (fd == -1) continue;
+
+      int32_t result = ExtractEntryToFile(archive, entry, fd);
+      close(fd);
+      if (result != 0 && !failed.exchange(true)) {
+        first_error = result;
+        failed_index = index;
+      }
+    }
+  };
+
+  num_threads = std::clamp<size_t>(num_threads, 1, std::max<size_t>(order.size(), 1));
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  if (failed) {
+    if (failed_name != nullptr) *failed_name = names[failed_index];
+    return first_error;
+  }
+  return 0;
+}
+
 #endif  //! defined(_WIN32)
 
 int MappedZipFile::GetFileDescriptor() const {
@@ -1261,6 +1515,18 @@ bool MappedZipFile::ReadAtOffset(uint8_t* buf, size_t len, off64_t off) const {
   return true;
 }
 
+const uint8_t* MappedZipFile::AccessAtOffset(size_t len, off64_t off) const {
+  if (has_fd_ || base_ptr_ == nullptr) {
+    return nullptr;
+  }
+  if (off < 0 || off > data_length_ || len > static_cast<size_t>(data_length_ - off)) {
+    ALOGE("Zip: invalid offset: %" PRId64 ", length: %zu, data length: %" PRId64, off, len,
+          data_length_);
+    return nullptr;
+  }
+  return static_cast<const uint8_t*>(base_ptr_) + off;
+}
+
 void CentralDirectory::Initialize(const void* map_base_ptr, off64_t cd_start_offset,
                                   size_t cd_size) {
   base_ptr_ = static_cast<const uint8_t*>(map_base_ptr) + cd_start_offset;
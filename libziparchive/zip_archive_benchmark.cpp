@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
+
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -37,9 +39,8 @@ static std::unique_ptr<TemporaryFile> CreateZip(int size = 4, int count = 1000)
     // Make file names longer and longer.
     lastName = lastName + std::to_string(i);
     writer.StartEntry(lastName.c_str(), ZipWriter::kCompress);
-    while (size > 0) {
+    for (int remaining = size; remaining > 0; remaining -= 4) {
       writer.WriteBytes("helo", 4);
-      size -= 4;
     }
     writer.FinishEntry();
   }
@@ -86,6 +87,41 @@ static void Iterate_all_files(benchmark::State& state) {
 }
 BENCHMARK(Iterate_all_files);
 
+static void Iterate_prefix(benchmark::State& state) {
+  // An APK-like layout: many resources and a handful of native libraries.
+  TemporaryFile temp_file;
+  FILE* fp = fdopen(temp_file.fd, "w");
+  ZipWriter writer(fp);
+  for (int i = 0; i < 50000; i++) {
+    writer.StartEntry("res/drawable-xxhdpi-v4/image" + std::to_string(i) + ".png", 0);
+    writer.FinishEntry();
+  }
+  for (int i = 0; i < 16; i++) {
+    writer.StartEntry("lib/arm64-v8a/lib" + std::to_string(i) + ".so", 0);
+    writer.FinishEntry();
+  }
+  writer.Finish();
+  fclose(fp);
+
+  ZipArchiveHandle handle;
+  if (OpenArchive(temp_file.path, &handle)) {
+    state.SkipWithError("Failed to open archive");
+    return;
+  }
+
+  void* iteration_cookie;
+  ZipEntry data;
+  std::string_view name;
+  for (auto _ : state) {
+    StartIteration(handle, &iteration_cookie, "lib/arm64-v8a/");
+    while (Next(iteration_cookie, &data, &name) == 0) {
+    }
+    EndIteration(iteration_cookie);
+  }
+  CloseArchive(handle);
+}
+BENCHMARK(Iterate_prefix);
+
 static void StartAlignedEntry(benchmark::State& state) {
   TemporaryFile file;
   FILE* fp = fdopen(file.fd, "w");
@@ -108,6 +144,27 @@ static void StartAlignedEntry(benchmark::State& state) {
 }
 BENCHMARK(StartAlignedEntry)->Arg(2)->Arg(16)->Arg(1024)->Arg(4096);
 
+static void CompressEntry_threads(benchmark::State& state) {
+  std::string data;
+  for (size_t i = 0; data.size() < 16 * 1024 * 1024; i++) {
+    data += "line " + std::to_string(i % 9973) + " of the file\n";
+  }
+
+  for (auto _ : state) {
+    TemporaryFile file;
+    FILE* fp = fdopen(file.fd, "w");
+    ZipWriter writer(fp);
+    writer.SetCompressionThreads(state.range(0));
+    writer.StartEntry("data.txt", ZipWriter::kCompress);
+    writer.WriteBytes(data.data(), data.size());
+    writer.FinishEntry();
+    writer.Finish();
+    fclose(fp);
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(CompressEntry_threads)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
 static void ExtractEntry(benchmark::State& state) {
   std::unique_ptr<TemporaryFile> temp_file(CreateZip(1024 * 1024, 1));
 
@@ -132,4 +189,42 @@ static void ExtractEntry(benchmark::State& state) {
 
 BENCHMARK(ExtractEntry)->Arg(2)->Arg(16)->Arg(1024);
 
+static void ExtractEntriesToFiles_threads(benchmark::State& state) {
+  // 64 entries of 1MiB each, roughly the shape of an APK's native libraries.
+  std::unique_ptr<TemporaryFile> temp_file(CreateZip(1024 * 1024, 64));
+
+  ZipArchiveHandle handle;
+  if (OpenArchive(temp_file->path, &handle)) {
+    state.SkipWithError("Failed to open archive");
+    return;
+  }
+
+  std::vector<std::string> names;
+  void* iteration_cookie;
+  StartIteration(handle, &iteration_cookie);
+  ZipEntry data;
+  std::string name;
+  while (Next(iteration_cookie, &data, &name) == 0) {
+    names.push_back(name);
+  }
+  EndIteration(iteration_cookie);
+
+  TemporaryDir temp_dir;
+  auto open_fn = [&temp_dir](const ZipEntry&, const std::string& name) {
+    // The names grow by at least one character per entry, so their lengths are unique.
+    std::string path = std::string(temp_dir.path) + "/" + std::to_string(name.size());
+    return open(path.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0600);
+  };
+
+  for (auto _ : state) {
+    if (ExtractEntriesToFiles(handle, names, state.range(0), open_fn)) {
+      state.SkipWithError("Failed to extract archive entries");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * names.size() * 1024 * 1024);
+  CloseArchive(handle);
+}
+BENCHMARK(ExtractEntriesToFiles_threads)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->UseRealTime();
+
 BENCHMARK_MAIN();
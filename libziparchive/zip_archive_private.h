@@ -23,6 +23,7 @@
 #include <unistd.h>
 
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include "android-base/macros.h"
@@ -118,6 +119,11 @@ class MappedZipFile {
 
   bool ReadAtOffset(uint8_t* buf, size_t len, off64_t off) const;
 
+  // Returns a pointer to |len| bytes at |off| if the archive is backed by
+  // memory, or nullptr if it is backed by a file descriptor or the range is
+  // out of bounds.
+  const uint8_t* AccessAtOffset(size_t len, off64_t off) const;
+
  private:
   // If has_fd_ is true, fd is valid and we'll read contents of a zip archive
   // from the file. Otherwise, we're opening the archive from a memory mapped
@@ -157,10 +163,14 @@ class CentralDirectory {
  *
  * ZipStringOffset stores a 4 byte offset from a fixed location in the memory
  * mapped file instead of the entire address, consuming 8 bytes with alignment.
+ * The 2 bytes that alignment would otherwise waste hold the top bits of the
+ * name's hash, so that most mismatches while probing the hash table are
+ * rejected without touching the name itself.
  */
 struct ZipStringOffset {
   uint32_t name_offset;
   uint16_t name_length;
+  uint16_t hash_tag;
 
   const std::string_view ToStringView(const uint8_t* start) const {
     return std::string_view{reinterpret_cast<const char*>(start + name_offset), name_length};
@@ -187,6 +197,13 @@ struct ZipArchive {
   uint32_t hash_table_size;
   ZipStringOffset* hash_table;
 
+  // Indexes of the occupied hash_table slots, ordered by entry name, so that
+  // iterating with a prefix only visits the matching entries. Built on the
+  // first such iteration; guarded by sorted_index_lock until then.
+  std::vector<uint32_t> sorted_index;
+  bool sorted_index_built;
+  std::mutex sorted_index_lock;
+
   ZipArchive(MappedZipFile&& map, bool assume_ownership);
   ZipArchive(const void* address, size_t length);
   ~ZipArchive();
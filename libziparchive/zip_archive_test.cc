@@ -23,16 +23,19 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/mapped_file.h>
+#include <android-base/strings.h>
 #include <android-base/unique_fd.h>
 #include <gtest/gtest.h>
 #include <ziparchive/zip_archive.h>
 #include <ziparchive/zip_archive_stream_entry.h>
+#include <ziparchive/zip_writer.h>
 
 static std::string test_data_dir = android::base::GetExecutableDirectory() + "/testdata";
 
@@ -222,6 +225,54 @@ TEST(ziparchive, IterationWithBadPrefixAndSuffix) {
   CloseArchive(handle);
 }
 
+TEST(ziparchive, IterationWithPrefixIndex) {
+  // Names chosen so that entries sharing a prefix are interleaved in the hash
+  // table with entries that sort just before or after the prefix.
+  std::vector<std::string> all_names{"lib/", "lib", "lia", "lib0", "lib/arm64-v8a/libfoo.so",
+                                     "lib/x86/libfoo.so", "lib/x86/libbar.so", "libz", "res/a.xml",
+                                     "res/b.png", "resources.arsc"};
+  for (int i = 0; i < 200; ++i) all_names.push_back("res/drawable/" + std::to_string(i) + ".png");
+
+  TemporaryFile tmp_file;
+  FILE* fp = fdopen(dup(tmp_file.fd), "w");
+  ZipWriter writer(fp);
+  for (const auto& name : all_names) {
+    ASSERT_EQ(0, writer.StartEntry(name, 0));
+    ASSERT_EQ(0, writer.FinishEntry());
+  }
+  ASSERT_EQ(0, writer.Finish());
+  ASSERT_EQ(0, fclose(fp));
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(tmp_file.fd, "IterationWithPrefixIndex", &handle, false));
+
+  for (const std::string_view prefix : {"lib", "lib/", "lib/x86/", "res/", "res/drawable/1", "z"}) {
+    for (const std::string_view suffix : {"", ".so", ".png"}) {
+      std::vector<std::string> expected;
+      for (const auto& name : all_names) {
+        if (android::base::StartsWith(name, prefix) && android::base::EndsWith(name, suffix)) {
+          expected.push_back(name);
+        }
+      }
+      std::sort(expected.begin(), expected.end());
+
+      void* cookie;
+      ASSERT_EQ(0, StartIteration(handle, &cookie, prefix, suffix));
+      // Iterate twice, since reaching the end restarts the iteration.
+      for (int pass = 0; pass < 2; ++pass) {
+        std::vector<std::string> names;
+        ZipEntry data;
+        std::string name;
+        while (Next(cookie, &data, &name) == 0) names.push_back(name);
+        ASSERT_EQ(expected, names) << prefix << " " << suffix;
+      }
+      EndIteration(cookie);
+    }
+  }
+
+  CloseArchive(handle);
+}
+
 TEST(ziparchive, FindEntry) {
   ZipArchiveHandle handle;
   ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
@@ -514,6 +565,104 @@ TEST(ziparchive, OpenFromMemory) {
   ASSERT_NE(-1, tmp_binary.fd);
   ASSERT_EQ(0, ExtractEntryToFile(handle, &binary_entry, tmp_binary.fd));
 }
+
+TEST(ziparchive, ExtractToMemoryFromMemory) {
+  std::string zip_contents;
+  ASSERT_TRUE(android::base::ReadFileToString(test_data_dir + "/" + kValidZip, &zip_contents));
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFromMemory(zip_contents.data(), zip_contents.size(), kValidZip.c_str(),
+                                     &handle));
+
+  // An entry that's deflated is inflated straight from the mapping into the buffer.
+  ZipEntry data;
+  ASSERT_EQ(0, FindEntry(handle, "a.txt", &data));
+  std::vector<uint8_t> buffer(data.uncompressed_length);
+  ASSERT_EQ(0, ExtractToMemory(handle, &data, buffer.data(), data.uncompressed_length));
+  ASSERT_EQ(kATxtContents, buffer);
+
+  // A buffer of the wrong size is still rejected.
+  std::vector<uint8_t> short_buffer(data.uncompressed_length - 1);
+  ASSERT_NE(0, ExtractToMemory(handle, &data, short_buffer.data(),
+                               data.uncompressed_length - 1));
+
+  // An entry that's stored is copied straight from the mapping.
+  ASSERT_EQ(0, FindEntry(handle, "b.txt", &data));
+  buffer.resize(data.uncompressed_length);
+  ASSERT_EQ(0, ExtractToMemory(handle, &data, buffer.data(), data.uncompressed_length));
+  ASSERT_EQ(kBTxtContents, buffer);
+
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, GetStoredEntryView) {
+  std::string zip_contents;
+  ASSERT_TRUE(android::base::ReadFileToString(test_data_dir + "/" + kValidZip, &zip_contents));
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFromMemory(zip_contents.data(), zip_contents.size(), kValidZip.c_str(),
+                                     &handle));
+
+  ZipEntry data;
+  std::string_view view;
+  ASSERT_EQ(0, FindEntry(handle, "b.txt", &data));
+  ASSERT_EQ(0, GetStoredEntryView(handle, &data, &view));
+  ASSERT_EQ(std::string(kBTxtContents.begin(), kBTxtContents.end()), view);
+
+  // Compressed entries have no view.
+  ASSERT_EQ(0, FindEntry(handle, "a.txt", &data));
+  ASSERT_NE(0, GetStoredEntryView(handle, &data, &view));
+  CloseArchive(handle);
+
+  // Neither do archives backed by a file descriptor.
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+  ASSERT_EQ(0, FindEntry(handle, "b.txt", &data));
+  ASSERT_NE(0, GetStoredEntryView(handle, &data, &view));
+  CloseArchive(handle);
+}
+
+TEST(ziparchive, ExtractEntriesToFiles) {
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveWrapper(kValidZip, &handle));
+
+  TemporaryDir tmp_dir;
+  const std::vector<std::string> names{"a.txt", "b.txt", "b/", "b/c.txt", "b/d.txt"};
+  auto open_fn = [&tmp_dir](const ZipEntry&, const std::string& name) {
+    if (name.back() == '/') return -1;
+    std::string path = std::string(tmp_dir.path) + "/" + name;
+    std::replace(path.begin() + strlen(tmp_dir.path) + 1, path.end(), '/', '_');
+    return open(path.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC | O_BINARY, 0600);
+  };
+  ASSERT_EQ(0, ExtractEntriesToFiles(handle, names, 4, open_fn));
+
+  for (const auto& name : names) {
+    if (name.back() == '/') continue;
+    ZipEntry data;
+    ASSERT_EQ(0, FindEntry(handle, name, &data));
+    std::vector<uint8_t> expected(data.uncompressed_length);
+    ASSERT_EQ(0, ExtractToMemory(handle, &data, expected.data(),
+                                 static_cast<uint32_t>(expected.size())));
+
+    std::string flat_name(name);
+    std::replace(flat_name.begin(), flat_name.end(), '/', '_');
+    std::string contents;
+    ASSERT_TRUE(
+        android::base::ReadFileToString(std::string(tmp_dir.path) + "/" + flat_name, &contents));
+    ASSERT_EQ(std::string(expected.begin(), expected.end()), contents);
+  }
+
+  // A missing entry fails before anything is opened.
+  std::string failed_name;
+  bool opened = false;
+  auto never_open = [&opened](const ZipEntry&, const std::string&) {
+    opened = true;
+    return -1;
+  };
+  ASSERT_EQ(kEntryNotFound, ExtractEntriesToFiles(handle, {"a.txt", "missing.txt"}, 2, never_open,
+                                                  &failed_name));
+  ASSERT_EQ("missing.txt", failed_name);
+  ASSERT_FALSE(opened);
+
+  CloseArchive(handle);
+}
 #endif
 
 static void ZipArchiveStreamTest(ZipArchiveHandle& handle, const std::string& entry_name, bool raw,
@@ -22,7 +22,14 @@
 #include <cstdio>
 #define DEF_MEM_LEVEL 8  // normally in zutil.h?
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "android-base/logging.h"
@@ -84,6 +91,252 @@ static void DeleteZStream(z_stream* stream) {
   delete stream;
 }
 
+static int InitRawDeflate(z_stream* stream) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+  return deflateInit2(stream, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS, DEF_MEM_LEVEL,
+                      Z_DEFAULT_STRATEGY);
+#pragma GCC diagnostic pop
+}
+
+// Deflates entry data as a sequence of independently compressed blocks on a
+// pool of threads, in the manner of pigz. Every block but the last ends with a
+// sync flush, so the blocks concatenate into a single raw deflate stream, and
+// every block but the first is primed with the last 32KiB of the previous
+// block's input so that matches can still reach back across the boundary.
+// All methods are called on the writer's thread.
+class ZipWriter::ParallelDeflater {
+ public:
+  explicit ParallelDeflater(size_t num_threads) : max_in_flight_(2 * num_threads) {
+    for (size_t i = 0; i < num_threads; ++i) {
+      threads_.emplace_back([this]() { WorkerLoop(); });
+    }
+  }
+
+  ~ParallelDeflater() {
+    Reset();
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      stopping_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // Prepares for the data of a new entry.
+  void StartEntry() {
+    Reset();
+    dictionary_.clear();
+  }
+
+  // Adds entry data, writing out blocks in order as they are compressed.
+  int32_t Write(ZipWriter* writer, FileEntry* file, const uint8_t* data, size_t len) {
+    while (len > 0) {
+      if (!current_) NewBlock();
+      size_t n = std::min(len, kParallelBlockSize - current_->input.size());
+      current_->input.insert(current_->input.end(), data, data + n);
+      data += n;
+      len -= n;
+      if (current_->input.size() == kParallelBlockSize) {
+        Submit(false);
+        int32_t result = Drain(writer, file, max_in_flight_);
+        if (result != kNoError) return result;
+      }
+    }
+    return kNoError;
+  }
+
+  // Compresses whatever is left of the entry and writes out all its blocks.
+  int32_t Finish(ZipWriter* writer, FileEntry* file) {
+    // The last block may be empty; it still carries the end of the stream.
+    if (!current_) NewBlock();
+    Submit(true);
+    return Drain(writer, file, 0);
+  }
+
+  // Waits for any outstanding blocks and drops them.
+  void Reset() {
+    std::unique_lock<std::mutex> lock(lock_);
+    for (auto& block : in_flight_) {
+      done_cv_.wait(lock, [&block]() { return block->done; });
+    }
+    in_flight_.clear();
+    current_.reset();
+  }
+
+ private:
+  struct Block {
+    std::vector<uint8_t> dictionary;
+    std::vector<uint8_t> input;
+    bool last = false;
+
+    // Set by the worker thread under lock_.
+    std::vector<uint8_t> output;
+    bool done = false;
+    bool ok = false;
+  };
+
+  void NewBlock() {
+    current_ = std::make_unique<Block>();
+    current_->dictionary = dictionary_;
+    current_->input.reserve(kParallelBlockSize);
+  }
+
+  void Submit(bool last) {
+    static constexpr size_t kDictionarySize = 32 * 1024;
+    const std::vector<uint8_t>& input = current_->input;
+    size_t dictionary_size = std::min(input.size(), kDictionarySize);
+    dictionary_.assign(input.end() - dictionary_size, input.end());
+
+    current_->last = last;
+    {
+      std::lock_guard<std::mutex> lock(lock_);
+      queue_.push_back(current_.get());
+    }
+    work_cv_.notify_one();
+    in_flight_.push_back(std::move(current_));
+  }
+
+  // Writes out finished blocks in order, waiting for the oldest ones until no
+  // more than |max_in_flight| remain.
+  int32_t Drain(ZipWriter* writer, FileEntry* file, size_t max_in_flight) {
+    while (!in_flight_.empty()) {
+      Block* block = in_flight_.front().get();
+      {
+        std::unique_lock<std::mutex> lock(lock_);
+        if (in_flight_.size() > max_in_flight) {
+          done_cv_.wait(lock, [block]() { return block->done; });
+        } else if (!block->done) {
+          break;
+        }
+      }
+      if (!block->ok) {
+        LOG(ERROR) << "deflate of parallel block failed";
+        return writer->HandleError(kZlibError);
+      }
+      int32_t result = writer->WriteCompressedBlock(file, block->output);
+      if (result != kNoError) return result;
+      in_flight_.pop_front();
+    }
+    return kNoError;
+  }
+
+  void WorkerLoop() {
+    std::unique_ptr<z_stream, void (*)(z_stream*)> stream(new z_stream(), DeleteZStream);
+    int init_result = InitRawDeflate(stream.get());
+
+    std::unique_lock<std::mutex> lock(lock_);
+    while (true) {
+      work_cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+      if (stopping_) return;
+      Block* block = queue_.front();
+      queue_.pop_front();
+      lock.unlock();
+
+      std::vector<uint8_t> output;
+      bool ok = init_result == Z_OK && Compress(stream.get(), *block, &output);
+
+      lock.lock();
+      block->output = std::move(output);
+      block->ok = ok;
+      block->done = true;
+      done_cv_.notify_all();
+    }
+  }
+
+  static bool Compress(z_stream* stream, const Block& block, std::vector<uint8_t>* output) {
+    if (deflateReset(stream) != Z_OK) return false;
+    if (!block.dictionary.empty() &&
+        deflateSetDictionary(stream, block.dictionary.data(),
+                             static_cast<uInt>(block.dictionary.size())) != Z_OK) {
+      return false;
+    }
+
+    // deflateBound doesn't count the empty stored block that ends a sync flush.
+    output->resize(deflateBound(stream, static_cast<uLong>(block.input.size())) + 16);
+    stream->next_in = block.input.data();
+    stream->avail_in = static_cast<uInt>(block.input.size());
+    stream->next_out = output->data();
+    stream->avail_out = static_cast<uInt>(output->size());
+
+    int zerr = deflate(stream, block.last ? Z_FINISH : Z_SYNC_FLUSH);
+    bool ok = block.last ? zerr == Z_STREAM_END
+                         : (zerr == Z_OK && stream->avail_in == 0 && stream->avail_out != 0);
+    output->resize(output->size() - stream->avail_out);
+    return ok;
+  }
+
+  const size_t max_in_flight_;
+  std::vector<std::thread> threads_;
+
+  std::mutex lock_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  std::deque<Block*> queue_;
+  bool stopping_ = false;
+
+  // Blocks handed to the workers, oldest first, and the one being filled.
+  std::deque<std::unique_ptr<Block>> in_flight_;
+  std::unique_ptr<Block> current_;
+  std::vector<uint8_t> dictionary_;
+};
+
+// Holds a T for each writer that has one. ZipWriter's layout is part of libziparchive's ABI, so
+// state added for optional features lives here, keyed by writer, instead of in members. Writers
+// that never use such a feature only pay for an atomic load. ~ZipWriter and the move operations,
+// which are all out of line, keep the entries in step with the writers.
+template <typename T>
+class PerWriterState {
+ public:
+  T* Get(const ZipWriter* writer) {
+    if (count_.load(std::memory_order_acquire) == 0) {
+      return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(lock_);
+    auto it = entries_.find(writer);
+    return it == entries_.end() ? nullptr : it->second.get();
+  }
+
+  std::unique_ptr<T> Take(const ZipWriter* writer) {
+    if (count_.load(std::memory_order_acquire) == 0) {
+      return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(lock_);
+    auto it = entries_.find(writer);
+    if (it == entries_.end()) {
+      return nullptr;
+    }
+    std::unique_ptr<T> value = std::move(it->second);
+    entries_.erase(it);
+    count_.store(entries_.size(), std::memory_order_release);
+    return value;
+  }
+
+  // Replaces the writer's entry, or removes it if |value| is null.
+  void Set(const ZipWriter* writer, std::unique_ptr<T> value) {
+    // Destroy the old value outside the lock; a ParallelDeflater joins its threads.
+    std::unique_ptr<T> old_value = Take(writer);
+    if (!value) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(lock_);
+    entries_[writer] = std::move(value);
+    count_.store(entries_.size(), std::memory_order_release);
+  }
+
+  static PerWriterState& Instance() {
+    static PerWriterState* instance = new PerWriterState;
+    return *instance;
+  }
+
+ private:
+  std::mutex lock_;
+  std::unordered_map<const ZipWriter*, std::unique_ptr<T>> entries_;
+  std::atomic<size_t> count_ = 0;
+};
+
 ZipWriter::ZipWriter(FILE* f)
     : file_(f),
       seekable_(false),
@@ -107,6 +360,8 @@ ZipWriter::ZipWriter(ZipWriter&& writer) noexcept
       files_(std::move(writer.files_)),
       z_stream_(std::move(writer.z_stream_)),
       buffer_(std::move(writer.buffer_)) {
+  auto& parallel_deflaters = PerWriterState<ParallelDeflater>::Instance();
+  parallel_deflaters.Set(this, parallel_deflaters.Take(&writer));
   writer.file_ = nullptr;
   writer.state_ = State::kError;
 }
@@ -119,11 +374,32 @@ ZipWriter& ZipWriter::operator=(ZipWriter&& writer) noexcept {
   files_ = std::move(writer.files_);
   z_stream_ = std::move(writer.z_stream_);
   buffer_ = std::move(writer.buffer_);
+  if (this != &writer) {
+    auto& parallel_deflaters = PerWriterState<ParallelDeflater>::Instance();
+    parallel_deflaters.Set(this, parallel_deflaters.Take(&writer));
+  }
   writer.file_ = nullptr;
   writer.state_ = State::kError;
   return *this;
 }
 
+ZipWriter::~ZipWriter() {
+  PerWriterState<ParallelDeflater>::Instance().Set(this, nullptr);
+}
+
+int32_t ZipWriter::SetCompressionThreads(size_t num_threads) {
+  if (state_ != State::kWritingZip) {
+    return kInvalidState;
+  }
+
+  std::unique_ptr<ParallelDeflater> parallel_deflater;
+  if (num_threads > 1) {
+    parallel_deflater = std::make_unique<ParallelDeflater>(num_threads);
+  }
+  PerWriterState<ParallelDeflater>::Instance().Set(this, std::move(parallel_deflater));
+  return kNoError;
+}
+
 int32_t ZipWriter::HandleError(int32_t error_code) {
   state_ = State::kError;
   z_stream_.reset();
@@ -236,9 +512,14 @@ int32_t ZipWriter::StartAlignedEntryWithTime(std::string_view path, size_t flags
   if (flags & ZipWriter::kCompress) {
     file_entry.compression_method = kCompressDeflated;
 
-    int32_t result = PrepareDeflate();
-    if (result != kNoError) {
-      return result;
+    auto parallel_deflater = PerWriterState<ParallelDeflater>::Instance().Get(this);
+    if (parallel_deflater) {
+      parallel_deflater->StartEntry();
+    } else {
+      int32_t result = PrepareDeflate();
+      if (result != kNoError) {
+        return result;
+      }
     }
   } else {
     file_entry.compression_method = kCompressStored;
@@ -321,11 +602,7 @@ int32_t ZipWriter::PrepareDeflate() {
   // Initialize the z_stream for compression.
   z_stream_ = std::unique_ptr<z_stream, void (*)(z_stream*)>(new z_stream(), DeleteZStream);
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wold-style-cast"
-  int zerr = deflateInit2(z_stream_.get(), Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
-                          DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY);
-#pragma GCC diagnostic pop
+  int zerr = InitRawDeflate(z_stream_.get());
 
   if (zerr != Z_OK) {
     if (zerr == Z_VERSION_ERROR) {
@@ -384,6 +661,10 @@ int32_t ZipWriter::StoreBytes(FileEntry* file, const void* data, uint32_t len) {
 
 int32_t ZipWriter::CompressBytes(FileEntry* file, const void* data, uint32_t len) {
   CHECK(state_ == State::kWritingEntry);
+  auto parallel_deflater = PerWriterState<ParallelDeflater>::Instance().Get(this);
+  if (parallel_deflater) {
+    return parallel_deflater->Write(this, file, reinterpret_cast<const uint8_t*>(data), len);
+  }
   CHECK(z_stream_);
   CHECK(z_stream_->next_out != nullptr);
   CHECK(z_stream_->avail_out != 0);
@@ -419,6 +700,10 @@ int32_t ZipWriter::CompressBytes(FileEntry* file, const void* data, uint32_t len
 
 int32_t ZipWriter::FlushCompressedBytes(FileEntry* file) {
   CHECK(state_ == State::kWritingEntry);
+  auto parallel_deflater = PerWriterState<ParallelDeflater>::Instance().Get(this);
+  if (parallel_deflater) {
+    return parallel_deflater->Finish(this, file);
+  }
   CHECK(z_stream_);
   CHECK(z_stream_->next_out != nullptr);
   CHECK(z_stream_->avail_out != 0);
@@ -455,6 +740,15 @@ int32_t ZipWriter::FlushCompressedBytes(FileEntry* file) {
   return kNoError;
 }
 
+int32_t ZipWriter::WriteCompressedBlock(FileEntry* file, const std::vector<uint8_t>& data) {
+  if (fwrite(data.data(), 1, data.size(), file_) != data.size()) {
+    return HandleError(kIoError);
+  }
+  file->compressed_size += data.size();
+  current_offset_ += data.size();
+  return kNoError;
+}
+
 bool ZipWriter::ShouldUseDataDescriptor() const {
   // Only use a trailing "data descriptor" if the output isn't seekable.
   return !seekable_;
@@ -288,6 +288,64 @@ TEST_F(zipwriter, WriteCompressedZipFlushFull) {
   CloseArchive(handle);
 }
 
+TEST_F(zipwriter, WriteCompressedZipInParallel) {
+  // Compressible but not trivially so, so that blocks reference earlier ones.
+  std::string large;
+  for (size_t i = 0; large.size() < 5 * ZipWriter::kParallelBlockSize + 123; i++) {
+    large += "line " + std::to_string(i % 997) + " of the file\n";
+  }
+  const std::string exact(ZipWriter::kParallelBlockSize, 'x');
+
+  ZipWriter writer(file_);
+  ASSERT_EQ(0, writer.SetCompressionThreads(4));
+
+  ASSERT_EQ(0, writer.StartEntry("empty.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.FinishEntry());
+
+  ASSERT_EQ(0, writer.StartEntry("small.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.WriteBytes("helo", 4));
+  ASSERT_EQ(0, writer.FinishEntry());
+
+  ASSERT_EQ(0, writer.StartEntry("exact.txt", ZipWriter::kCompress));
+  ASSERT_EQ(0, writer.WriteBytes(exact.data(), exact.size()));
+  ASSERT_EQ(0, writer.FinishEntry());
+
+  // Write in chunks that straddle the block boundaries.
+  ASSERT_EQ(0, writer.StartEntry("large.txt", ZipWriter::kCompress));
+  for (size_t offset = 0; offset < large.size(); offset += 10007) {
+    size_t len = std::min<size_t>(10007, large.size() - offset);
+    ASSERT_EQ(0, writer.WriteBytes(large.data() + offset, len));
+  }
+  ASSERT_EQ(0, writer.FinishEntry());
+
+  ASSERT_EQ(0, writer.StartAlignedEntry("aligned.txt", ZipWriter::kCompress, 4096));
+  ASSERT_EQ(0, writer.WriteBytes(large.data(), large.size()));
+  ASSERT_EQ(0, writer.FinishEntry());
+  ASSERT_EQ(0, writer.Finish());
+
+  ASSERT_GE(0, lseek(fd_, 0, SEEK_SET));
+
+  ZipArchiveHandle handle;
+  ASSERT_EQ(0, OpenArchiveFd(fd_, "temp", &handle, false));
+
+  ZipEntry data;
+  ASSERT_EQ(0, FindEntry(handle, "empty.txt", &data));
+  ASSERT_TRUE(AssertFileEntryContentsEq("", handle, &data));
+  ASSERT_EQ(0, FindEntry(handle, "small.txt", &data));
+  ASSERT_TRUE(AssertFileEntryContentsEq("helo", handle, &data));
+  ASSERT_EQ(0, FindEntry(handle, "exact.txt", &data));
+  ASSERT_TRUE(AssertFileEntryContentsEq(exact, handle, &data));
+  ASSERT_EQ(0, FindEntry(handle, "large.txt", &data));
+  EXPECT_EQ(kCompressDeflated, data.method);
+  EXPECT_LT(data.compressed_length, large.size() / 4);
+  ASSERT_TRUE(AssertFileEntryContentsEq(large, handle, &data));
+  ASSERT_EQ(0, FindEntry(handle, "aligned.txt", &data));
+  EXPECT_EQ(0, data.offset & 0xfff);
+  ASSERT_TRUE(AssertFileEntryContentsEq(large, handle, &data));
+
+  CloseArchive(handle);
+}
+
 TEST_F(zipwriter, CheckStartEntryErrors) {
   ZipWriter writer(file_);
 
@@ -28,10 +28,13 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <mutex>
 #include <set>
 #include <string>
+#include <vector>
 
 #include <android-base/file.h>
+#include <android-base/parseint.h>
 #include <android-base/strings.h>
 #include <ziparchive/zip_archive.h>
 
@@ -53,6 +56,7 @@ static Role role;
 static OverwriteMode overwrite_mode = kPrompt;
 static bool flag_1 = false;
 static std::string flag_d;
+static size_t flag_j = 1;
 static bool flag_l = false;
 static bool flag_p = false;
 static bool flag_q = false;
@@ -105,8 +109,15 @@ static bool MakeDirectoryHierarchy(const std::string& path) {
   // Ensure the parent directories exist first.
   if (!MakeDirectoryHierarchy(android::base::Dirname(path))) return false;
 
-  // Then try to create this directory.
-  return (mkdir(path.c_str(), 0777) != -1);
+  // Then try to create this directory. With -j another thread may beat us to it,
+  // but something other than a directory at this path is still an error.
+  if (mkdir(path.c_str(), 0777) != -1) return true;
+  if (errno != EEXIST) return false;
+  if (stat(path.c_str(), &sb) == -1 || !S_ISDIR(sb.st_mode)) {
+    errno = EEXIST;
+    return false;
+  }
+  return true;
 }
 
 static float CompressionRatio(int64_t uncompressed, int64_t compressed) {
@@ -207,7 +218,11 @@ static void ExtractToPipe(ZipArchiveHandle zah, ZipEntry& entry, const std::stri
   delete[] buffer;
 }
 
-static void ExtractOne(ZipArchiveHandle zah, ZipEntry& entry, const std::string& name) {
+// Serializes the prompt (and the overwrite_mode it may change) between -j threads.
+static std::mutex prompt_lock;
+
+// Creates the file for |name|, returning -1 if it shouldn't be extracted.
+static int OpenOne(const ZipEntry& entry, const std::string& name) {
   // Bad filename?
   if (StartsWith(name, "/") || StartsWith(name, "../") || name.find("/../") != std::string::npos) {
     die(0, "bad filename %s", name.c_str());
@@ -229,30 +244,46 @@ static void ExtractOne(ZipArchiveHandle zah, ZipEntry& entry, const std::string&
       // If the directory already exists, that's fine.
       if (errno == EEXIST) {
         struct stat sb;
-        if (stat(name.c_str(), &sb) != -1 && S_ISDIR(sb.st_mode)) return;
+        if (stat(name.c_str(), &sb) != -1 && S_ISDIR(sb.st_mode)) return -1;
       }
       die(errno, "couldn't extract directory %s", dst.c_str());
     }
-    return;
+    return -1;
   }
 
   // Create the file.
   int fd = open(name.c_str(), O_CREAT | O_WRONLY | O_CLOEXEC | O_EXCL, entry.unix_mode);
   if (fd == -1 && errno == EEXIST) {
-    if (overwrite_mode == kNever) return;
-    if (overwrite_mode == kPrompt && !PromptOverwrite(dst)) return;
+    std::lock_guard<std::mutex> lock(prompt_lock);
+    if (overwrite_mode == kNever) return -1;
+    if (overwrite_mode == kPrompt && !PromptOverwrite(dst)) return -1;
     // Either overwrite_mode is kAlways or the user consented to this specific case.
     fd = open(name.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | O_TRUNC, entry.unix_mode);
   }
   if (fd == -1) die(errno, "couldn't create file %s", dst.c_str());
 
-  // Actually extract into the file.
   if (!flag_q) printf("  inflating: %s\n", dst.c_str());
+  return fd;
+}
+
+static void ExtractOne(ZipArchiveHandle zah, ZipEntry& entry, const std::string& name) {
+  int fd = OpenOne(entry, name);
+  if (fd == -1) return;
+
+  // Actually extract into the file.
   int err = ExtractEntryToFile(zah, &entry, fd);
-  if (err < 0) die(0, "failed to extract %s: %s", dst.c_str(), ErrorCodeString(err));
+  if (err < 0) die(0, "failed to extract %s: %s", (flag_d + name).c_str(), ErrorCodeString(err));
   close(fd);
 }
 
+static void ExtractAll(ZipArchiveHandle zah, const std::vector<std::string>& names) {
+  std::string failed_name;
+  int err = ExtractEntriesToFiles(zah, names, flag_j, OpenOne, &failed_name);
+  if (err < 0) {
+    die(0, "failed to extract %s: %s", (flag_d + failed_name).c_str(), ErrorCodeString(err));
+  }
+}
+
 static void ListOne(const ZipEntry& entry, const std::string& name) {
   tm t = entry.GetModificationTime();
   char time[32];
@@ -328,8 +359,16 @@ static void InfoOne(const ZipEntry& entry, const std::string& name) {
          entry.has_data_descriptor ? 'X' : 'x', method, time, name.c_str());
 }
 
-static void ProcessOne(ZipArchiveHandle zah, ZipEntry& entry, const std::string& name) {
-  if (role == kUnzip) {
+// Whether -j should hand the extraction to ExtractAll rather than ProcessOne.
+static bool ExtractInParallel() {
+  return role == kUnzip && flag_j > 1 && !flag_l && !flag_v && !flag_p;
+}
+
+static void ProcessOne(ZipArchiveHandle zah, ZipEntry& entry, const std::string& name,
+                       std::vector<std::string>* deferred) {
+  if (deferred != nullptr) {
+    deferred->push_back(name);
+  } else if (role == kUnzip) {
     if (flag_l || flag_v) {
       // -l or -lv or -lq or -v.
       ListOne(entry, name);
@@ -361,21 +400,27 @@ static void ProcessAll(ZipArchiveHandle zah) {
     die(0, "couldn't iterate %s: %s", archive_name, ErrorCodeString(err));
   }
 
+  // With -j we collect the names first and extract them all at once.
+  std::vector<std::string> names;
+  std::vector<std::string>* deferred = ExtractInParallel() ? &names : nullptr;
+
   ZipEntry entry;
   std::string name;
   while ((err = Next(cookie, &entry, &name)) >= 0) {
-    if (ShouldInclude(name)) ProcessOne(zah, entry, name);
+    if (ShouldInclude(name)) ProcessOne(zah, entry, name, deferred);
   }
 
   if (err < -1) die(0, "failed iterating %s: %s", archive_name, ErrorCodeString(err));
   EndIteration(cookie);
 
+  if (deferred != nullptr) ExtractAll(zah, names);
+
   MaybeShowFooter();
 }
 
 static void ShowHelp(bool full) {
   if (role == kUnzip) {
-    fprintf(full ? stdout : stderr, "usage: unzip [-d DIR] [-lnopqv] ZIP [FILE...] [-x FILE...]\n");
+    fprintf(full ? stdout : stderr, "usage: unzip [-d DIR] [-j N] [-lnopqv] ZIP [FILE...] [-x FILE...]\n");
     if (!full) exit(EXIT_FAILURE);
 
     printf(
@@ -384,6 +429,7 @@ static void ShowHelp(bool full) {
         "exclude (-x) lists use shell glob patterns.\n"
         "\n"
         "-d DIR	Extract into DIR\n"
+        "-j N	Extract N files at a time (default: 1)\n"
         "-l	List contents (-lq excludes archive name, -lv is verbose)\n"
         "-n	Never overwrite files (default: prompt)\n"
         "-o	Always overwrite files\n"
@@ -456,12 +502,17 @@ int main(int argc, char* argv[]) {
     }
 
     int opt;
-    while ((opt = getopt_long(argc, argv, "-d:hlnopqvx", opts, nullptr)) != -1) {
+    while ((opt = getopt_long(argc, argv, "-d:hj:lnopqvx", opts, nullptr)) != -1) {
       switch (opt) {
         case 'd':
           flag_d = optarg;
           if (!EndsWith(flag_d, "/")) flag_d += '/';
           break;
+        case 'j':
+          if (!android::base::ParseUint(optarg, &flag_j) || flag_j == 0) {
+            die(0, "bad -j argument: %s", optarg);
+          }
+          break;
         case 'l':
           flag_l = true;
           break;
@@ -28,6 +28,7 @@
 #include <sys/cdefs.h>  // ___STRING, __predict_true() and _predict_false()
 #include <sys/mman.h>   // mlockall()
 #include <sys/prctl.h>
+#include <sys/resource.h>  // getrlimit()
 #include <sys/stat.h>     // lstat()
 #include <sys/syscall.h>  // __NR_getdents64
 #include <sys/sysinfo.h>  // get_nprocs_conf()
@@ -48,6 +49,7 @@
 #include <android-base/parseint.h>
 #include <android-base/properties.h>
 #include <android-base/strings.h>
+#include <android-base/unique_fd.h>
 #include <cutils/android_get_control_file.h>
 #include <log/log_main.h>
 
@@ -119,6 +121,14 @@ std::unordered_set<std::string> llkIgnorelistUid;
 // "logd" (if not userdebug).
 std::unordered_set<std::string> llkIgnorelistStack;
 #endif
+size_t llkStatFdMax;                                 // tasks with /proc/<tid>/stat kept open
+
+// Cost of the current check, reported with each sample.
+struct {
+    unsigned tasks;  // tasks visited
+    unsigned opens;  // files opened
+    unsigned reads;  // file reads
+} llkScan;
 
 class dir {
   public:
@@ -226,6 +236,8 @@ bool llkIsMissingExeLink(pid_t tid) {
 // Reduces the churn of reporting read errors in the callers.
 std::string ReadFile(std::string&& path) {
     std::string content;
+    ++llkScan.opens;
+    ++llkScan.reads;
     if (!android::base::ReadFileToString(path, &content)) {
         PLOG(DEBUG) << "Read " << path << " failed";
         content = "";
@@ -306,9 +318,24 @@ struct proc {
     bool updated;                  // cleared before monitoring pass.
     bool killed;                   // sent a kill to this thread, next panic...
     bool frozen;                   // process is in frozen cgroup.
+    android::base::unique_fd statFd;  // /proc/<tid>/stat kept open between checks
 
     void setComm(const char* _comm) { strncpy(comm + 1, _comm, sizeof(comm) - 2); }
 
+    // comm in /proc/<tid>/stat changes on exec, so only then do we drop
+    // the cached cmdline and exe link state to be read again.
+    void updateComm(const char* _comm) {
+        size_t len = strlen(comm + 1);
+        if ((comm[0] == '[') && len && (comm[len] == ']')) --len;  // added by getComm()
+        if ((len == strnlen(_comm, sizeof(comm) - 2)) && !strncmp(comm + 1, _comm, len)) {
+            return;
+        }
+        comm[0] = '\0';
+        setComm(_comm);
+        exeMissingValid = false;
+        cmdlineValid = false;
+    }
+
     void setFrozen(bool _frozen) { frozen = _frozen; }
 
     proc(pid_t tid, pid_t pid, pid_t ppid, const char* _comm, int time, char state, bool frozen)
@@ -605,6 +632,37 @@ proc* llkTidAlloc(pid_t tid, pid_t pid, pid_t ppid, const char* comm, int time,
     return &it.first->second;
 }
 
+// /proc/<tid>/stat is well under 1K, all tasks share this buffer.
+char llkStatBuffer[1024];
+
+// Read /proc/<tid>/stat into llkStatBuffer with a single pread through *fd,
+// opening it first if needed. Returns false if the task is gone. Once its
+// task exits a descriptor reads nothing, while the tid may already belong
+// to a new task found in the scan; then *reopened is set and the new
+// task's stat file is read instead.
+bool llkReadStat(android::base::unique_fd* fd, const std::string& piddir, bool* reopened) {
+    *reopened = false;
+    for (;;) {
+        if (*fd < 0) {
+            ++llkScan.opens;
+            fd->reset(::open((piddir + "/stat").c_str(), O_RDONLY | O_CLOEXEC));
+            if (*fd < 0) {
+                PLOG(DEBUG) << "Open " << piddir << "/stat failed";
+                return false;
+            }
+        }
+        ++llkScan.reads;
+        auto rc = TEMP_FAILURE_RETRY(::pread(*fd, llkStatBuffer, sizeof(llkStatBuffer) - 1, 0));
+        if (rc > 0) {
+            llkStatBuffer[rc] = '\0';
+            return true;
+        }
+        fd->reset();
+        if (*reopened) return false;
+        *reopened = true;
+    }
+}
+
 std::string llkFormat(milliseconds ms) {
     auto sec = duration_cast<seconds>(ms);
     std::ostringstream s;
@@ -973,6 +1031,9 @@ milliseconds llkCheck(bool checkRunning) {
         return llkCycle - ms;
     }
     last = now;
+    timespec cpuStart;
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuStart);
+    llkScan = {};
 
     LOG(VERBOSE) << "opendir(\"" << procdir << "\")";
     if (__predict_false(!llkTopDirectory)) {
@@ -1008,6 +1069,7 @@ milliseconds llkCheck(bool checkRunning) {
         // Get the process tasks
         std::string taskdir = piddir + "/task/";
         int pid = -1;
+        bool frozen = false;
         LOG(VERBOSE) << "+opendir(\"" << taskdir << "\")";
         dir taskDirectory(taskdir);
         if (__predict_false(!taskDirectory)) {
@@ -1019,11 +1081,19 @@ milliseconds llkCheck(bool checkRunning) {
                 continue;
             }
 
-            // Get the process stat
-            std::string stat = ReadFile(piddir + "/stat");
-            if (stat.empty()) {
+            // Get the process stat, through the descriptor kept from the
+            // last check if we have seen this task before.
+            auto procp = llkTidLookup(::atoi(tp->d_name));
+            android::base::unique_fd statFd;
+            auto fd = &statFd;
+            if (procp && ((procp->statFd >= 0) || (tids.size() <= llkStatFdMax))) {
+                fd = &procp->statFd;
+            }
+            bool reopened;
+            if (!llkReadStat(fd, piddir, &reopened)) {
                 continue;
             }
+            ++llkScan.tasks;
             unsigned tid = -1;
             char pdir[TASK_COMM_LEN + 1];
             char state = '?';
@@ -1034,7 +1104,7 @@ milliseconds llkCheck(bool checkRunning) {
             pdir[0] = '\0';
             // tid should not change value
             auto match = ::sscanf(
-                stat.c_str(),
+                llkStatBuffer,
                 "%u (%" ___STRING(
                     TASK_COMM_LEN) "[^)]) %c %u %*d %*d %*d %*d %*d %*d %*d %*d %*d %u %u %d",
                 &tid, pdir, &state, &ppid, &utime, &stime, &dummy);
@@ -1047,16 +1117,24 @@ milliseconds llkCheck(bool checkRunning) {
                 continue;
             }
 
-            // Get the process cgroup
-            auto cgroup = ReadFile(piddir + "/cgroup");
-            auto frozen = cgroup.find(":freezer:/frozen") != std::string::npos;
+            // Get the process cgroup, the freezer applies to all its threads
+            if (pid == static_cast<int>(tid)) {
+                auto cgroup = ReadFile(piddir + "/cgroup");
+                frozen = cgroup.find(":freezer:/frozen") != std::string::npos;
+            }
 
-            auto procp = llkTidLookup(tid);
             if (procp == nullptr) {
                 procp = llkTidAlloc(tid, pid, ppid, pdir, utime + stime, state, frozen);
+                if (tids.size() <= llkStatFdMax) {
+                    procp->statFd = std::move(statFd);
+                }
             } else {
-                // comm can change ...
-                procp->setComm(pdir);
+                // a new task reusing the tid
+                if (reopened) {
+                    procp->reset();
+                }
+                // comm can change, on exec ...
+                procp->updateComm(pdir);
                 // frozen can change, too...
                 procp->setFrozen(frozen);
                 procp->updated = true;
@@ -1259,7 +1337,14 @@ milliseconds llkCheck(bool checkRunning) {
     timespec end;
     ::clock_gettime(CLOCK_MONOTONIC_COARSE, &end);
     auto milli = llkGetTimespecDiffMs(&now, &end);
-    LOG((milli > 10s) ? ERROR : (milli > 1s) ? WARNING : VERBOSE) << "sample " << llkFormat(milli);
+    timespec cpuEnd;
+    ::clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpuEnd);
+    auto cpu = duration_cast<microseconds>(seconds(cpuEnd.tv_sec - cpuStart.tv_sec) +
+                                           nanoseconds(cpuEnd.tv_nsec - cpuStart.tv_nsec));
+    LOG((milli > 10s) ? ERROR : (milli > 1s) ? WARNING : VERBOSE)
+            << "sample " << llkFormat(milli) << " cpu=" << cpu.count() << "us"
+            << " tasks=" << llkScan.tasks << " opens=" << llkScan.opens
+            << " reads=" << llkScan.reads;
 
     // cap to minimum sleep for 1 second since last cycle
     if (llkCycle < (ms + 1s)) {
@@ -1363,6 +1448,19 @@ bool llkInit(const char* threadname) {
 
     llkIgnorelistUid = llkSplit(LLK_IGNORELIST_UID_PROPERTY, LLK_IGNORELIST_UID_DEFAULT);
 
+    // Keep /proc/<tid>/stat open between checks for as many tasks as the
+    // descriptor limit allows, leaving headroom for everything else.
+    rlimit rl;
+    if (!getrlimit(RLIMIT_NOFILE, &rl)) {
+        if (rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+            getrlimit(RLIMIT_NOFILE, &rl);
+        }
+        static constexpr rlim_t reserve = 128;
+        llkStatFdMax = (rl.rlim_cur > reserve) ? (rl.rlim_cur - reserve) : 0;
+    }
+
     // internal watchdog
     ::signal(SIGALRM, llkAlarmHandler);
 
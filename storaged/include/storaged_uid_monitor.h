@@ -19,7 +19,11 @@
 
 #include <stdint.h>
 
+#include <deque>
+#include <functional>
+#include <map>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -39,7 +43,7 @@ using namespace android::os::storaged;
 
 class uid_info : public UidInfo {
 public:
-    bool parse_uid_io_stats(string&& s);
+    bool parse_uid_io_stats(string_view s);
 };
 
 class io_usage {
@@ -76,6 +80,73 @@ struct uid_records {
     vector<uid_record> entries;
 };
 
+// Compact history of uid I/O records, keyed by the end timestamp of each
+// period. Names are interned and each period keeps its records as
+// varint-encoded columns, so a record with little I/O takes a few bytes.
+// Records are decoded on demand. The counters are stored as they are rather
+// than as deltas against the previous period: they are already per-period
+// usage, and periods are erased independently of each other.
+class uid_io_history {
+public:
+    size_t size() const { return periods_.size(); }
+    size_t count(uint64_t end_ts) const { return periods_.count(end_ts); }
+    // number of records over all periods
+    size_t num_entries() const { return num_entries_; }
+    // number of distinct uid and task names still referenced
+    size_t num_names() const { return name_ids_.size(); }
+    void clear();
+
+    // replaces the records of the period ending at end_ts
+    void set(uint64_t end_ts, const uid_records& records);
+    // adds records to the period ending at end_ts, creating it if needed
+    void append(uint64_t end_ts, uint64_t start_ts, const vector<uid_record>& entries);
+    // returns false if no period ends at end_ts
+    bool get(uint64_t end_ts, uid_records* records) const;
+    // visits the periods ending at or after first_ts, oldest first
+    void for_each(uint64_t first_ts,
+                  const function<void(uint64_t, const uid_records&)>& fn) const;
+
+    // removes the periods ending before ts
+    void erase_before(uint64_t ts);
+    // removes the oldest period and returns its number of records
+    size_t erase_oldest();
+    void remove_user(userid_t user_id);
+
+    // bytes used by encoded records and interned names
+    size_t memory_usage() const;
+
+private:
+    struct period {
+        uint64_t start_ts = 0;
+        uint32_t num_entries = 0;
+        // one name id and user id per record
+        vector<uint8_t> names;
+        vector<uint8_t> user_ids;
+        // the io_usage counters of each record
+        vector<uint8_t> uid_ios;
+        // per record, the number of tasks followed by each task's name id
+        // and io_usage counters
+        vector<uint8_t> tasks;
+    };
+
+    uint32_t intern(const string& name);
+    void release_name(uint32_t id);
+    void encode(const vector<uid_record>& entries, period* p);
+    void decode(const period& p, uid_records* records) const;
+    // drops the name references held by the records of p
+    void release(const period& p);
+
+    map<uint64_t, period> periods_;
+    size_t num_entries_ = 0;
+    // interned uid and task names; a deque keeps name_ids_ keys valid
+    deque<string> names_;
+    unordered_map<string_view, uint32_t> name_ids_;
+    // number of encoded references to each name; unreferenced names are
+    // dropped and their ids reused
+    vector<uint32_t> name_refs_;
+    vector<uint32_t> free_name_ids_;
+};
+
 class uid_monitor {
 private:
     FRIEND_TEST(storaged_test, uid_monitor);
@@ -86,7 +157,9 @@ private:
     // current io usage for next report, app name -> uid_io_usage
     unordered_map<string, uid_io_usage> curr_io_stats_;
     // io usage records, end timestamp -> {start timestamp, vector of records}
-    map<uint64_t, uid_records> io_history_;
+    uid_io_history io_history_;
+    // reused for each read of /proc/uid_io/stats
+    string uid_io_stats_buffer_;
     // charger ON/OFF
     charger_stat_t charger_stat_;
     // protects curr_io_stats, last_uid_io_stats, records and charger_stat
@@ -127,7 +200,7 @@ public:
     void load_uid_io_proto(userid_t user_id, const UidIOUsage& proto);
     void clear_user_history(userid_t user_id);
 
-    map<uint64_t, uid_records>& io_history() { return io_history_; }
+    uid_io_history& io_history() { return io_history_; }
 
     static constexpr int MAX_UID_RECORDS_SIZE = 1000 * 48; // 1000 uids in 48 hours
 };
@@ -19,6 +19,7 @@
 #include <stdint.h>
 #include <time.h>
 
+#include <charconv>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
@@ -27,8 +28,6 @@
 #include <android-base/file.h>
 #include <android-base/logging.h>
 #include <android-base/macros.h>
-#include <android-base/parseint.h>
-#include <android-base/strings.h>
 #include <android-base/stringprintf.h>
 #include <binder/IServiceManager.h>
 #include <log/log_event_list.h>
@@ -55,22 +54,45 @@ std::unordered_map<uint32_t, uid_info> uid_monitor::get_uid_io_stats()
     return get_uid_io_stats_locked();
 };
 
+namespace {
+
+template <typename T>
+bool parse_field(std::string_view field, T* out)
+{
+    const char* end = field.data() + field.size();
+    auto [ptr, ec] = std::from_chars(field.data(), end, *out);
+    return ec == std::errc() && ptr == end;
+}
+
+/* parses the next space separated field of s and removes it from s */
+template <typename T>
+bool consume_field(std::string_view* s, T* out)
+{
+    size_t sep = s->find(' ');
+    if (!parse_field(s->substr(0, sep), out)) {
+        return false;
+    }
+    s->remove_prefix(sep == std::string_view::npos ? s->size() : sep + 1);
+    return true;
+}
+
+} // namespace
+
 /* return true on parse success and false on failure */
-bool uid_info::parse_uid_io_stats(std::string&& s)
-{
-    std::vector<std::string> fields = Split(s, " ");
-    if (fields.size() < 11 ||
-        !ParseUint(fields[0],  &uid) ||
-        !ParseUint(fields[1],  &io[FOREGROUND].rchar) ||
-        !ParseUint(fields[2],  &io[FOREGROUND].wchar) ||
-        !ParseUint(fields[3],  &io[FOREGROUND].read_bytes) ||
-        !ParseUint(fields[4],  &io[FOREGROUND].write_bytes) ||
-        !ParseUint(fields[5],  &io[BACKGROUND].rchar) ||
-        !ParseUint(fields[6],  &io[BACKGROUND].wchar) ||
-        !ParseUint(fields[7],  &io[BACKGROUND].read_bytes) ||
-        !ParseUint(fields[8],  &io[BACKGROUND].write_bytes) ||
-        !ParseUint(fields[9],  &io[FOREGROUND].fsync) ||
-        !ParseUint(fields[10], &io[BACKGROUND].fsync)) {
+bool uid_info::parse_uid_io_stats(std::string_view s)
+{
+    std::string_view fields = s;
+    if (!consume_field(&fields, &uid) ||
+        !consume_field(&fields, &io[FOREGROUND].rchar) ||
+        !consume_field(&fields, &io[FOREGROUND].wchar) ||
+        !consume_field(&fields, &io[FOREGROUND].read_bytes) ||
+        !consume_field(&fields, &io[FOREGROUND].write_bytes) ||
+        !consume_field(&fields, &io[BACKGROUND].rchar) ||
+        !consume_field(&fields, &io[BACKGROUND].wchar) ||
+        !consume_field(&fields, &io[BACKGROUND].read_bytes) ||
+        !consume_field(&fields, &io[BACKGROUND].write_bytes) ||
+        !consume_field(&fields, &io[FOREGROUND].fsync) ||
+        !consume_field(&fields, &io[BACKGROUND].fsync)) {
         LOG(WARNING) << "Invalid uid I/O stats: \"" << s << "\"";
         return false;
     }
@@ -78,27 +100,37 @@ bool uid_info::parse_uid_io_stats(std::string&& s)
 }
 
 /* return true on parse success and false on failure */
-bool task_info::parse_task_io_stats(std::string&& s)
-{
-    std::vector<std::string> fields = Split(s, ",");
-    size_t size = fields.size();
-    if (size < 13 ||
-        !ParseInt(fields[size - 11],  &pid) ||
-        !ParseUint(fields[size - 10],  &io[FOREGROUND].rchar) ||
-        !ParseUint(fields[size - 9],  &io[FOREGROUND].wchar) ||
-        !ParseUint(fields[size - 8],  &io[FOREGROUND].read_bytes) ||
-        !ParseUint(fields[size - 7],  &io[FOREGROUND].write_bytes) ||
-        !ParseUint(fields[size - 6],  &io[BACKGROUND].rchar) ||
-        !ParseUint(fields[size - 5],  &io[BACKGROUND].wchar) ||
-        !ParseUint(fields[size - 4],  &io[BACKGROUND].read_bytes) ||
-        !ParseUint(fields[size - 3], &io[BACKGROUND].write_bytes) ||
-        !ParseUint(fields[size - 2], &io[FOREGROUND].fsync) ||
-        !ParseUint(fields[size - 1], &io[BACKGROUND].fsync)) {
+bool task_info::parse_task_io_stats(std::string_view s)
+{
+    // The task name may contain commas, so take the numbers from the end.
+    std::string_view fields[11];
+    std::string_view rest = s;
+    for (int i = 10; i >= 0; i--) {
+        size_t sep = rest.rfind(',');
+        if (sep == std::string_view::npos) {
+            rest = {};
+            break;
+        }
+        fields[i] = rest.substr(sep + 1);
+        rest = rest.substr(0, sep);
+    }
+    size_t comm_start = rest.find(',');
+    if (comm_start == std::string_view::npos ||
+        !parse_field(fields[0], &pid) ||
+        !parse_field(fields[1], &io[FOREGROUND].rchar) ||
+        !parse_field(fields[2], &io[FOREGROUND].wchar) ||
+        !parse_field(fields[3], &io[FOREGROUND].read_bytes) ||
+        !parse_field(fields[4], &io[FOREGROUND].write_bytes) ||
+        !parse_field(fields[5], &io[BACKGROUND].rchar) ||
+        !parse_field(fields[6], &io[BACKGROUND].wchar) ||
+        !parse_field(fields[7], &io[BACKGROUND].read_bytes) ||
+        !parse_field(fields[8], &io[BACKGROUND].write_bytes) ||
+        !parse_field(fields[9], &io[FOREGROUND].fsync) ||
+        !parse_field(fields[10], &io[BACKGROUND].fsync)) {
         LOG(WARNING) << "Invalid task I/O stats: \"" << s << "\"";
         return false;
     }
-    comm = Join(std::vector<std::string>(
-                fields.begin() + 1, fields.end() - 11), ',');
+    comm = rest.substr(comm_start + 1);
     return true;
 }
 
@@ -153,37 +185,42 @@ void get_uid_names(const vector<int>& uids, const vector<std::string*>& uid_name
 std::unordered_map<uint32_t, uid_info> uid_monitor::get_uid_io_stats_locked()
 {
     std::unordered_map<uint32_t, uid_info> uid_io_stats;
-    std::string buffer;
-    if (!ReadFileToString(UID_IO_STATS_PATH, &buffer)) {
+    if (!ReadFileToString(UID_IO_STATS_PATH, &uid_io_stats_buffer_)) {
         PLOG(ERROR) << UID_IO_STATS_PATH << ": ReadFileToString failed";
         return uid_io_stats;
     }
 
-    std::vector<std::string> io_stats = Split(std::move(buffer), "\n");
+    // Walk the lines in place, rather than splitting the file into strings.
+    std::string_view io_stats = uid_io_stats_buffer_;
     uid_info u;
     vector<int> uids;
     vector<std::string*> uid_names;
 
-    for (uint32_t i = 0; i < io_stats.size(); i++) {
-        if (io_stats[i].empty()) {
+    while (!io_stats.empty()) {
+        size_t eol = io_stats.find('\n');
+        std::string_view line = io_stats.substr(0, eol);
+        io_stats.remove_prefix(eol == std::string_view::npos ? io_stats.size() : eol + 1);
+        if (line.empty()) {
             continue;
         }
 
-        if (io_stats[i].compare(0, 4, "task")) {
-            if (!u.parse_uid_io_stats(std::move(io_stats[i])))
+        if (line.compare(0, 4, "task")) {
+            if (!u.parse_uid_io_stats(line))
                 continue;
-            uid_io_stats[u.uid] = u;
-            uid_io_stats[u.uid].name = std::to_string(u.uid);
+            uid_info& info = uid_io_stats[u.uid];
+            info = u;
             uids.push_back(u.uid);
-            uid_names.push_back(&uid_io_stats[u.uid].name);
-            if (last_uid_io_stats_.find(u.uid) == last_uid_io_stats_.end()) {
+            uid_names.push_back(&info.name);
+            auto last = last_uid_io_stats_.find(u.uid);
+            if (last == last_uid_io_stats_.end()) {
+                info.name = std::to_string(u.uid);
                 refresh_uid_names = true;
             } else {
-                uid_io_stats[u.uid].name = last_uid_io_stats_[u.uid].name;
+                info.name = last->second.name;
             }
         } else {
             task_info t;
-            if (!t.parse_task_io_stats(std::move(io_stats[i])))
+            if (!t.parse_task_io_stats(line))
                 continue;
             uid_io_stats[u.uid].tasks[t.pid] = t;
         }
@@ -198,24 +235,259 @@ std::unordered_map<uint32_t, uid_info> uid_monitor::get_uid_io_stats_locked()
 
 namespace {
 
-inline size_t history_size(
-    const std::map<uint64_t, struct uid_records>& history)
+constexpr size_t IO_USAGE_COUNTERS = IO_TYPES * UID_STATS * CHARGER_STATS;
+
+void put_varint(vector<uint8_t>* out, uint64_t value)
 {
-    size_t count = 0;
-    for (auto const& it : history) {
-        count += it.second.entries.size();
+    while (value >= 0x80) {
+        out->push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out->push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t get_varint(const uint8_t** in)
+{
+    uint64_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = *(*in)++;
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+}
+
+void put_io_usage(vector<uint8_t>* out, const io_usage& usage)
+{
+    const uint64_t* counters = &usage.bytes[0][0][0];
+    for (size_t i = 0; i < IO_USAGE_COUNTERS; i++) {
+        put_varint(out, counters[i]);
+    }
+}
+
+void get_io_usage(const uint8_t** in, io_usage* usage)
+{
+    uint64_t* counters = &usage->bytes[0][0][0];
+    for (size_t i = 0; i < IO_USAGE_COUNTERS; i++) {
+        counters[i] = get_varint(in);
     }
-    return count;
 }
 
 } // namespace
 
+void uid_io_history::clear()
+{
+    periods_.clear();
+    num_entries_ = 0;
+    name_ids_.clear();
+    names_.clear();
+    name_refs_.clear();
+    free_name_ids_.clear();
+}
+
+uint32_t uid_io_history::intern(const std::string& name)
+{
+    auto it = name_ids_.find(name);
+    if (it != name_ids_.end()) {
+        name_refs_[it->second]++;
+        return it->second;
+    }
+    uint32_t id;
+    if (!free_name_ids_.empty()) {
+        id = free_name_ids_.back();
+        free_name_ids_.pop_back();
+        names_[id] = name;
+        name_refs_[id] = 1;
+    } else {
+        id = names_.size();
+        names_.emplace_back(name);
+        name_refs_.push_back(1);
+    }
+    name_ids_.emplace(names_[id], id);
+    return id;
+}
+
+void uid_io_history::release_name(uint32_t id)
+{
+    if (--name_refs_[id] > 0) {
+        return;
+    }
+    name_ids_.erase(names_[id]);
+    string().swap(names_[id]);
+    free_name_ids_.push_back(id);
+}
+
+void uid_io_history::release(const period& p)
+{
+    const uint8_t* names = p.names.data();
+    const uint8_t* tasks = p.tasks.data();
+    io_usage usage;
+    for (uint32_t i = 0; i < p.num_entries; i++) {
+        release_name(get_varint(&names));
+        for (uint64_t n = get_varint(&tasks); n > 0; n--) {
+            release_name(get_varint(&tasks));
+            get_io_usage(&tasks, &usage);
+        }
+    }
+}
+
+void uid_io_history::encode(const vector<uid_record>& entries, period* p)
+{
+    for (const auto& entry : entries) {
+        put_varint(&p->names, intern(entry.name));
+        put_varint(&p->user_ids, entry.ios.user_id);
+        put_io_usage(&p->uid_ios, entry.ios.uid_ios);
+        put_varint(&p->tasks, entry.ios.task_ios.size());
+        for (const auto& task_io : entry.ios.task_ios) {
+            put_varint(&p->tasks, intern(task_io.first));
+            put_io_usage(&p->tasks, task_io.second);
+        }
+    }
+    p->names.shrink_to_fit();
+    p->user_ids.shrink_to_fit();
+    p->uid_ios.shrink_to_fit();
+    p->tasks.shrink_to_fit();
+    p->num_entries += entries.size();
+    num_entries_ += entries.size();
+}
+
+void uid_io_history::decode(const period& p, uid_records* records) const
+{
+    records->start_ts = p.start_ts;
+    records->entries.resize(p.num_entries);
+
+    const uint8_t* names = p.names.data();
+    const uint8_t* user_ids = p.user_ids.data();
+    const uint8_t* uid_ios = p.uid_ios.data();
+    const uint8_t* tasks = p.tasks.data();
+    for (auto& entry : records->entries) {
+        entry.name = names_[get_varint(&names)];
+        entry.ios.user_id = get_varint(&user_ids);
+        get_io_usage(&uid_ios, &entry.ios.uid_ios);
+        entry.ios.task_ios.clear();
+        for (uint64_t n = get_varint(&tasks); n > 0; n--) {
+            const std::string& task_name = names_[get_varint(&tasks)];
+            get_io_usage(&tasks, &entry.ios.task_ios[task_name]);
+        }
+    }
+}
+
+void uid_io_history::set(uint64_t end_ts, const uid_records& records)
+{
+    auto it = periods_.find(end_ts);
+    if (it != periods_.end()) {
+        num_entries_ -= it->second.num_entries;
+        release(it->second);
+        periods_.erase(it);
+    }
+    period& p = periods_[end_ts];
+    p.start_ts = records.start_ts;
+    encode(records.entries, &p);
+}
+
+void uid_io_history::append(uint64_t end_ts, uint64_t start_ts,
+                            const vector<uid_record>& entries)
+{
+    period& p = periods_[end_ts];
+    p.start_ts = start_ts;
+    encode(entries, &p);
+}
+
+bool uid_io_history::get(uint64_t end_ts, uid_records* records) const
+{
+    auto it = periods_.find(end_ts);
+    if (it == periods_.end()) {
+        return false;
+    }
+    decode(it->second, records);
+    return true;
+}
+
+void uid_io_history::for_each(
+    uint64_t first_ts, const function<void(uint64_t, const uid_records&)>& fn) const
+{
+    uid_records records;
+    for (auto it = periods_.lower_bound(first_ts); it != periods_.end(); ++it) {
+        decode(it->second, &records);
+        fn(it->first, records);
+    }
+}
+
+void uid_io_history::erase_before(uint64_t ts)
+{
+    auto end = periods_.lower_bound(ts);
+    for (auto it = periods_.begin(); it != end; ++it) {
+        num_entries_ -= it->second.num_entries;
+        release(it->second);
+    }
+    periods_.erase(periods_.begin(), end);
+}
+
+size_t uid_io_history::erase_oldest()
+{
+    if (periods_.empty()) {
+        return 0;
+    }
+    size_t count = periods_.begin()->second.num_entries;
+    num_entries_ -= count;
+    release(periods_.begin()->second);
+    periods_.erase(periods_.begin());
+    return count;
+}
+
+void uid_io_history::remove_user(userid_t user_id)
+{
+    uid_records records;
+    for (auto it = periods_.begin(); it != periods_.end(); ) {
+        decode(it->second, &records);
+        auto& entries = records.entries;
+        entries.erase(
+            remove_if(entries.begin(), entries.end(),
+                [user_id](const uid_record& rec) {
+                    return rec.ios.user_id == user_id;}),
+            entries.end());
+
+        if (entries.size() == it->second.num_entries) {
+            it++;
+            continue;
+        }
+        num_entries_ -= it->second.num_entries;
+        release(it->second);
+        if (entries.empty()) {
+            it = periods_.erase(it);
+            continue;
+        }
+        it->second = {};
+        it->second.start_ts = records.start_ts;
+        encode(entries, &it->second);
+        it++;
+    }
+}
+
+size_t uid_io_history::memory_usage() const
+{
+    size_t bytes = 0;
+    for (const auto& it : periods_) {
+        const period& p = it.second;
+        bytes += sizeof(it) + p.names.capacity() + p.user_ids.capacity() +
+                 p.uid_ios.capacity() + p.tasks.capacity();
+    }
+    for (const auto& name : names_) {
+        bytes += sizeof(name) + sizeof(uint32_t);
+        if (name.capacity() > sizeof(name)) {
+            bytes += name.capacity();
+        }
+    }
+    bytes += (name_refs_.capacity() + free_name_ids_.capacity()) * sizeof(uint32_t);
+    return bytes;
+}
+
 void uid_monitor::add_records_locked(uint64_t curr_ts)
 {
     // remove records more than 5 days old
     if (curr_ts > 5 * DAY_TO_SEC) {
-        auto it = io_history_.lower_bound(curr_ts - 5 * DAY_TO_SEC);
-        io_history_.erase(io_history_.begin(), it);
+        io_history_.erase_before(curr_ts - 5 * DAY_TO_SEC);
     }
 
     struct uid_records new_records;
@@ -243,15 +515,13 @@ void uid_monitor::add_records_locked(uint64_t curr_ts)
     // make some room for new records
     maybe_shrink_history_for_items(new_records.entries.size());
 
-    io_history_[curr_ts] = new_records;
+    io_history_.set(curr_ts, new_records);
 }
 
 void uid_monitor::maybe_shrink_history_for_items(size_t nitems) {
-    ssize_t overflow = history_size(io_history_) + nitems - MAX_UID_RECORDS_SIZE;
+    ssize_t overflow = io_history_.num_entries() + nitems - MAX_UID_RECORDS_SIZE;
     while (overflow > 0 && io_history_.size() > 0) {
-        auto del_it = io_history_.begin();
-        overflow -= del_it->second.entries.size();
-        io_history_.erase(io_history_.begin());
+        overflow -= io_history_.erase_oldest();
     }
 }
 
@@ -271,8 +541,8 @@ std::map<uint64_t, struct uid_records> uid_monitor::dump(
         first_ts = time(NULL) - hours * HOUR_TO_SEC;
     }
 
-    for (auto it = io_history_.lower_bound(first_ts); it != io_history_.end(); ++it) {
-        const std::vector<struct uid_record>& recs = it->second.entries;
+    io_history_.for_each(first_ts, [&](uint64_t end_ts, const uid_records& records) {
+        const std::vector<struct uid_record>& recs = records.entries;
         struct uid_records filtered;
 
         for (const auto& rec : recs) {
@@ -290,12 +560,12 @@ std::map<uint64_t, struct uid_records> uid_monitor::dump(
         }
 
         if (filtered.entries.empty())
-            continue;
+            return;
 
-        filtered.start_ts = it->second.start_ts;
+        filtered.start_ts = records.start_ts;
         dump_records.insert(
-            std::pair<uint64_t, struct uid_records>(it->first, filtered));
-    }
+            std::pair<uint64_t, struct uid_records>(end_ts, filtered));
+    });
 
     return dump_records;
 }
@@ -407,9 +677,7 @@ void get_io_usage_proto(io_usage* usage, const IOUsage& io_proto)
 
 void uid_monitor::update_uid_io_proto(unordered_map<int, StoragedProto>* protos)
 {
-    for (const auto& item : io_history_) {
-        const uint64_t& end_ts = item.first;
-        const struct uid_records& recs = item.second;
+    io_history_.for_each(0, [&](uint64_t end_ts, const uid_records& recs) {
         unordered_map<userid_t, UidIOItem*> user_items;
 
         for (const auto& entry : recs.entries) {
@@ -442,29 +710,14 @@ void uid_monitor::update_uid_io_proto(unordered_map<int, StoragedProto>* protos)
                 set_io_usage_proto(task_io_proto->mutable_ios(), task_ios);
             }
         }
-    }
+    });
 }
 
 void uid_monitor::clear_user_history(userid_t user_id)
 {
     Mutex::Autolock _l(uidm_mutex_);
 
-    for (auto& item : io_history_) {
-        vector<uid_record>* entries = &item.second.entries;
-        entries->erase(
-            remove_if(entries->begin(), entries->end(),
-                [user_id](const uid_record& rec) {
-                    return rec.ios.user_id == user_id;}),
-            entries->end());
-    }
-
-    for (auto it = io_history_.begin(); it != io_history_.end(); ) {
-        if (it->second.entries.empty()) {
-            it = io_history_.erase(it);
-        } else {
-            it++;
-        }
-    }
+    io_history_.remove_user(user_id);
 }
 
 void uid_monitor::load_uid_io_proto(userid_t user_id, const UidIOUsage& uid_io_proto)
@@ -475,20 +728,21 @@ void uid_monitor::load_uid_io_proto(userid_t user_id, const UidIOUsage& uid_io_p
 
     for (const auto& item_proto : uid_io_proto.uid_io_items()) {
         const UidIORecords& records_proto = item_proto.records();
-        struct uid_records* recs = &io_history_[item_proto.end_ts()];
+        struct uid_records existing = {};
+        io_history_.get(item_proto.end_ts(), &existing);
 
         // It's possible that the same uid_io_proto file gets loaded more than
         // once, for example, if system_server crashes. In this case we avoid
         // adding duplicate entries, so we build a quick way to check for
         // duplicates.
         std::unordered_set<std::string> existing_uids;
-        for (const auto& rec : recs->entries) {
+        for (const auto& rec : existing.entries) {
             if (rec.ios.user_id == user_id) {
                 existing_uids.emplace(rec.name);
             }
         }
 
-        recs->start_ts = records_proto.start_ts();
+        std::vector<struct uid_record> new_entries;
         for (const auto& rec_proto : records_proto.entries()) {
             if (existing_uids.find(rec_proto.uid_name()) != existing_uids.end()) {
                 continue;
@@ -504,8 +758,9 @@ void uid_monitor::load_uid_io_proto(userid_t user_id, const UidIOUsage& uid_io_p
                     &record.ios.task_ios[task_io_proto.task_name()],
                     task_io_proto.ios());
             }
-            recs->entries.push_back(record);
+            new_entries.push_back(record);
         }
+        io_history_.append(item_proto.end_ts(), records_proto.start_ts(), new_entries);
 
         // We already added items, so this will just cull down to the maximum
         // length. We do not remove anything if there is only one entry.
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2020 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <random>
+#include <string>
+#include <string_view>
+
+#include <benchmark/benchmark.h>
+
+#include <storaged.h>
+
+using namespace std;
+
+namespace {
+
+// Builds the text of /proc/uid_io/stats for |num_uids| uids with two tasks each.
+string make_uid_io_stats(int num_uids)
+{
+    mt19937_64 random(num_uids);
+    string stats;
+    for (int i = 0; i < num_uids; i++) {
+        stats += to_string(10000 + i);
+        for (int j = 0; j < 10; j++) {
+            stats += " " + to_string(random() % (1ULL << 32));
+        }
+        stats += "\n";
+        for (int t = 0; t < 2; t++) {
+            stats += "task,worker,thread-" + to_string(t) + "," + to_string(i * 10 + t);
+            for (int j = 0; j < 10; j++) {
+                stats += "," + to_string(random() % (1ULL << 24));
+            }
+            stats += "\n";
+        }
+    }
+    return stats;
+}
+
+// One hour of records for |num_uids| apps, as add_records_locked builds them.
+uid_records make_records(int num_uids, uint64_t start_ts, mt19937_64* random)
+{
+    uid_records records;
+    records.start_ts = start_ts;
+    for (int i = 0; i < num_uids; i++) {
+        uid_record record;
+        record.name = "com.example.app" + to_string(i);
+        record.ios.user_id = 0;
+        record.ios.uid_ios.bytes[READ][FOREGROUND][CHARGER_OFF] = (*random)() % (64 << 20);
+        record.ios.uid_ios.bytes[WRITE][BACKGROUND][CHARGER_OFF] = (*random)() % (1 << 20);
+        record.ios.task_ios["RenderThread"].bytes[READ][FOREGROUND][CHARGER_OFF] =
+                (*random)() % (16 << 20);
+        records.entries.push_back(record);
+    }
+    return records;
+}
+
+} // namespace
+
+static void BM_ParseUidIoStats(benchmark::State& state)
+{
+    const string stats = make_uid_io_stats(state.range(0));
+
+    for (auto _ : state) {
+        uid_info u;
+        task_info t;
+        string_view rest = stats;
+        while (!rest.empty()) {
+            size_t end = rest.find('\n');
+            string_view line = rest.substr(0, end);
+            rest.remove_prefix(end == string_view::npos ? rest.size() : end + 1);
+            if (line.compare(0, 5, "task,") == 0) {
+                benchmark::DoNotOptimize(t.parse_task_io_stats(line));
+            } else {
+                benchmark::DoNotOptimize(u.parse_uid_io_stats(line));
+            }
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * stats.size());
+}
+BENCHMARK(BM_ParseUidIoStats)->Arg(100)->Arg(1000);
+
+// Fills two days of hourly history and reads it back the way dump() does.
+static void BM_UidIoHistory(benchmark::State& state)
+{
+    const int num_uids = state.range(0);
+    mt19937_64 random(num_uids);
+    vector<uid_records> hours;
+    for (uint64_t h = 0; h < 48; h++) {
+        hours.push_back(make_records(num_uids, h * 3600, &random));
+    }
+
+    size_t memory = 0;
+    for (auto _ : state) {
+        uid_io_history history;
+        for (uint64_t h = 0; h < hours.size(); h++) {
+            history.set((h + 1) * 3600, hours[h]);
+        }
+        uint64_t total = 0;
+        history.for_each(0, [&](uint64_t, const uid_records& records) {
+            for (const auto& record : records.entries) {
+                total += record.ios.uid_ios.bytes[READ][FOREGROUND][CHARGER_OFF];
+            }
+        });
+        benchmark::DoNotOptimize(total);
+        memory = history.memory_usage();
+    }
+    state.counters["bytes_per_record"] = static_cast<double>(memory) / (48 * num_uids);
+}
+BENCHMARK(BM_UidIoHistory)->Arg(100)->Arg(1000);
+
+BENCHMARK_MAIN();
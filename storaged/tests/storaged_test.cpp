@@ -445,7 +445,7 @@ TEST(storaged_test, uid_monitor) {
     uid_monitor uidm;
     auto& io_history = uidm.io_history();
 
-    io_history[200] = {
+    io_history.set(200, {
         .start_ts = 100,
         .entries = {
             { "app1", {
@@ -465,9 +465,9 @@ TEST(storaged_test, uid_monitor) {
               }
             },
         },
-    };
+    });
 
-    io_history[300] = {
+    io_history.set(300, {
         .start_ts = 200,
         .entries = {
             { "app1", {
@@ -481,7 +481,7 @@ TEST(storaged_test, uid_monitor) {
               }
             },
         },
-    };
+    });
 
     unordered_map<int, StoragedProto> protos;
 
@@ -529,7 +529,7 @@ TEST(storaged_test, uid_monitor) {
 
     io_history.clear();
 
-    io_history[300] = {
+    io_history.set(300, {
         .start_ts = 200,
         .entries = {
             { "app1", {
@@ -538,9 +538,9 @@ TEST(storaged_test, uid_monitor) {
               }
             },
         },
-    };
+    });
 
-    io_history[400] = {
+    io_history.set(400, {
         .start_ts = 300,
         .entries = {
             { "app1", {
@@ -549,7 +549,7 @@ TEST(storaged_test, uid_monitor) {
               }
             },
         },
-    };
+    });
 
     uidm.load_uid_io_proto(0, protos[0].uid_io_usage());
     uidm.load_uid_io_proto(1, protos[1].uid_io_usage());
@@ -559,8 +559,10 @@ TEST(storaged_test, uid_monitor) {
     EXPECT_EQ(io_history.count(300), 1UL);
     EXPECT_EQ(io_history.count(400), 1UL);
 
-    EXPECT_EQ(io_history[200].start_ts, 100UL);
-    const vector<struct uid_record>& entries_0 = io_history[200].entries;
+    uid_records records_0;
+    ASSERT_TRUE(io_history.get(200, &records_0));
+    EXPECT_EQ(records_0.start_ts, 100UL);
+    const vector<struct uid_record>& entries_0 = records_0.entries;
     EXPECT_EQ(entries_0.size(), 3UL);
     EXPECT_EQ(entries_0[0].name, "app1");
     EXPECT_EQ(entries_0[0].ios.user_id, 0UL);
@@ -573,8 +575,10 @@ TEST(storaged_test, uid_monitor) {
     EXPECT_EQ(entries_0[2].ios.uid_ios.bytes[WRITE][FOREGROUND][CHARGER_ON], 1000UL);
     EXPECT_EQ(entries_0[2].ios.uid_ios.bytes[READ][FOREGROUND][CHARGER_ON], 1000UL);
 
-    EXPECT_EQ(io_history[300].start_ts, 200UL);
-    const vector<struct uid_record>& entries_1 = io_history[300].entries;
+    uid_records records_1;
+    ASSERT_TRUE(io_history.get(300, &records_1));
+    EXPECT_EQ(records_1.start_ts, 200UL);
+    const vector<struct uid_record>& entries_1 = records_1.entries;
     EXPECT_EQ(entries_1.size(), 3UL);
     EXPECT_EQ(entries_1[0].name, "app1");
     EXPECT_EQ(entries_1[0].ios.user_id, 0UL);
@@ -586,8 +590,10 @@ TEST(storaged_test, uid_monitor) {
     EXPECT_EQ(entries_1[2].ios.user_id, 1UL);
     EXPECT_EQ(entries_1[2].ios.uid_ios.bytes[WRITE][FOREGROUND][CHARGER_OFF], 1000UL);
 
-    EXPECT_EQ(io_history[400].start_ts, 300UL);
-    const vector<struct uid_record>& entries_2 = io_history[400].entries;
+    uid_records records_2;
+    ASSERT_TRUE(io_history.get(400, &records_2));
+    EXPECT_EQ(records_2.start_ts, 300UL);
+    const vector<struct uid_record>& entries_2 = records_2.entries;
     EXPECT_EQ(entries_2.size(), 1UL);
     EXPECT_EQ(entries_2[0].name, "app1");
     EXPECT_EQ(entries_2[0].ios.user_id, 0UL);
@@ -620,8 +626,10 @@ TEST(storaged_test, uid_monitor) {
     EXPECT_EQ(io_history.count(200), 1UL);
     EXPECT_EQ(io_history.count(300), 1UL);
 
-    EXPECT_EQ(io_history[200].entries.size(), 1UL);
-    EXPECT_EQ(io_history[300].entries.size(), 1UL);
+    ASSERT_TRUE(io_history.get(200, &records_0));
+    EXPECT_EQ(records_0.entries.size(), 1UL);
+    ASSERT_TRUE(io_history.get(300, &records_1));
+    EXPECT_EQ(records_1.entries.size(), 1UL);
 
     uidm.clear_user_history(1);
 
@@ -633,7 +641,7 @@ TEST(storaged_test, load_uid_io_proto) {
     auto& io_history = uidm.io_history();
 
     static const uint64_t kProtoTime = 200;
-    io_history[kProtoTime] = {
+    io_history.set(kProtoTime, {
         .start_ts = 100,
         .entries = {
             { "app1", {
@@ -652,7 +660,7 @@ TEST(storaged_test, load_uid_io_proto) {
               }
             },
         },
-    };
+    });
 
     unordered_map<int, StoragedProto> protos;
     uidm.update_uid_io_proto(&protos);
@@ -664,16 +672,17 @@ TEST(storaged_test, load_uid_io_proto) {
         uidm.load_uid_io_proto(0, user_0);
     }
     ASSERT_EQ(io_history.size(), size_t(1));
-    ASSERT_EQ(io_history[kProtoTime].entries.size(), size_t(3));
+    uid_records record;
+    ASSERT_TRUE(io_history.get(kProtoTime, &record));
+    ASSERT_EQ(record.entries.size(), size_t(3));
 
     // Create duplicate entries until we go over the limit.
-    auto record = io_history[kProtoTime];
     io_history.clear();
     for (size_t i = 0; i < uid_monitor::MAX_UID_RECORDS_SIZE * 2; i++) {
         if (i == kProtoTime) {
             continue;
         }
-        io_history[i] = record;
+        io_history.set(i, record);
     }
     ASSERT_GT(io_history.size(), size_t(uid_monitor::MAX_UID_RECORDS_SIZE));
 
@@ -684,3 +693,79 @@ TEST(storaged_test, load_uid_io_proto) {
     uidm.load_uid_io_proto(0, user_0);
     ASSERT_LE(io_history.size(), size_t(uid_monitor::MAX_UID_RECORDS_SIZE));
 }
+
+TEST(storaged_test, uid_io_history) {
+    uid_io_history history;
+
+    uid_record record = {};
+    record.name = "com.example.app";
+    record.ios.user_id = 10;
+    record.ios.uid_ios.bytes[READ][FOREGROUND][CHARGER_OFF] = 1;
+    record.ios.uid_ios.bytes[WRITE][BACKGROUND][CHARGER_ON] = UINT64_MAX;
+    record.ios.task_ios["worker"].bytes[WRITE][FOREGROUND][CHARGER_OFF] = 4096;
+    record.ios.task_ios["main"].bytes[READ][BACKGROUND][CHARGER_ON] = 1 << 20;
+    history.set(200, {.start_ts = 100, .entries = {record, record}});
+    history.append(300, 200, {record});
+    EXPECT_EQ(history.size(), 2UL);
+    EXPECT_EQ(history.num_entries(), 3UL);
+
+    uid_records records;
+    ASSERT_TRUE(history.get(200, &records));
+    EXPECT_EQ(records.start_ts, 100UL);
+    ASSERT_EQ(records.entries.size(), 2UL);
+    for (const auto& entry : records.entries) {
+        EXPECT_EQ(entry.name, record.name);
+        EXPECT_EQ(entry.ios.user_id, 10UL);
+        EXPECT_EQ(memcmp(&entry.ios.uid_ios, &record.ios.uid_ios, sizeof(io_usage)), 0);
+        ASSERT_EQ(entry.ios.task_ios.size(), 2UL);
+        EXPECT_EQ(entry.ios.task_ios.at("worker").bytes[WRITE][FOREGROUND][CHARGER_OFF], 4096UL);
+        EXPECT_EQ(entry.ios.task_ios.at("main").bytes[READ][BACKGROUND][CHARGER_ON], 1UL << 20);
+    }
+    EXPECT_FALSE(history.get(250, &records));
+
+    history.erase_before(300);
+    EXPECT_EQ(history.size(), 1UL);
+    EXPECT_EQ(history.num_entries(), 1UL);
+    EXPECT_EQ(history.num_names(), 3UL);
+    history.remove_user(10);
+    EXPECT_EQ(history.size(), 0UL);
+    EXPECT_EQ(history.num_entries(), 0UL);
+    EXPECT_EQ(history.num_names(), 0UL);
+
+    // Names of erased periods are dropped, so a long-running daemon that
+    // sees many short-lived names doesn't keep them all.
+    for (uint64_t ts = 1; ts <= 100; ts++) {
+        uid_record app = {};
+        app.name = "app" + std::to_string(ts);
+        app.ios.task_ios["task" + std::to_string(ts)] = {};
+        history.set(ts, {.start_ts = ts - 1, .entries = {app}});
+        history.erase_before(ts);
+        EXPECT_EQ(history.num_names(), 2UL);
+    }
+    ASSERT_TRUE(history.get(100, &records));
+    ASSERT_EQ(records.entries.size(), 1UL);
+    EXPECT_EQ(records.entries[0].name, "app100");
+    EXPECT_EQ(records.entries[0].ios.task_ios.count("task100"), 1UL);
+    history.erase_oldest();
+    EXPECT_EQ(history.num_names(), 0UL);
+}
+
+TEST(storaged_test, parse_uid_io_stats) {
+    uid_info uid;
+    ASSERT_TRUE(uid.parse_uid_io_stats("10010 1 2 3 4 5 6 7 8 9 10"));
+    EXPECT_EQ(uid.uid, 10010UL);
+    EXPECT_EQ(uid.io[FOREGROUND].rchar, 1UL);
+    EXPECT_EQ(uid.io[BACKGROUND].write_bytes, 8UL);
+    EXPECT_EQ(uid.io[BACKGROUND].fsync, 10UL);
+    EXPECT_FALSE(uid.parse_uid_io_stats("10010 1 2 3 4 5 6 7 8 9"));
+    EXPECT_FALSE(uid.parse_uid_io_stats("10010 1 2 3 4 x 6 7 8 9 10"));
+
+    task_info task;
+    ASSERT_TRUE(task.parse_task_io_stats("task,com.example,app,1234,1,2,3,4,5,6,7,8,9,10"));
+    EXPECT_EQ(task.comm, "com.example,app");
+    EXPECT_EQ(task.pid, 1234);
+    EXPECT_EQ(task.io[FOREGROUND].rchar, 1UL);
+    EXPECT_EQ(task.io[BACKGROUND].fsync, 10UL);
+    EXPECT_FALSE(task.parse_task_io_stats("task,1234,1,2,3,4,5,6,7,8,9,10"));
+    EXPECT_FALSE(task.parse_task_io_stats("task,app,-1,1,2,3,4,5,6,7,8,9,10,x"));
+}